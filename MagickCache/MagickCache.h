@@ -44,55 +44,159 @@ typedef enum
   WildResourceType
 } MagickCacheResourceType;
 
+typedef enum
+{
+  UndefinedChangeType,
+  PutChangeType,
+  DeleteChangeType,
+  ExpireChangeType
+} MagickCacheChangeType;
+
+typedef enum
+{
+  DefaultCursorFlag = 0x0000,
+  NoStatCursorFlag = 0x0001,
+  NoVerifyCursorFlag = 0x0002,
+  SortedCursorFlag = 0x0004
+} MagickCacheCursorFlags;
+
 typedef struct _MagickCache
   MagickCache;
 
 typedef struct _MagickCacheResource
   MagickCacheResource;
 
+typedef struct _MagickCacheCursor
+  MagickCacheCursor;
+
+typedef struct _MagickCacheEntry
+{
+  const char
+    *iri;
+
+  MagickCacheResourceType
+    type;
+
+  size_t
+    columns,
+    rows,
+    extent;
+
+  time_t
+    timestamp,
+    accessed,
+    ttl;
+
+  MagickSizeType
+    hits;
+
+  MagickBooleanType
+    cold;
+} MagickCacheEntry;
+
+typedef struct _MagickCacheChange
+{
+  MagickSizeType
+    sequence;
+
+  MagickCacheChangeType
+    type;
+
+  time_t
+    timestamp;
+
+  const char
+    *iri;
+} MagickCacheChange;
+
+typedef struct _MagickCacheStatistics
+{
+  MagickSizeType
+    hits,
+    misses,
+    extent,
+    count;
+} MagickCacheStatistics;
+
 extern MagickExport char
+  *GetMagickCacheCursorToken(const MagickCacheCursor *),
   *GetMagickCacheException(const MagickCache *,ExceptionType *),
   *GetMagickCacheResourceException(const MagickCacheResource *,ExceptionType *),
   *GetMagickCacheResourceIRI(const MagickCacheResource *),
   *GetMagickCacheResourceMeta(MagickCache *,MagickCacheResource *);
 
+extern MagickExport const char
+  *GetMagickCacheOption(const MagickCache *,const char *);
+
 extern MagickExport Image
   *GetMagickCacheResourceImage(MagickCache *cache,MagickCacheResource *,
-    const char *);
+    const char *),
+  *GetMagickCacheResourceImageFrames(MagickCache *,MagickCacheResource *,
+    const size_t,const size_t,const char *),
+  *GetMagickCacheResourceImageLevel(MagickCache *,MagickCacheResource *,
+    const size_t,const char *),
+  *GetMagickCacheResourceImageRegions(MagickCache *,MagickCacheResource *,
+    const char **,const size_t);
 
 extern MagickExport MagickBooleanType
   ClearMagickCacheException(MagickCache *),
-  ClearMagickCacheResource(MagickCacheResource *),
+  ClearMagickCacheResourceException(MagickCacheResource *),
   CreateMagickCache(const char *,const StringInfo *),
   DeleteMagickCacheResource(MagickCache *,MagickCacheResource *),
+  EvictMagickCacheResources(MagickCache *),
   GetMagickCacheResource(MagickCache *,MagickCacheResource *),
   GetMagickCacheResourceID(MagickCache *,const size_t,char *),
+  GetMagickCacheStatistics(MagickCache *,MagickCacheStatistics *),
   IdentifyMagickCacheResource(MagickCache *,MagickCacheResource *,FILE *),
   IsMagickCacheResourceExpired(MagickCache *,MagickCacheResource *),
+  IterateMagickCacheChanges(MagickCache *,const MagickSizeType,const void *,
+    MagickBooleanType (*callback)(MagickCache *,const MagickCacheChange *,
+    const void *)),
   IterateMagickCacheResources(MagickCache *,const char *,const void *,
     MagickBooleanType (*callback)(MagickCache *,MagickCacheResource *,
     const void *)),
+  MaterializeMagickCacheResources(MagickCache *,const char *),
   PutMagickCacheResource(MagickCache *,MagickCacheResource *),
   PutMagickCacheResourceBlob(MagickCache *,MagickCacheResource *,const size_t,
     const void *),
   PutMagickCacheResourceImage(MagickCache *,MagickCacheResource *,
     const Image *),
+  PutMagickCacheResourceImageBlob(MagickCache *,MagickCacheResource *,
+    const size_t,const void *),
+  PutMagickCacheResourceImageStream(MagickCache *,MagickCacheResource *,
+    const char *),
   PutMagickCacheResourceMeta(MagickCache *,MagickCacheResource *,const char *),
+  RebalanceMagickCacheResources(MagickCache *,const char *),
+  ResetMagickCacheResource(MagickCacheResource *,const char *),
+  SeekMagickCacheCursor(MagickCacheCursor *,const char *),
+  SetMagickCacheOption(MagickCache *,const char *,const char *),
   SetMagickCacheResourceIRI(MagickCache *,MagickCacheResource *,const char *),
-  SetMagickCacheResourceVersion(MagickCacheResource *,const size_t);
+  SetMagickCacheResourceVersion(MagickCacheResource *,const size_t),
+  SnapshotMagickCache(MagickCache *,const char *),
+  SyncMagickCacheChanges(MagickCache *,MagickCache *,MagickSizeType *);
 
 extern MagickExport MagickCache
   *AcquireMagickCache(const char *,const StringInfo *),
   *DestroyMagickCache(MagickCache *);
 
+extern MagickExport MagickCacheCursor
+  *CloseMagickCacheCursor(MagickCacheCursor *),
+  *OpenMagickCacheCursor(MagickCache *,const char *,
+    const MagickCacheCursorFlags);
+
+extern MagickExport const MagickCacheEntry
+  *NextMagickCacheCursor(MagickCacheCursor *);
+
 extern MagickExport MagickCacheResource
   *AcquireMagickCacheResource(MagickCache *,const char *),
-  *DestroyMagickCacheResource(MagickCacheResource *);
+  *DestroyMagickCacheResource(MagickCacheResource *),
+  *RelinquishMagickCacheResource(MagickCache *,MagickCacheResource *);
 
 extern MagickExport MagickCacheResourceType
   GetMagickCacheResourceType(const MagickCacheResource *);
 
 extern MagickExport size_t
+  GetMagickCacheResourceDepth(const MagickCacheResource *),
   GetMagickCacheResourceExtent(const MagickCacheResource *),
   GetMagickCacheResourceVersion(const MagickCacheResource *);
 
@@ -103,6 +207,10 @@ extern MagickExport time_t
 
 extern MagickExport void
   *GetMagickCacheResourceBlob(MagickCache *,MagickCacheResource *),
+  *GetMagickCacheResourceImageSource(MagickCache *,MagickCacheResource *,
+    size_t *),
+  *GetMagickCacheResourceRendition(MagickCache *,MagickCacheResource *,
+    const char *,const char *,size_t *),
   GetMagickCacheResourceSize(const MagickCacheResource *,size_t *,size_t *),
   SetMagickCacheResourceTTL(MagickCacheResource *,const time_t);
 
@@ -25,14 +25,42 @@ extern "C" {
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <dirent.h>
+#if !defined(MAGICKCORE_WINDOWS_SUPPORT) || defined(__CYGWIN__)
+#include <sys/file.h>
+#endif
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
 
+#define MagickCacheAccess  ".magickcache.access"
+#define MagickCacheChanges  ".magickcache.changes"
+#define MagickCacheJournal  ".magickcache.journal"
+#define MagickCacheOptions  ".magickcache.options"
 #define MagickCacheSentinel  ".magickcache.sentinel"
+#define MagickCacheUsage  ".magickcache.usage"
 #define MagickCacheResourceSentinel  ".magickcache.resource.sentinel"
 #define MagickCacheMin(x,y)  (((x) < (y)) ? (x) : (y))
 
 #if !defined(O_BINARY)
 #define O_BINARY  0x00
 #endif
+#if !defined(O_CLOEXEC)
+#define O_CLOEXEC  0x00
+#endif
+#if !defined(O_DIRECTORY)
+#define O_DIRECTORY  0x00
+#endif
+
+#if !defined(MAGICKCORE_WINDOWS_SUPPORT) && defined(AT_FDCWD) && \
+    defined(AT_REMOVEDIR)
+#define MAGICKCACHE_HAVE_OPENAT  1
+#endif
+
+#if defined(MAGICKCACHE_HAVE_OPENAT) && defined(SYS_syncfs)
+#define MAGICKCACHE_HAVE_SYNCFS  1
+#endif
 
 #if defined(MAGICKCORE_WINDOWS_SUPPORT)
 #if !defined(readdir)
@@ -46,6 +74,12 @@ extern "C" {
 #define close_utf8 close
 #endif
 
+#if defined(MAGICKCORE_WINDOWS_SUPPORT) && !defined(__CYGWIN__)
+#define fsync_utf8 _commit
+#else
+#define fsync_utf8 fsync
+#endif
+
 static inline unsigned int CRC32(const unsigned char *message,
   const size_t length)
 {
@@ -108,6 +142,188 @@ static inline const struct tm *GetMagickUTCTime(const time_t *timep,
   return(result);
 }
 
+static inline MagickOffsetType GetMagickCacheMicroseconds(void)
+{
+#if defined(MAGICKCORE_HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+  struct timespec
+    timer;
+
+  if (clock_gettime(CLOCK_MONOTONIC,&timer) == 0)
+    return((MagickOffsetType) timer.tv_sec*1000000+timer.tv_nsec/1000);
+#endif
+  return((MagickOffsetType) time((time_t *) NULL)*1000000);
+}
+
+static inline MagickOffsetType MagickCacheAtomicAdd(
+  volatile MagickOffsetType *value,const MagickOffsetType delta)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return(__atomic_add_fetch(value,delta,__ATOMIC_RELAXED));
+#elif defined(MAGICKCORE_WINDOWS_SUPPORT)
+  return(InterlockedExchangeAdd64((volatile LONGLONG *) value,delta)+delta);
+#else
+  *value+=delta;
+  return(*value);
+#endif
+}
+
+static inline MagickOffsetType MagickCacheAtomicLoad(
+  volatile MagickOffsetType *value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return(__atomic_load_n(value,__ATOMIC_RELAXED));
+#else
+  return(*value);
+#endif
+}
+
+static inline void MagickCacheAtomicStore(volatile MagickOffsetType *value,
+  const MagickOffsetType desired)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  __atomic_store_n(value,desired,__ATOMIC_RELAXED);
+#else
+  *value=desired;
+#endif
+}
+
+static inline MagickBooleanType MagickCacheAtomicSwap(
+  volatile MagickOffsetType *value,MagickOffsetType expected,
+  const MagickOffsetType desired)
+{
+  /*
+    Replace the value with desired only if it still equals expected.
+  */
+#if defined(__GNUC__) || defined(__clang__)
+  if (__atomic_compare_exchange_n(value,&expected,desired,0,__ATOMIC_ACQ_REL,
+      __ATOMIC_ACQUIRE) == 0)
+    return(MagickFalse);
+  return(MagickTrue);
+#elif defined(MAGICKCORE_WINDOWS_SUPPORT)
+  if (InterlockedCompareExchange64((volatile LONGLONG *) value,desired,
+      expected) != expected)
+    return(MagickFalse);
+  return(MagickTrue);
+#else
+  if (*value != expected)
+    return(MagickFalse);
+  *value=desired;
+  return(MagickTrue);
+#endif
+}
+
+static inline MagickBooleanType MatchMagickCacheGlobCharacter(
+  const char *pattern,const int c,const char **next)
+{
+  const char
+    *p;
+
+  MagickBooleanType
+    negate,
+    status;
+
+  /*
+    Match one pattern element: ?, [class], \escape, or a literal.
+  */
+  p=pattern;
+  if (*p == '?')
+    {
+      *next=p+1;
+      return(MagickTrue);
+    }
+  if ((*p == '\\') && (p[1] != '\0'))
+    {
+      *next=p+2;
+      return(p[1] == c ? MagickTrue : MagickFalse);
+    }
+  if (*p == '[')
+    {
+      const char
+        *q;
+
+      q=p+1;
+      negate=((*q == '!') || (*q == '^')) ? MagickTrue : MagickFalse;
+      if (negate != MagickFalse)
+        q++;
+      if (*q == ']')
+        q++;
+      q=strchr(q,']');
+      if (q != (const char *) NULL)
+        {
+          /*
+            Character class, a leading ] is literal.
+          */
+          status=MagickFalse;
+          p++;
+          if (negate != MagickFalse)
+            p++;
+          do
+          {
+            if ((p[1] == '-') && (p+2 < q))
+              {
+                if ((c >= (int) ((unsigned char) p[0])) &&
+                    (c <= (int) ((unsigned char) p[2])))
+                  status=MagickTrue;
+                p+=3;
+              }
+            else
+              {
+                if (c == (int) ((unsigned char) *p))
+                  status=MagickTrue;
+                p++;
+              }
+          } while (p < q);
+          *next=q+1;
+          return(status != negate ? MagickTrue : MagickFalse);
+        }
+    }
+  *next=p+1;
+  return((int) ((unsigned char) *p) == c ? MagickTrue : MagickFalse);
+}
+
+static inline MagickBooleanType IsMagickCacheGlobMatch(const char *pattern,
+  const char *name)
+{
+  const char
+    *n,
+    *next,
+    *p,
+    *star_name,
+    *star_pattern;
+
+  /*
+    Match one path component against one pattern component; * backtracks to
+    its most recent occurrence only, so matching is linear in practice.
+  */
+  p=pattern;
+  n=name;
+  star_name=(const char *) NULL;
+  star_pattern=(const char *) NULL;
+  while (*n != '\0')
+  {
+    if (*p == '*')
+      {
+        star_pattern=(++p);
+        star_name=n;
+        continue;
+      }
+    if ((*p != '\0') && (MatchMagickCacheGlobCharacter(p,(int)
+        ((unsigned char) *n),&next) != MagickFalse))
+      {
+        p=next;
+        n++;
+        continue;
+      }
+    if (star_pattern == (const char *) NULL)
+      return(MagickFalse);
+    p=star_pattern;
+    n=(++star_name);
+  }
+  while (*p == '*')
+    p++;
+  return(*p == '\0' ? MagickTrue : MagickFalse);
+}
+
 #if defined(MAGICKCORE_WINDOWS_SUPPORT)
 static inline wchar_t *CreateWidePath(const char *path)
 {
@@ -184,6 +400,55 @@ static inline struct dirent *NTReadDirectory(DIR *entry)
 }
 #endif
 
+static inline int link_utf8(const char *source,const char *destination)
+{
+#if !defined(MAGICKCORE_WINDOWS_SUPPORT) || defined(__CYGWIN__)
+  return(link(source,destination));
+#else
+   int
+     status;
+
+   wchar_t
+     *destination_wide,
+     *source_wide;
+
+   source_wide=CreateWidePath(source);
+   if (source_wide == (wchar_t *) NULL)
+     return(-1);
+   destination_wide=CreateWidePath(destination);
+   if (destination_wide == (wchar_t *) NULL)
+     {
+       source_wide=(wchar_t *) RelinquishMagickMemory(source_wide);
+       return(-1);
+     }
+   status=CreateHardLinkW(destination_wide,source_wide,NULL) != 0 ? 0 : -1;
+   destination_wide=(wchar_t *) RelinquishMagickMemory(destination_wide);
+   source_wide=(wchar_t *) RelinquishMagickMemory(source_wide);
+   return(status);
+#endif
+}
+
+static inline int mkdir_utf8(const char *path,const mode_t mode)
+{
+#if !defined(MAGICKCORE_WINDOWS_SUPPORT) || defined(__CYGWIN__)
+  return(mkdir(path,mode));
+#else
+  int
+    status;
+
+  wchar_t
+    *path_wide;
+
+  (void) mode;
+  path_wide=CreateWidePath(path);
+  if (path_wide == (wchar_t *) NULL)
+    return(-1);
+  status=_wmkdir(path_wide);
+  path_wide=(wchar_t *) RelinquishMagickMemory(path_wide);
+  return(status);
+#endif
+}
+
 static inline MagickBooleanType MagickCreatePath(const char *path)
 {
   char
@@ -212,29 +477,13 @@ static inline MagickBooleanType MagickCreatePath(const char *path)
     (void) ConcatenateMagickString(directed_walk,"/",extent);
     if (GetPathAttributes(directed_walk,&attributes) == MagickFalse)
       {
-#if defined(MAGICKCORE_WINDOWS_SUPPORT)
-      {
-        wchar_t
-          wide_path;
-
-        wide_path=CreateWidePath(directed_walk);
-        if (wide_path == (wchar_t *) NULL)
+        status=mkdir_utf8(directed_walk,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+        if (status < 0)
           {
             status=(-1);
             break;
           }
-        status=_wmkdir(wide_path);
-        wide_path=(wchar_t *) RelinquishMagickMemory(wide_path);
       }
-#else
-      status=mkdir(directed_walk,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
-#endif
-      if (status < 0)
-        {
-          status=(-1);
-          break;
-        }
-    }
   }
   directed_path=DestroyString(directed_path);
   directed_walk=DestroyString(directed_walk);
@@ -281,6 +530,35 @@ static inline int remove_utf8(const char *path)
 #endif
 }
 
+static inline int rename_utf8(const char *source,const char *destination)
+{
+#if !defined(MAGICKCORE_WINDOWS_SUPPORT) || defined(__CYGWIN__)
+  return(rename(source,destination));
+#else
+   int
+     status;
+
+   wchar_t
+     *destination_wide,
+     *source_wide;
+
+   source_wide=CreateWidePath(source);
+   if (source_wide == (wchar_t *) NULL)
+     return(-1);
+   destination_wide=CreateWidePath(destination);
+   if (destination_wide == (wchar_t *) NULL)
+     {
+       source_wide=(wchar_t *) RelinquishMagickMemory(source_wide);
+       return(-1);
+     }
+   status=MoveFileExW(source_wide,destination_wide,MOVEFILE_REPLACE_EXISTING)
+     != 0 ? 0 : -1;
+   destination_wide=(wchar_t *) RelinquishMagickMemory(destination_wide);
+   source_wide=(wchar_t *) RelinquishMagickMemory(source_wide);
+   return(status);
+#endif
+}
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
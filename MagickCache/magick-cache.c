@@ -59,13 +59,25 @@
 /*
   MagickCache defines.
 */
+#define MagickCacheAccessSlots  65536
 #define MagickCacheAPIVersion  1
 #define MagickCacheMax(x,y)  (((x) > (y)) ? (x) : (y))
 #define MagickCacheMin(x,y)  (((x) < (y)) ? (x) : (y))
 #define MagickCacheDigestExtent  64
+#define MagickCacheDirectoryExtent  16384
+#define MagickCacheEvictionExtent  256
+#define MagickCacheEvictionTimeout  60
+#define MagickCacheJournalExtent  1048576
 #define MagickCacheNonce  "MagickCache"
 #define MagickCacheNonceExtent  8
+#define MagickCacheProbeInterval  1000000
+#define MagickCachePyramidExtent  256
+#define MagickCacheRenditionSuffix  ".rendition"
+#define MagickCacheResourcePoolExtent  64
 #define MagickCacheSignature  0xabacadabU
+#define MagickCacheSnapshotExtent  256
+#define MagickCacheTileExtent  256
+#define MagickCacheTierExtent  65536
 #define ThrowMagickCacheException(severity,tag,context) \
 { \
   (void) ThrowMagickException(cache->exception,GetMagickModule(),severity,tag, \
@@ -76,11 +88,199 @@
 /*
   MagickCache structures.
 */
+typedef enum
+{
+  LRUEvictionPolicy,
+  LFUEvictionPolicy,
+  FIFOEvictionPolicy
+} EvictionPolicy;
+
+typedef enum
+{
+  UndefinedJournalDurability,
+  NoJournalDurability,
+  PeriodicJournalDurability,
+  GroupJournalDurability
+} JournalDurability;
+
+typedef enum
+{
+  UndefinedJournalRecord,
+  PutJournalRecord,
+  DeleteJournalRecord,
+  CommitJournalRecord
+} JournalRecordType;
+
+struct CacheAccess
+{
+  MagickOffsetType
+    slots,
+    hits,
+    misses,
+    reserved[5];
+};
+
+struct CacheAccessSlot
+{
+  MagickOffsetType
+    tag,
+    hits,
+    accessed;
+};
+
+struct CacheUsage
+{
+  MagickOffsetType
+    extent,
+    count,
+    evict,
+    reserved[5];
+};
+
+struct JournalRecord
+{
+  unsigned int
+    signature,
+    length,
+    type;
+
+  MagickOffsetType
+    sequence,
+    extent;
+
+  unsigned char
+    nonce[MagickCacheNonceExtent];
+
+  char
+    id[MagickCacheDigestExtent];
+};
+
+struct JournalEntry
+{
+  JournalRecordType
+    type;
+
+  MagickBooleanType
+    committed;
+
+  MagickOffsetType
+    extent;
+
+  unsigned char
+    nonce[MagickCacheNonceExtent];
+
+  char
+    id[MagickCacheDigestExtent+1],
+    *iri;
+};
+
+struct ChangeRecord
+{
+  unsigned int
+    signature,
+    length,
+    type;
+
+  MagickOffsetType
+    timestamp;
+};
+
+struct ChangeSync
+{
+  MagickCache
+    *target;
+
+  MagickSizeType
+    sequence;
+};
+
+struct TileHeader
+{
+  unsigned int
+    signature,
+    length,
+    extent;
+
+  MagickOffsetType
+    columns,
+    rows;
+};
+
+struct FrameHeader
+{
+  unsigned int
+    signature,
+    length;
+
+  MagickOffsetType
+    frames;
+};
+
+struct TileStream
+{
+  char
+    *path;
+
+  int
+    file;
+
+  ImageInfo
+    *image_info;
+
+  MagickOffsetType
+    *offsets;
+
+  size_t
+    extent,
+    columns,
+    number_tiles,
+    index;
+
+  struct TileHeader
+    header;
+};
+
+struct ImageStream
+{
+  MagickCache
+    *cache;
+
+  MagickCacheResource
+    *resource;
+
+  const Image
+    *image;
+
+  Image
+    *band;
+
+  size_t
+    rows;
+
+  struct TileStream
+    tiles;
+
+  MagickBooleanType
+    status;
+};
+
+struct EvictionCandidate
+{
+  MagickOffsetType
+    key;
+
+  char
+    *iri;
+};
+
 struct _MagickCache
 {
   char
     *path;
 
+  int
+    root;
+
   StringInfo
     *nonce,
     *passkey;
@@ -97,6 +297,97 @@ struct _MagickCache
   RandomInfo
     *random_info;
 
+  SplayTreeInfo
+    *directories,
+    *options;
+
+  struct CacheUsage
+    *usage;
+
+  MagickBooleanType
+    usage_mapped;
+
+  struct CacheAccess
+    *access;
+
+  size_t
+    access_extent;
+
+  MagickBooleanType
+    access_opened;
+
+  struct _MagickCache
+    *cold,
+    **shards,
+    **mirrors;
+
+  char
+    *shard_roots,
+    *mirror_roots;
+
+  size_t
+    number_shards,
+    number_mirrors,
+    promote;
+
+  MagickOffsetType
+    hedge;
+
+  volatile MagickOffsetType
+    pending,
+    latency,
+    sampled;
+
+  int
+    journal;
+
+  JournalDurability
+    durability;
+
+  size_t
+    journal_interval;
+
+  volatile MagickOffsetType
+    journal_written,
+    journal_synced,
+    journal_timestamp,
+    journal_pending;
+
+  SemaphoreInfo
+    *journal_semaphore;
+
+  int
+    changes;
+
+  MagickBooleanType
+    pyramid,
+    source,
+    lazy,
+    packed,
+    frames;
+
+  size_t
+    tiles;
+
+  MagickSizeType
+    extent_limit,
+    count_limit;
+
+  size_t
+    watermark;
+
+  EvictionPolicy
+    eviction;
+
+  MagickCacheResource
+    *resources;
+
+  size_t
+    number_resources;
+
+  SemaphoreInfo
+    *semaphore;
+
   MagickBooleanType
     debug;
 
@@ -118,6 +409,7 @@ struct _MagickCacheResource
   size_t
     columns,
     rows,
+    depth,
     extent,
     version;
 
@@ -132,7 +424,15 @@ struct _MagickCacheResource
     *blob;
 
   MagickBooleanType
-    memory_mapped;
+    memory_mapped,
+    encoded,
+    cold;
+
+  size_t
+    shard;
+
+  MagickOffsetType
+    sequence;
 
   ExceptionInfo
     *exception;
@@ -140,169 +440,5215 @@ struct _MagickCacheResource
   MagickBooleanType
     debug;
 
+  struct _MagickCacheResource
+    *rendition,
+    *next;
+
   size_t
     signature;
 };
 
-struct ResourceNode
+struct CursorFrame
 {
-  char
-    *path;
+  DIR
+    *directory;
 
-  struct ResourceNode
-    *previous,
-    *next;
-};
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   A c q u i r e M a g i c k C a c h e                                       %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  AcquireMagickCache() creates a MagickCache structure for getting or putting
-%  resources, from or to the MagickCache repository.  NULL is returned if the
-%  MagickCache repo is not found or if the repo is not compatible with the
-%  current API version.
-%
-%  The format of the AcquireMagickCache method is:
-%
-%      MagickCache *AcquireMagickCache(const char *path,
-%        const StringInfo *passkey)
-%
-%  A description of each parameter follows:
-%
-%    o path: the MagickCache path, absolute (e.g. /myrepo) or relative (e.g.
-%      ./myrepo).
-%
-%    o passkey: the MagickCache passkey.
-%
-*/
+  size_t
+    length;
 
-static void GetMagickCacheSentinel(MagickCache *cache,unsigned char *sentinel)
-{
-  unsigned char
-    *p;
+  char
+    **names;
 
-  unsigned int
-    signature;
+  size_t
+    number_names,
+    index;
 
-  /*
-    Retrieve the MagickCache sentinel.
-  */
-  p=sentinel;
-  p+=sizeof(signature);
-  (void) memcpy(GetStringInfoDatum(cache->nonce),p,
-    GetStringInfoLength(cache->nonce));
-  p+=GetStringInfoLength(cache->nonce);
-  (void) memcpy(cache->digest,p,strlen(cache->digest));
-  p+=strlen(cache->digest);
-}
+  MagickBooleanType
+    pending;
 
-static inline unsigned int GetMagickCacheSignature(const StringInfo *nonce)
+  MagickSizeType
+    states;
+};
+
+struct _MagickCacheCursor
 {
-  StringInfo
-    *version;
+  MagickCache
+    *cache;
 
-  unsigned char
-    *p;
+  MagickCacheCursorFlags
+    flags;
 
-  unsigned int
-    signature;
+  struct CursorFrame
+    *frames;
 
-  /*
-    Generate a MagickCache signature based on the MagickCache properties.
-  */
-  version=AcquireStringInfo(MagickPathExtent);
-  p=GetStringInfoDatum(version);
-  (void) memcpy(p,MagickCachePackageName,strlen(MagickCachePackageName));
-  p+=strlen(MagickCachePackageName);
-  signature=MagickCacheAPIVersion;
-  (void) memcpy(p,&signature,sizeof(signature));
-  p+=sizeof(signature);
-  signature=MagickCacheSignature;
-  (void) memcpy(p,&signature,sizeof(signature));
-  p+=sizeof(signature);
-  SetStringInfoLength(version,(size_t) (p-GetStringInfoDatum(version)));
-  ConcatenateStringInfo(version,nonce);
-  signature=CRC32(GetStringInfoDatum(version),GetStringInfoLength(version));
-  version=DestroyStringInfo(version);
-  return(signature);
-}
+  size_t
+    depth,
+    number_frames;
 
-MagickExport MagickCache *AcquireMagickCache(const char *path,
-  const StringInfo *passkey)
-{
   char
-    *sentinel_path;
+    path[MagickPathExtent],
+    iri[MagickPathExtent];
 
-  MagickCache
-    *cache;
+  StringInfo
+    *nonce;
+
+  char
+    **patterns;
 
   size_t
-    extent;
+    number_patterns;
 
-  struct stat
-    attributes;
+  MagickSizeType
+    accept;
 
-  unsigned int
+  MagickBooleanType
+    owner,
+    status;
+
+  MagickCacheEntry
+    entry;
+
+  size_t
     signature;
+};
 
-  void
-    *sentinel;
+/*
+  The files beside its MPC header that make up an image resource payload.
+*/
+static const char
+  *ImageResourceFiles[] = { ".cache", ".source", ".tiles", ".frames" };
 
-  /*
-    Confirm the path exists.
+/*
+  The formats whose decoders return the rows of an image once each, top to
+  bottom, and so can be streamed.
+*/
+static const char
+  *StreamFormats[] =
+  {
+    "JPEG", "MIFF", "PAM", "PBM", "PGM", "PNG", "PNM", "PPM", "TIFF"
+  };
+
+/*
+  Forward declarations.
+*/
+static MagickBooleanType
+  MaterializeMagickCacheResource(MagickCache *,MagickCacheResource *),
+  UnmapResourceBlob(void *,const size_t);
+
+static void
+  *MapResourceBlob(int,const MapMode,const MagickOffsetType,const size_t),
+  RecoverMagickCacheJournal(MagickCache *);
+
+/*
+  MagickCache file methods.  All paths are relative to the cache repository
+  root and, where the platform supports it, resolved with the *at() family of
+  system calls against a descriptor of the root opened once when the cache is
+  acquired.  This avoids a walk from / for each access and keeps the cache
+  usable even if its root is renamed while it is open.
+*/
+static const char *GetMagickCacheRelativePath(const char *path)
+{
+  const char
+    *p;
+
+  for (p=path; *p == '/'; p++) ;
+  return(*p == '\0' ? "." : p);
+}
+
+static char *AcquireMagickCachePath(const MagickCache *cache,const char *path)
+{
+  char
+    *canonical_path;
+
+  canonical_path=AcquireString(cache->path);
+  (void) ConcatenateString(&canonical_path,"/");
+  (void) ConcatenateString(&canonical_path,GetMagickCacheRelativePath(path));
+  return(canonical_path);
+}
+
+static char *AcquireMagickCacheResourcePath(
+  const MagickCacheResource *resource,const char *filename)
+{
+  char
+    *path;
+
+  path=AcquireString(GetMagickCacheRelativePath(resource->iri));
+  if (filename != (const char *) NULL)
+    {
+      (void) ConcatenateString(&path,"/");
+      (void) ConcatenateString(&path,filename);
+    }
+  return(path);
+}
+
+static int CreateMagickCacheDirectory(const MagickCache *cache,
+  const char *path)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(mkdirat(cache->root,GetMagickCacheRelativePath(path),S_IRWXU |
+    S_IRWXG | S_IROTH | S_IXOTH));
+#else
+  char
+    *canonical_path;
+
+  int
+    status;
+
+  canonical_path=AcquireMagickCachePath(cache,path);
+  status=mkdir_utf8(canonical_path,S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+  canonical_path=DestroyString(canonical_path);
+  return(status);
+#endif
+}
+
+static MagickBooleanType CreateMagickCachePath(MagickCache *cache,
+  const char *path)
+{
+  char
+    *directed_path,
+    *p,
+    *q;
+
+  MagickBooleanType
+    status;
+
+  size_t
+    length;
+
+  /*
+    Create each component of a path relative to the cache repository root.
+    Directories known to exist are remembered so repeated puts below the same
+    IRI prefix cost no system calls; missing ones are created starting from
+    the deepest known ancestor.
+  */
+  if (GetValueFromSplayTree(cache->directories,GetMagickCacheRelativePath(
+      path)) != (const void *) NULL)
+    return(MagickTrue);
+  if (GetNumberOfNodesInSplayTree(cache->directories) >=
+      MagickCacheDirectoryExtent)
+    ResetSplayTree(cache->directories);
+  directed_path=ConstantString(GetMagickCacheRelativePath(path));
+  length=strlen(directed_path);
+  p=directed_path;
+  for (q=strrchr(directed_path,'/'); q != (char *) NULL;
+       q=strrchr(directed_path,'/'))
+  {
+    *q='\0';
+    if (GetValueFromSplayTree(cache->directories,directed_path) !=
+        (const void *) NULL)
+      {
+        p=q+1;
+        break;
+      }
+  }
+  for (q=directed_path; q < (directed_path+length); q++)
+    if (*q == '\0')
+      *q='/';
+  status=MagickTrue;
+  for (q=strchr(p,'/'); ; q=strchr(q+1,'/'))
+  {
+    char
+      *directory;
+
+    if (q != (char *) NULL)
+      *q='\0';
+    if ((CreateMagickCacheDirectory(cache,directed_path) != 0) &&
+        (errno != EEXIST))
+      {
+        status=MagickFalse;
+        break;
+      }
+    directory=ConstantString(directed_path);
+    (void) AddValueToSplayTree(cache->directories,directory,directory);
+    if (q == (char *) NULL)
+      break;
+    *q='/';
+  }
+  directed_path=DestroyString(directed_path);
+  return(status);
+}
+
+static MagickBooleanType GetMagickCacheFileAttributes(const MagickCache *cache,
+  const char *path,struct stat *attributes)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  if (fstatat(cache->root,GetMagickCacheRelativePath(path),attributes,0) != 0)
+    return(MagickFalse);
+  return(MagickTrue);
+#else
+  char
+    *canonical_path;
+
+  MagickBooleanType
+    status;
+
+  canonical_path=AcquireMagickCachePath(cache,path);
+  status=GetPathAttributes(canonical_path,attributes);
+  canonical_path=DestroyString(canonical_path);
+  return(status);
+#endif
+}
+
+static int OpenMagickCacheFile(const MagickCache *cache,const char *path,
+  const int flags,const mode_t mode)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(openat(cache->root,GetMagickCacheRelativePath(path),flags | O_BINARY |
+    O_CLOEXEC,mode));
+#else
+  char
+    *canonical_path;
+
+  int
+    file;
+
+  canonical_path=AcquireMagickCachePath(cache,path);
+  file=open_utf8(canonical_path,flags | O_BINARY,mode);
+  canonical_path=DestroyString(canonical_path);
+  return(file);
+#endif
+}
+
+static DIR *OpenMagickCacheDirectory(const MagickCache *cache,const char *path)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  DIR
+    *directory;
+
+  int
+    file;
+
+  file=OpenMagickCacheFile(cache,path,O_RDONLY | O_DIRECTORY,0);
+  if (file == -1)
+    return((DIR *) NULL);
+  directory=fdopendir(file);
+  if (directory == (DIR *) NULL)
+    (void) close_utf8(file);
+  return(directory);
+#else
+  char
+    *canonical_path;
+
+  DIR
+    *directory;
+
+  canonical_path=AcquireMagickCachePath(cache,path);
+  directory=opendir(canonical_path);
+  canonical_path=DestroyString(canonical_path);
+  return(directory);
+#endif
+}
+
+static void *ReadMagickCacheFile(const MagickCache *cache,const char *path,
+  size_t *extent,ExceptionInfo *exception)
+{
+  int
+    file;
+
+  ssize_t
+    count = 0,
+    i;
+
+  struct stat
+    attributes;
+
+  unsigned char
+    *blob;
+
+  /*
+    Read a file from the cache repository into a blob.
+  */
+  *extent=0;
+  file=OpenMagickCacheFile(cache,path,O_RDONLY,0);
+  if (file == -1)
+    {
+      (void) ThrowMagickException(exception,GetMagickModule(),CacheError,
+        "cannot open file","`%s'",path);
+      return(NULL);
+    }
+  if (fstat(file,&attributes) != 0)
+    {
+      (void) close_utf8(file);
+      (void) ThrowMagickException(exception,GetMagickModule(),CacheError,
+        "cannot read file","`%s'",path);
+      return(NULL);
+    }
+  blob=(unsigned char *) AcquireQuantumMemory((size_t) attributes.st_size+1,
+    sizeof(*blob));
+  if (blob == (unsigned char *) NULL)
+    {
+      (void) close_utf8(file);
+      (void) ThrowMagickException(exception,GetMagickModule(),
+        ResourceLimitError,"MemoryAllocationFailed","`%s'",path);
+      return(NULL);
+    }
+  for (i=0; i < (ssize_t) attributes.st_size; i+=count)
+  {
+    count=read(file,blob+i,(size_t) MagickCacheMin((size_t)
+      attributes.st_size-(size_t) i,(size_t) SSIZE_MAX));
+    if (count == 0)
+      break;
+    if (count < 0)
+      {
+        count=0;
+        if (errno != EINTR)
+          break;
+      }
+  }
+  (void) close_utf8(file);
+  if (i < (ssize_t) attributes.st_size)
+    {
+      blob=(unsigned char *) RelinquishMagickMemory(blob);
+      (void) ThrowMagickException(exception,GetMagickModule(),CacheError,
+        "cannot read file","`%s'",path);
+      return(NULL);
+    }
+  blob[i]='\0';
+  *extent=(size_t) i;
+  return(blob);
+}
+
+static inline MagickSizeType GetMagickCacheHash(MagickSizeType hash,
+  const char *text)
+{
+  const unsigned char
+    *p;
+
+  for (p=(const unsigned char *) text; *p != '\0'; p++)
+    hash=(hash ^ *p)*MagickULLConstant(0x100000001b3);
+  return(hash);
+}
+
+static inline MagickCache *GetMagickCacheShard(MagickCache *cache,
+  const size_t shard)
+{
+  if ((shard == 0) || (shard > cache->number_shards))
+    return(cache);
+  return(cache->shards[shard-1]);
+}
+
+static size_t GetMagickCacheShardPlacement(const MagickCache *cache,
+  const char *iri)
+{
+  MagickSizeType
+    hash,
+    score;
+
+  size_t
+    i,
+    shard;
+
+  /*
+    Rendezvous hashing: every root scores the IRI and the highest score owns
+    it.  A root that is added takes over only the IRIs it now wins, about one
+    in N, and the other roots keep theirs.
+  */
+  if (cache->number_shards == 0)
+    return(0);
+  score=0;
+  shard=0;
+  for (i=0; i <= cache->number_shards; i++)
+  {
+    hash=GetMagickCacheHash(MagickULLConstant(0xcbf29ce484222325),i == 0 ?
+      "" : cache->shards[i-1]->path);
+    hash=GetMagickCacheHash(hash ^ '/',GetMagickCacheRelativePath(iri));
+    hash^=hash >> 33;
+    hash*=MagickULLConstant(0xff51afd7ed558ccd);
+    hash^=hash >> 33;
+    if ((i == 0) || (hash > score))
+      {
+        score=hash;
+        shard=i;
+      }
+  }
+  return(shard);
+}
+
+static inline MagickCache *GetMagickCacheTier(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  if (resource->cold != MagickFalse)
+    return(cache->cold);
+  return(GetMagickCacheShard(cache,resource->shard));
+}
+
+static MagickBooleanType LocateMagickCacheResource(MagickCache *cache,
+  const char *iri,const char *path,struct stat *attributes,size_t *shard,
+  MagickBooleanType *cold)
+{
+  size_t
+    i,
+    placement;
+
+  /*
+    Find the root that holds a resource payload: the one the IRI hashes to,
+    then the other roots, as it may not be rebalanced yet, then the cold
+    tier.
+  */
+  *cold=MagickFalse;
+  placement=GetMagickCacheShardPlacement(cache,iri);
+  *shard=placement;
+  if (GetMagickCacheFileAttributes(GetMagickCacheShard(cache,placement),path,
+       attributes) != MagickFalse)
+    return(MagickTrue);
+  for (i=0; i <= cache->number_shards; i++)
+  {
+    if (i == placement)
+      continue;
+    *shard=i;
+    if (GetMagickCacheFileAttributes(GetMagickCacheShard(cache,i),path,
+          attributes) != MagickFalse)
+      return(MagickTrue);
+  }
+  *shard=placement;
+  if (cache->cold == (MagickCache *) NULL)
+    return(MagickFalse);
+  *cold=GetMagickCacheFileAttributes(cache->cold,path,attributes);
+  return(*cold);
+}
+
+static inline MagickBooleanType IsMagickCacheReplicaSlow(MagickCache *cache,
+  MagickCache *replica)
+{
+  return(MagickCacheAtomicLoad(&replica->latency) > cache->hedge ? MagickTrue :
+    MagickFalse);
+}
+
+static inline MagickBooleanType ProbeMagickCacheReplica(MagickCache *cache,
+  MagickCache *replica,const MagickOffsetType timestamp)
+{
+  MagickOffsetType
+    sampled;
+
+  /*
+    A slow copy is read again once a probe interval passes without a read
+    of it, so its average recovers when its disk does.  One read claims
+    each probe.
+  */
+  if (IsMagickCacheReplicaSlow(cache,replica) == MagickFalse)
+    return(MagickFalse);
+  sampled=MagickCacheAtomicLoad(&replica->sampled);
+  if ((timestamp-sampled) < MagickCacheProbeInterval)
+    return(MagickFalse);
+  return(MagickCacheAtomicSwap(&replica->sampled,sampled,timestamp));
+}
+
+static MagickCache *AcquireMagickCacheReplica(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  MagickCache
+    *replica;
+
+  MagickOffsetType
+    timestamp;
+
+  size_t
+    i;
+
+  /*
+    Read from the copy with the fewest reads in flight, the faster one on a
+    tie, and pass over copies whose recent reads were slower than the
+    mirror:latency option while another copy keeps up.  Reads in flight and
+    latencies are those of this cache handle.
+  */
+  replica=GetMagickCacheTier(cache,resource);
+  if ((resource->cold != MagickFalse) || (cache->number_mirrors == 0))
+    {
+      (void) MagickCacheAtomicAdd(&replica->pending,1);
+      return(replica);
+    }
+  timestamp=GetMagickCacheMicroseconds();
+  if (ProbeMagickCacheReplica(cache,replica,timestamp) != MagickFalse)
+    {
+      (void) MagickCacheAtomicAdd(&replica->pending,1);
+      return(replica);
+    }
+  for (i=0; i < cache->number_mirrors; i++)
+  {
+    MagickBooleanType
+      slow;
+
+    MagickCache
+      *mirror;
+
+    MagickOffsetType
+      pending;
+
+    mirror=cache->mirrors[i];
+    if (ProbeMagickCacheReplica(cache,mirror,timestamp) != MagickFalse)
+      {
+        replica=mirror;
+        break;
+      }
+    slow=IsMagickCacheReplicaSlow(cache,mirror);
+    if (slow != IsMagickCacheReplicaSlow(cache,replica))
+      {
+        if (slow == MagickFalse)
+          replica=mirror;
+        continue;
+      }
+    pending=MagickCacheAtomicLoad(&mirror->pending);
+    if ((pending < MagickCacheAtomicLoad(&replica->pending)) ||
+        ((pending == MagickCacheAtomicLoad(&replica->pending)) &&
+         (MagickCacheAtomicLoad(&mirror->latency) <
+          MagickCacheAtomicLoad(&replica->latency))))
+      replica=mirror;
+  }
+  (void) MagickCacheAtomicAdd(&replica->pending,1);
+  return(replica);
+}
+
+static void RelinquishMagickCacheReplica(MagickCache *replica,
+  const MagickOffsetType timestamp)
+{
+  MagickOffsetType
+    latency,
+    sampled;
+
+  /*
+    Fold the read latency into a moving average, weighing the last read 1/8.
+  */
+  (void) MagickCacheAtomicAdd(&replica->pending,-1);
+  sampled=GetMagickCacheMicroseconds();
+  latency=MagickCacheAtomicLoad(&replica->latency);
+  MagickCacheAtomicStore(&replica->latency,latency+(sampled-timestamp-
+    latency)/8);
+  MagickCacheAtomicStore(&replica->sampled,sampled);
+}
+
+static char *AcquireMagickCacheLevelPath(
+  const MagickCacheResource *resource,const size_t level)
+{
+  char
+    id[MagickPathExtent];
+
+  /*
+    Level 0 is the payload itself, level n its pyramid reduction by 2^n.  The
+    suffix has no dot so the MPC image cache is not named after the payload.
+  */
+  if (level == 0)
+    return(AcquireMagickCacheResourcePath(resource,resource->id));
+  (void) FormatLocaleString(id,MagickPathExtent,"%s_%.20g",resource->id,
+    (double) level);
+  return(AcquireMagickCacheResourcePath(resource,id));
+}
+
+static size_t GetMagickCacheResourceLevels(const size_t columns,
+  const size_t rows)
+{
+  size_t
+    height,
+    levels,
+    width;
+
+  /*
+    Halve the image until it fits in a single pyramid tile.
+  */
+  width=columns;
+  height=rows;
+  for (levels=0; MagickCacheMax(width,height) > MagickCachePyramidExtent; )
+  {
+    width=(width+1)/2;
+    height=(height+1)/2;
+    levels++;
+  }
+  return(levels);
+}
+
+static MagickSizeType GetMagickCacheFileExtent(const MagickCache *cache,
+  const char *path,const char *suffix,MagickBooleanType *status)
+{
+  char
+    *file_path;
+
+  struct stat
+    attributes;
+
+  file_path=AcquireString(path);
+  if (suffix != (const char *) NULL)
+    (void) ConcatenateString(&file_path,suffix);
+  *status=GetMagickCacheFileAttributes(cache,file_path,&attributes);
+  file_path=DestroyString(file_path);
+  if (*status == MagickFalse)
+    return(0);
+  return((MagickSizeType) attributes.st_size);
+}
+
+static MagickSizeType GetMagickCachePayloadExtent(const MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    exists,
+    status;
+
+  MagickSizeType
+    extent;
+
+  size_t
+    i,
+    level;
+
+  /*
+    Return the bytes a resource occupies on disk, its image cache, tiles,
+    frames, original encoded bytes, and pyramid levels included.
+  */
+  extent=0;
+  for (level=0; ; level++)
+  {
+    path=AcquireMagickCacheLevelPath(resource,level);
+    extent+=GetMagickCacheFileExtent(cache,path,(const char *) NULL,&status);
+    if (resource->resource_type == ImageResourceType)
+      for (i=0; i < (level == 0 ? (sizeof(ImageResourceFiles)/
+           sizeof(*ImageResourceFiles)) : 1); i++)
+        extent+=GetMagickCacheFileExtent(cache,path,ImageResourceFiles[i],
+          &exists);
+    path=DestroyString(path);
+    if ((resource->resource_type != ImageResourceType) ||
+        ((level != 0) && (status == MagickFalse)))
+      break;
+  }
+  return(extent);
+}
+
+static inline MagickSizeType GetMagickCacheResourceFootprint(
+  MagickCache *cache,const MagickCacheResource *resource)
+{
+  /*
+    Only the primary tier is accounted for.
+  */
+  if (resource->cold != MagickFalse)
+    return(0);
+  return(GetMagickCachePayloadExtent(GetMagickCacheTier(cache,resource),
+    resource));
+}
+
+static int LinkMagickCacheFile(const MagickCache *source,
+  const MagickCache *destination,const char *path)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(linkat(source->root,GetMagickCacheRelativePath(path),
+    destination->root,GetMagickCacheRelativePath(path),0));
+#else
+  char
+    *canonical_destination,
+    *canonical_source;
+
+  int
+    status;
+
+  canonical_source=AcquireMagickCachePath(source,path);
+  canonical_destination=AcquireMagickCachePath(destination,path);
+  status=link_utf8(canonical_source,canonical_destination);
+  canonical_destination=DestroyString(canonical_destination);
+  canonical_source=DestroyString(canonical_source);
+  return(status);
+#endif
+}
+
+static int RemoveMagickCacheDirectory(const MagickCache *cache,
+  const char *path)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(unlinkat(cache->root,GetMagickCacheRelativePath(path),AT_REMOVEDIR));
+#else
+  char
+    *canonical_path;
+
+  int
+    status;
+
+  canonical_path=AcquireMagickCachePath(cache,path);
+  status=remove_utf8(canonical_path);
+  canonical_path=DestroyString(canonical_path);
+  return(status);
+#endif
+}
+
+static int RemoveMagickCacheFile(const MagickCache *cache,const char *path)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(unlinkat(cache->root,GetMagickCacheRelativePath(path),0));
+#else
+  char
+    *canonical_path;
+
+  int
+    status;
+
+  canonical_path=AcquireMagickCachePath(cache,path);
+  status=remove_utf8(canonical_path);
+  canonical_path=DestroyString(canonical_path);
+  return(status);
+#endif
+}
+
+static int RenameMagickCacheFile(const MagickCache *cache,const char *source,
+  const char *destination)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(renameat(cache->root,GetMagickCacheRelativePath(source),cache->root,
+    GetMagickCacheRelativePath(destination)));
+#else
+  char
+    *canonical_destination,
+    *canonical_source;
+
+  int
+    status;
+
+  canonical_source=AcquireMagickCachePath(cache,source);
+  canonical_destination=AcquireMagickCachePath(cache,destination);
+  status=rename_utf8(canonical_source,canonical_destination);
+  canonical_destination=DestroyString(canonical_destination);
+  canonical_source=DestroyString(canonical_source);
+  return(status);
+#endif
+}
+
+static MagickBooleanType ReadMagickCacheBlob(const int file,
+  const MagickOffsetType offset,void *blob,const size_t length)
+{
+  ssize_t
+    count = 0,
+    i;
+
+  if (lseek(file,(off_t) offset,SEEK_SET) != (off_t) offset)
+    return(MagickFalse);
+  for (i=0; i < (ssize_t) length; i+=count)
+  {
+    count=read(file,(unsigned char *) blob+i,(size_t) MagickCacheMin(
+      length-(size_t) i,(size_t) SSIZE_MAX));
+    if (count == 0)
+      break;
+    if (count < 0)
+      {
+        count=0;
+        if (errno != EINTR)
+          break;
+      }
+  }
+  return(i < (ssize_t) length ? MagickFalse : MagickTrue);
+}
+
+static MagickBooleanType WriteMagickCacheBlob(const int file,const void *blob,
+  const size_t length)
+{
+  ssize_t
+    count = 0,
+    i;
+
+  for (i=0; i < (ssize_t) length; i+=count)
+  {
+    count=write(file,(const unsigned char *) blob+i,(size_t) MagickCacheMin(
+      length-(size_t) i,(size_t) SSIZE_MAX));
+    if (count <= 0)
+      {
+        count=0;
+        if (errno != EINTR)
+          break;
+      }
+  }
+  return(i < (ssize_t) length ? MagickFalse : MagickTrue);
+}
+
+static MagickBooleanType WriteMagickCacheFile(const MagickCache *cache,
+  const char *path,const int flags,const void *blob,const size_t length,
+  ExceptionInfo *exception)
+{
+  int
+    file;
+
+  MagickBooleanType
+    status;
+
+  /*
+    Write a blob to a file in the cache repository.
+  */
+  file=OpenMagickCacheFile(cache,path,O_WRONLY | O_CREAT | flags,S_IRUSR |
+    S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (file == -1)
+    {
+      (void) ThrowMagickException(exception,GetMagickModule(),CacheError,
+        "cannot open file","`%s'",path);
+      return(MagickFalse);
+    }
+  status=WriteMagickCacheBlob(file,blob,length);
+  if (close_utf8(file) == -1)
+    status=MagickFalse;
+  if (status == MagickFalse)
+    (void) ThrowMagickException(exception,GetMagickModule(),CacheError,
+      "cannot write file","`%s'",path);
+  return(status);
+}
+
+static MagickBooleanType CopyMagickCacheFile(MagickCache *source,
+  MagickCache *destination,const char *path)
+{
+  char
+    *copy_path,
+    *id;
+
+  int
+    input,
+    output;
+
+  MagickBooleanType
+    status;
+
+  ssize_t
+    count;
+
+  StringInfo
+    *key;
+
+  unsigned char
+    *buffer;
+
+  /*
+    Copy a file between tiers; it appears in the destination all at once.
+    The copy is written under a random name, so one left behind by a crash
+    does not get in the way of the next.
+  */
+  buffer=(unsigned char *) AcquireQuantumMemory(MagickCacheTierExtent,
+    sizeof(*buffer));
+  if (buffer == (unsigned char *) NULL)
+    return(MagickFalse);
+  input=OpenMagickCacheFile(source,path,O_RDONLY,0);
+  if (input == -1)
+    {
+      buffer=(unsigned char *) RelinquishMagickMemory(buffer);
+      return(MagickFalse);
+    }
+  key=GetRandomKey(destination->random_info,MagickCacheNonceExtent);
+  id=StringInfoToHexString(key);
+  key=DestroyStringInfo(key);
+  copy_path=AcquireString(path);
+  (void) ConcatenateString(&copy_path,"-");
+  (void) ConcatenateString(&copy_path,id);
+  (void) ConcatenateString(&copy_path,".tier");
+  id=DestroyString(id);
+  output=OpenMagickCacheFile(destination,copy_path,O_WRONLY | O_CREAT |
+    O_EXCL,S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  status=output != -1 ? MagickTrue : MagickFalse;
+  while (status != MagickFalse)
+  {
+    count=read(input,buffer,MagickCacheTierExtent);
+    if ((count < 0) && (errno == EINTR))
+      continue;
+    if (count <= 0)
+      {
+        if (count < 0)
+          status=MagickFalse;
+        break;
+      }
+    status=WriteMagickCacheBlob(output,buffer,(size_t) count);
+  }
+  (void) close_utf8(input);
+  if ((output != -1) && (close_utf8(output) == -1))
+    status=MagickFalse;
+  if ((status != MagickFalse) &&
+      (RenameMagickCacheFile(destination,copy_path,path) != 0))
+    status=MagickFalse;
+  if ((status == MagickFalse) && (output != -1))
+    (void) RemoveMagickCacheFile(destination,copy_path);
+  copy_path=DestroyString(copy_path);
+  buffer=(unsigned char *) RelinquishMagickMemory(buffer);
+  return(status);
+}
+
+static void RemoveMagickCacheResourceLevels(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  int
+    status;
+
+  size_t
+    level;
+
+  /*
+    Remove the pyramid levels of an image resource, if any.
+  */
+  if (resource->resource_type != ImageResourceType)
+    return;
+  for (level=1; ; level++)
+  {
+    path=AcquireMagickCacheLevelPath(resource,level);
+    status=RemoveMagickCacheFile(cache,path);
+    (void) ConcatenateString(&path,".cache");
+    (void) RemoveMagickCacheFile(cache,path);
+    path=DestroyString(path);
+    if (status != 0)
+      break;
+  }
+}
+
+static void RemoveMagickCacheResourceFiles(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  size_t
+    i;
+
+  /*
+    Remove the image cache, original encoded bytes, tiles, and frames of an
+    image resource, if any.
+  */
+  if (resource->resource_type != ImageResourceType)
+    return;
+  for (i=0; i < (sizeof(ImageResourceFiles)/sizeof(*ImageResourceFiles)); i++)
+  {
+    path=AcquireMagickCacheResourcePath(resource,resource->id);
+    (void) ConcatenateString(&path,ImageResourceFiles[i]);
+    (void) RemoveMagickCacheFile(cache,path);
+    path=DestroyString(path);
+  }
+}
+
+static void RemoveMagickCacheResourcePayload(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) RemoveMagickCacheFile(cache,path);
+  path=DestroyString(path);
+  RemoveMagickCacheResourceFiles(cache,resource);
+  RemoveMagickCacheResourceLevels(cache,resource);
+}
+
+static char *AcquireMagickCacheRenditionPath(
+  const MagickCacheResource *resource,const char *transform)
+{
+  char
+    *digest,
+    *path;
+
+  StringInfo
+    *key;
+
+  /*
+    A rendition is a file beside the sentinel of its image, never a resource
+    of its own, named after the image ID and a digest of its transform.  An
+    image put again has a new ID, so no rendition outlives the image put it
+    was encoded from.
+  */
+  key=StringToStringInfo(transform);
+  digest=StringInfoToDigest(key);
+  key=DestroyStringInfo(key);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,"-");
+  (void) ConcatenateString(&path,digest);
+  (void) ConcatenateString(&path,MagickCacheRenditionSuffix);
+  digest=DestroyString(digest);
+  return(path);
+}
+
+static MagickSizeType RemoveMagickCacheResourceRenditions(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  char
+    *directory_path,
+    *path;
+
+  DIR
+    *directory;
+
+  MagickSizeType
+    extent;
+
+  size_t
+    length;
+
+  struct dirent
+    *entry;
+
+  struct stat
+    attributes;
+
+  /*
+    Remove the renditions of an image resource, whatever image put they
+    were encoded from, and return the bytes they occupied.
+  */
+  extent=0;
+  if (resource->resource_type != ImageResourceType)
+    return(extent);
+  directory_path=AcquireMagickCacheResourcePath(resource,(const char *) NULL);
+  directory=OpenMagickCacheDirectory(cache,directory_path);
+  if (directory == (DIR *) NULL)
+    {
+      directory_path=DestroyString(directory_path);
+      return(extent);
+    }
+  while ((entry=readdir(directory)) != (struct dirent *) NULL)
+  {
+    length=strlen(entry->d_name);
+    if ((length <= strlen(MagickCacheRenditionSuffix)) ||
+        (strcmp(entry->d_name+length-strlen(MagickCacheRenditionSuffix),
+         MagickCacheRenditionSuffix) != 0))
+      continue;
+    path=AcquireMagickCacheResourcePath(resource,entry->d_name);
+    if ((GetMagickCacheFileAttributes(cache,path,&attributes) != MagickFalse) &&
+        (RemoveMagickCacheFile(cache,path) == 0))
+      extent+=(MagickSizeType) attributes.st_size;
+    path=DestroyString(path);
+  }
+  (void) closedir(directory);
+  directory_path=DestroyString(directory_path);
+  return(extent);
+}
+
+static MagickBooleanType CopyMagickCacheResourceFiles(MagickCache *source,
+  MagickCache *destination,const MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    status;
+
+  size_t
+    i,
+    level;
+
+  struct stat
+    attributes;
+
+  /*
+    Copy the image cache, original encoded bytes, tiles, frames, and pyramid
+    levels of an image resource, if any.
+  */
+  status=MagickTrue;
+  if (resource->resource_type != ImageResourceType)
+    return(status);
+  for (i=0; (status != MagickFalse) &&
+       (i < (sizeof(ImageResourceFiles)/sizeof(*ImageResourceFiles))); i++)
+  {
+    path=AcquireMagickCacheResourcePath(resource,resource->id);
+    (void) ConcatenateString(&path,ImageResourceFiles[i]);
+    if (GetMagickCacheFileAttributes(source,path,&attributes) != MagickFalse)
+      status=CopyMagickCacheFile(source,destination,path);
+    path=DestroyString(path);
+  }
+  for (level=1; status != MagickFalse; level++)
+  {
+    path=AcquireMagickCacheLevelPath(resource,level);
+    if (GetMagickCacheFileAttributes(source,path,&attributes) == MagickFalse)
+      {
+        path=DestroyString(path);
+        break;
+      }
+    status=CopyMagickCacheFile(source,destination,path);
+    (void) ConcatenateString(&path,".cache");
+    if (status != MagickFalse)
+      status=CopyMagickCacheFile(source,destination,path);
+    path=DestroyString(path);
+  }
+  return(status);
+}
+
+static MagickBooleanType CopyMagickCacheResource(MagickCache *source,
+  MagickCache *destination,const MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    status;
+
+  /*
+    Copy a resource payload between roots; its sentinel stays put.  An image
+    put lazily or as tiles has an empty MPC header and no image cache.
+  */
+  if (CreateMagickCachePath(destination,resource->iri) == MagickFalse)
+    return(MagickFalse);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=CopyMagickCacheFile(source,destination,path);
+  if ((status != MagickFalse) &&
+      (CopyMagickCacheResourceFiles(source,destination,resource) ==
+       MagickFalse))
+    {
+      RemoveMagickCacheResourcePayload(destination,resource);
+      status=MagickFalse;
+    }
+  path=DestroyString(path);
+  return(status);
+}
+
+static MagickBooleanType MoveMagickCacheResource(MagickCache *source,
+  MagickCache *destination,const MagickCacheResource *resource)
+{
+  /*
+    Each file is whole in either tier, but a reader that located the
+    resource in the source tier before its files are removed fails to read
+    it and must get it again.
+  */
+  if (CopyMagickCacheResource(source,destination,resource) == MagickFalse)
+    return(MagickFalse);
+  RemoveMagickCacheResourcePayload(source,resource);
+  return(MagickTrue);
+}
+
+static void RemoveMagickCacheResourcePath(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  char
+    *iri;
+
+  /*
+    Remove the directories of a resource IRI that are now empty.
+  */
+  iri=AcquireString(GetMagickCacheRelativePath(resource->iri));
+  for ( ; *iri != '\0'; GetPathComponent(iri,HeadPath,iri))
+  {
+    if (RemoveMagickCacheDirectory(cache,iri) != 0)
+      break;
+    (void) DeleteNodeFromSplayTree(cache->directories,iri);
+  }
+  iri=DestroyString(iri);
+}
+
+static MagickBooleanType MirrorMagickCacheResource(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  MagickBooleanType
+    status;
+
+  size_t
+    i;
+
+  /*
+    Copy a resource payload from its root to each mirror.  A mirror that
+    cannot take it is reported; reads then fall back to the other copies.
+  */
+  status=MagickTrue;
+  if (resource->cold != MagickFalse)
+    return(status);
+  for (i=0; i < cache->number_mirrors; i++)
+    if (CopyMagickCacheResource(GetMagickCacheTier(cache,resource),
+          cache->mirrors[i],resource) == MagickFalse)
+      {
+        (void) ThrowMagickException(resource->exception,GetMagickModule(),
+          CacheWarning,"cannot mirror resource","`%s'",
+          cache->mirrors[i]->path);
+        status=MagickFalse;
+      }
+  return(status);
+}
+
+static void UnmirrorMagickCacheResource(MagickCache *cache,
+  const MagickCacheResource *resource)
+{
+  size_t
+    i;
+
+  for (i=0; i < cache->number_mirrors; i++)
+  {
+    RemoveMagickCacheResourcePayload(cache->mirrors[i],resource);
+    RemoveMagickCacheResourcePath(cache->mirrors[i],resource);
+  }
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   A c q u i r e M a g i c k C a c h e                                       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  AcquireMagickCache() creates a MagickCache structure for getting or putting
+%  resources, from or to the MagickCache repository.  NULL is returned if the
+%  MagickCache repo is not found, if the repo is not compatible with the
+%  current API version, or if its options cannot be applied, e.g. a tier or
+%  journal that cannot be opened.
+%
+%  The format of the AcquireMagickCache method is:
+%
+%      MagickCache *AcquireMagickCache(const char *path,
+%        const StringInfo *passkey)
+%
+%  A description of each parameter follows:
+%
+%    o path: the MagickCache path, absolute (e.g. /myrepo) or relative (e.g.
+%      ./myrepo).
+%
+%    o passkey: the MagickCache passkey.
+%
+*/
+
+static void GetMagickCacheSentinel(MagickCache *cache,unsigned char *sentinel)
+{
+  unsigned char
+    *p;
+
+  unsigned int
+    signature;
+
+  /*
+    Retrieve the MagickCache sentinel.
+  */
+  p=sentinel;
+  p+=sizeof(signature);
+  (void) memcpy(GetStringInfoDatum(cache->nonce),p,
+    GetStringInfoLength(cache->nonce));
+  p+=GetStringInfoLength(cache->nonce);
+  (void) memcpy(cache->digest,p,strlen(cache->digest));
+  p+=strlen(cache->digest);
+}
+
+static inline unsigned int GetMagickCacheSignature(const StringInfo *nonce)
+{
+  StringInfo
+    *version;
+
+  unsigned char
+    *p;
+
+  unsigned int
+    signature;
+
+  /*
+    Generate a MagickCache signature based on the MagickCache properties.
+  */
+  version=AcquireStringInfo(MagickPathExtent);
+  p=GetStringInfoDatum(version);
+  (void) memcpy(p,MagickCachePackageName,strlen(MagickCachePackageName));
+  p+=strlen(MagickCachePackageName);
+  signature=MagickCacheAPIVersion;
+  (void) memcpy(p,&signature,sizeof(signature));
+  p+=sizeof(signature);
+  signature=MagickCacheSignature;
+  (void) memcpy(p,&signature,sizeof(signature));
+  p+=sizeof(signature);
+  SetStringInfoLength(version,(size_t) (p-GetStringInfoDatum(version)));
+  ConcatenateStringInfo(version,nonce);
+  signature=CRC32(GetStringInfoDatum(version),GetStringInfoLength(version));
+  version=DestroyStringInfo(version);
+  return(signature);
+}
+
+static void CloseMagickCacheUsage(MagickCache *cache)
+{
+  if (cache->usage == (struct CacheUsage *) NULL)
+    return;
+  if (cache->usage_mapped != MagickFalse)
+    (void) UnmapResourceBlob(cache->usage,sizeof(*cache->usage));
+  else
+    {
+      (void) WriteMagickCacheFile(cache,MagickCacheUsage,O_TRUNC,cache->usage,
+        sizeof(*cache->usage),cache->exception);
+      cache->usage=(struct CacheUsage *) RelinquishMagickMemory(cache->usage);
+    }
+  cache->usage=(struct CacheUsage *) NULL;
+  cache->usage_mapped=MagickFalse;
+}
+
+static inline MagickSizeType GetMagickCacheThreshold(const MagickSizeType limit,
+  const size_t watermark)
+{
+  return((MagickSizeType) ceil((double) limit*watermark/100.0));
+}
+
+static MagickBooleanType IsMagickCacheOverCount(MagickCache *cache,
+  const size_t watermark)
+{
+  MagickOffsetType
+    count;
+
+  if (cache->usage == (struct CacheUsage *) NULL)
+    return(MagickFalse);
+  count=MagickCacheAtomicLoad(&cache->usage->count);
+  if ((cache->count_limit != 0) && (count > 0) &&
+      ((MagickSizeType) count > GetMagickCacheThreshold(cache->count_limit,
+       watermark)))
+    return(MagickTrue);
+  return(MagickFalse);
+}
+
+static MagickBooleanType IsMagickCacheOverExtent(MagickCache *cache,
+  const size_t watermark)
+{
+  MagickOffsetType
+    extent;
+
+  if (cache->usage == (struct CacheUsage *) NULL)
+    return(MagickFalse);
+  extent=MagickCacheAtomicLoad(&cache->usage->extent);
+  if ((cache->extent_limit != 0) && (extent > 0) &&
+      ((MagickSizeType) extent > GetMagickCacheThreshold(cache->extent_limit,
+       watermark)))
+    return(MagickTrue);
+  return(MagickFalse);
+}
+
+static inline MagickBooleanType IsMagickCacheOverCapacity(MagickCache *cache,
+  const size_t watermark)
+{
+  if (IsMagickCacheOverExtent(cache,watermark) != MagickFalse)
+    return(MagickTrue);
+  return(IsMagickCacheOverCount(cache,watermark));
+}
+
+static void LoadMagickCacheOptions(MagickCache *cache)
+{
+  char
+    *options,
+    *p,
+    *q;
+
+  size_t
+    extent;
+
+  struct stat
+    attributes;
+
+  /*
+    Options persist in the cache repository as key=value lines.
+  */
+  if (GetMagickCacheFileAttributes(cache,MagickCacheOptions,&attributes) ==
+      MagickFalse)
+    return;
+  options=(char *) ReadMagickCacheFile(cache,MagickCacheOptions,&extent,
+    cache->exception);
+  if (options == (char *) NULL)
+    return;
+  for (p=options; *p != '\0'; p=q)
+  {
+    char
+      *value;
+
+    q=strchr(p,'\n');
+    if (q == (char *) NULL)
+      q=p+strlen(p);
+    else
+      *q++='\0';
+    value=strchr(p,'=');
+    if (value == (char *) NULL)
+      continue;
+    *value++='\0';
+    (void) AddValueToSplayTree(cache->options,ConstantString(p),
+      ConstantString(value));
+  }
+  options=(char *) RelinquishMagickMemory(options);
+}
+
+static void UpdateMagickCacheUsage(MagickCache *cache,
+  const MagickOffsetType extent,const MagickOffsetType count)
+{
+  if (cache->usage == (struct CacheUsage *) NULL)
+    return;
+  if (extent != 0)
+    (void) MagickCacheAtomicAdd(&cache->usage->extent,extent);
+  if (count != 0)
+    (void) MagickCacheAtomicAdd(&cache->usage->count,count);
+}
+
+static MagickBooleanType CountMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource,const void *context)
+{
+  (void) context;
+  UpdateMagickCacheUsage(cache,(MagickOffsetType)
+    GetMagickCacheResourceFootprint(cache,resource),1);
+  return(MagickTrue);
+}
+
+static MagickBooleanType OpenMagickCacheUsage(MagickCache *cache)
+{
+  int
+    file;
+
+  MagickBooleanType
+    recount;
+
+  struct CacheUsage
+    usage;
+
+  struct stat
+    attributes;
+
+  /*
+    The usage counters are shared by every process with the cache open.  The
+    process that creates them seeds them from the resources already on disk.
+  */
+  recount=MagickFalse;
+  file=OpenMagickCacheFile(cache,MagickCacheUsage,O_RDWR | O_CREAT | O_EXCL,
+    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (file != -1)
+    {
+      recount=MagickTrue;
+      (void) memset(&usage,0,sizeof(usage));
+      if (WriteMagickCacheBlob(file,&usage,sizeof(usage)) == MagickFalse)
+        file=close_utf8(file)-1;
+    }
+  else
+    if (errno == EEXIST)
+      {
+        file=OpenMagickCacheFile(cache,MagickCacheUsage,O_RDWR,0);
+        if ((file != -1) && ((fstat(file,&attributes) != 0) ||
+            (attributes.st_size < (off_t) sizeof(usage))))
+          file=close_utf8(file)-1;
+      }
+  if (file == -1)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot open file","`%s'",MagickCacheUsage);
+      return(MagickFalse);
+    }
+  cache->usage=(struct CacheUsage *) MapResourceBlob(file,IOMode,0,
+    sizeof(*cache->usage));
+  if (cache->usage != (struct CacheUsage *) NULL)
+    cache->usage_mapped=MagickTrue;
+  else
+    {
+      cache->usage=(struct CacheUsage *) AcquireCriticalMemory(
+        sizeof(*cache->usage));
+      if (read(file,cache->usage,sizeof(*cache->usage)) !=
+          (ssize_t) sizeof(*cache->usage))
+        (void) memset(cache->usage,0,sizeof(*cache->usage));
+    }
+  (void) close_utf8(file);
+  if (recount != MagickFalse)
+    (void) IterateMagickCacheResources(cache,"/",(const void *) NULL,
+      CountMagickCacheResource);
+  return(MagickTrue);
+}
+
+static MagickCache *AcquireMagickCacheTier(const char *path)
+{
+  MagickCache
+    *cache;
+
+  /*
+    A tier or shard is a bare cache rooted at another directory; it holds
+    resource payloads only, their sentinels stay in the primary root.
+  */
+  if (IsPathAccessible(path) == MagickFalse)
+    (void) MagickCreatePath(path);
+  cache=(MagickCache *) AcquireCriticalMemory(sizeof(*cache));
+  (void) memset(cache,0,sizeof(*cache));
+  cache->path=ConstantString(path);
+  cache->root=(-1);
+  cache->journal=(-1);
+  cache->changes=(-1);
+  cache->random_info=AcquireRandomInfo();
+  cache->exception=AcquireExceptionInfo();
+  cache->directories=NewSplayTree(CompareSplayTreeString,
+    RelinquishMagickMemory,(void *(*)(void *)) NULL);
+  cache->signature=MagickCacheSignature;
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  cache->root=open_utf8(path,O_RDONLY | O_DIRECTORY | O_CLOEXEC,0);
+  if (cache->root == -1)
+    cache=DestroyMagickCache(cache);
+#else
+  if (IsPathAccessible(path) == MagickFalse)
+    cache=DestroyMagickCache(cache);
+#endif
+  return(cache);
+}
+
+static MagickCache **DestroyMagickCacheRoots(MagickCache **roots,
+  size_t *number_roots)
+{
+  size_t
+    i;
+
+  for (i=0; i < *number_roots; i++)
+    roots[i]=DestroyMagickCache(roots[i]);
+  *number_roots=0;
+  if (roots != (MagickCache **) NULL)
+    roots=(MagickCache **) RelinquishMagickMemory(roots);
+  return(roots);
+}
+
+static MagickCache **AcquireMagickCacheRoots(MagickCache *cache,
+  const char *list,size_t *number_roots)
+{
+  char
+    path[MagickPathExtent];
+
+  const char
+    *p,
+    *q;
+
+  MagickCache
+    **roots;
+
+  size_t
+    extent;
+
+  /*
+    Open each root of a list separated like the PATH environment variable.
+  */
+  *number_roots=0;
+  extent=1;
+  for (p=list; *p != '\0'; p++)
+    if (*p == DirectoryListSeparator)
+      extent++;
+  roots=(MagickCache **) AcquireQuantumMemory(extent,sizeof(*roots));
+  if (roots == (MagickCache **) NULL)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        ResourceLimitError,"MemoryAllocationFailed","`%s'",list);
+      return(roots);
+    }
+  for (p=list; *p != '\0'; p=(*q == '\0') ? q : q+1)
+  {
+    for (q=p; (*q != DirectoryListSeparator) && (*q != '\0'); q++) ;
+    if (q == p)
+      continue;
+    (void) CopyMagickString(path,p,MagickCacheMin((size_t) (q-p)+1,
+      MagickPathExtent));
+    roots[*number_roots]=AcquireMagickCacheTier(path);
+    if (roots[*number_roots] == (MagickCache *) NULL)
+      {
+        (void) ThrowMagickException(cache->exception,GetMagickModule(),
+          CacheError,"cannot open root","`%s'",path);
+        return(DestroyMagickCacheRoots(roots,number_roots));
+      }
+    (*number_roots)++;
+  }
+  return(roots);
+}
+
+static MagickBooleanType SyncMagickCacheRoots(MagickCache *cache,
+  const char *key,MagickCache ***roots,size_t *number_roots,char **list)
+{
+  const char
+    *value;
+
+  /*
+    Reopen the roots named by an option only when the option changed.
+  */
+  value=GetMagickCacheOption(cache,key);
+  if ((value == (const char *) NULL) && (*list == (char *) NULL))
+    return(MagickTrue);
+  if ((value != (const char *) NULL) && (*list != (char *) NULL) &&
+      (strcmp(value,*list) == 0))
+    return(MagickTrue);
+  *roots=DestroyMagickCacheRoots(*roots,number_roots);
+  if (*list != (char *) NULL)
+    *list=DestroyString(*list);
+  if (value == (const char *) NULL)
+    return(MagickTrue);
+  *roots=AcquireMagickCacheRoots(cache,value,number_roots);
+  if (*roots == (MagickCache **) NULL)
+    return(MagickFalse);
+  *list=ConstantString(value);
+  return(MagickTrue);
+}
+
+static void CloseMagickCacheChanges(MagickCache *cache)
+{
+  if (cache->changes == -1)
+    return;
+  (void) close_utf8(cache->changes);
+  cache->changes=(-1);
+}
+
+static MagickBooleanType OpenMagickCacheChanges(MagickCache *cache)
+{
+  if (cache->changes != -1)
+    return(MagickTrue);
+  cache->changes=OpenMagickCacheFile(cache,MagickCacheChanges,O_WRONLY |
+    O_CREAT | O_APPEND,S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH |
+    S_IWOTH);
+  if (cache->changes == -1)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot open file","`%s'",MagickCacheChanges);
+      return(MagickFalse);
+    }
+  return(MagickTrue);
+}
+
+static MagickBooleanType RecordMagickCacheChange(MagickCache *cache,
+  const MagickCacheResource *resource,const MagickCacheChangeType type)
+{
+  size_t
+    length;
+
+  struct
+  {
+    struct ChangeRecord
+      record;
+
+    char
+      iri[MagickPathExtent];
+  } entry;
+
+  /*
+    Append a change once it is complete.  The offset just past its record is
+    its sequence, so a reader resumes with a single seek however long the
+    feed grows.
+  */
+  if (cache->changes == -1)
+    return(MagickTrue);
+  length=MagickCacheMin(strlen(resource->iri),MagickPathExtent-1);
+  (void) memset(&entry.record,0,sizeof(entry.record));
+  entry.record.length=(unsigned int) (sizeof(entry.record)+length);
+  entry.record.type=(unsigned int) type;
+  entry.record.timestamp=(MagickOffsetType) time((time_t *) NULL);
+  (void) memcpy(entry.iri,resource->iri,length);
+  entry.record.signature=CRC32((const unsigned char *) &entry+
+    sizeof(entry.record.signature),entry.record.length-
+    sizeof(entry.record.signature));
+  if (WriteMagickCacheBlob(cache->changes,&entry,entry.record.length) ==
+      MagickFalse)
+    {
+      /*
+        The put or delete itself is done, so this is only a warning.
+      */
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheWarning,"cannot write change feed","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  return(MagickTrue);
+}
+
+static MagickOffsetType AppendMagickCacheJournal(MagickCache *cache,
+  const JournalRecordType type,const MagickCacheResource *resource,
+  const MagickOffsetType extent)
+{
+  const char
+    *iri;
+
+  size_t
+    length;
+
+  struct
+  {
+    struct JournalRecord
+      record;
+
+    char
+      iri[MagickPathExtent];
+  } entry;
+
+  /*
+    Append a record in a single write; with O_APPEND the records of
+    concurrent writers do not interleave and a torn final record fails its
+    checksum.
+  */
+  iri=GetMagickCacheRelativePath(resource->iri);
+  length=MagickCacheMin(strlen(iri),MagickPathExtent);
+  (void) memset(&entry.record,0,sizeof(entry.record));
+  entry.record.length=(unsigned int) (sizeof(entry.record)+length);
+  entry.record.type=(unsigned int) type;
+  entry.record.sequence=resource->sequence;
+  entry.record.extent=extent;
+  (void) memcpy(entry.record.nonce,GetStringInfoDatum(resource->nonce),
+    MagickCacheNonceExtent);
+  (void) memcpy(entry.record.id,resource->id,MagickCacheMin(strlen(
+    resource->id),MagickCacheDigestExtent));
+  (void) memcpy(entry.iri,iri,length);
+  entry.record.signature=CRC32((const unsigned char *) &entry+
+    sizeof(entry.record.signature),entry.record.length-
+    sizeof(entry.record.signature));
+  if (WriteMagickCacheBlob(cache->journal,&entry,entry.record.length) ==
+      MagickFalse)
+    return(-1);
+  return(MagickCacheAtomicAdd(&cache->journal_written,1));
+}
+
+static MagickBooleanType SyncMagickCacheFile(const MagickCache *cache,
+  const char *path)
+{
+  int
+    file;
+
+  MagickBooleanType
+    status;
+
+  file=OpenMagickCacheFile(cache,path,O_RDONLY,0);
+  if (file == -1)
+    return(MagickFalse);
+  status=fsync_utf8(file) == 0 ? MagickTrue : MagickFalse;
+  (void) close_utf8(file);
+  return(status);
+}
+
+static MagickBooleanType SyncMagickCacheJournal(MagickCache *cache,
+  const MagickOffsetType record)
+{
+  MagickBooleanType
+    status;
+
+  MagickOffsetType
+    written;
+
+  time_t
+    timestamp;
+
+  /*
+    Group commit: the first writer to get here syncs every record appended
+    so far and the writers whose records it covered return without a sync
+    of their own.
+  */
+  if (cache->durability == NoJournalDurability)
+    return(MagickTrue);
+  timestamp=time((time_t *) NULL);
+  if ((cache->durability == PeriodicJournalDurability) &&
+      ((timestamp-(time_t) MagickCacheAtomicLoad(&cache->journal_timestamp)) <
+       (time_t) cache->journal_interval))
+    return(MagickTrue);
+  if (MagickCacheAtomicLoad(&cache->journal_synced) >= record)
+    return(MagickTrue);
+  status=MagickTrue;
+  LockSemaphoreInfo(cache->journal_semaphore);
+  if (MagickCacheAtomicLoad(&cache->journal_synced) < record)
+    {
+      written=MagickCacheAtomicLoad(&cache->journal_written);
+      if (fsync_utf8(cache->journal) != 0)
+        status=MagickFalse;
+      else
+        {
+          MagickCacheAtomicStore(&cache->journal_synced,written);
+          MagickCacheAtomicStore(&cache->journal_timestamp,(MagickOffsetType)
+            timestamp);
+        }
+    }
+  UnlockSemaphoreInfo(cache->journal_semaphore);
+  return(status);
+}
+
+static void SyncMagickCacheFileSystems(MagickCache *cache)
+{
+#if defined(MAGICKCACHE_HAVE_SYNCFS)
+  size_t
+    i;
+
+  /*
+    Flush the file systems that hold the repository roots, not every one on
+    the host.
+  */
+  (void) syscall(SYS_syncfs,cache->root);
+  for (i=0; i < cache->number_shards; i++)
+    (void) syscall(SYS_syncfs,cache->shards[i]->root);
+  for (i=0; i < cache->number_mirrors; i++)
+    (void) syscall(SYS_syncfs,cache->mirrors[i]->root);
+  if (cache->cold != (MagickCache *) NULL)
+    (void) syscall(SYS_syncfs,cache->cold->root);
+#else
+  (void) cache;
+  sync();
+#endif
+}
+
+static void ReleaseMagickCacheJournal(MagickCache *cache)
+{
+  struct stat
+    attributes;
+
+  /*
+    The last put or delete in flight drops the shared lock.  A journal grown
+    past MagickCacheJournalExtent is then checkpointed, provided no process
+    has one in flight: every record left is complete or was abandoned by a
+    crash, so the replay that rolls back the abandoned ones empties it.
+  */
+  LockSemaphoreInfo(cache->journal_semaphore);
+  cache->journal_pending--;
+#if defined(LOCK_EX)
+  if (cache->journal_pending == 0)
+    {
+      (void) flock(cache->journal,LOCK_UN);
+      if ((fstat(cache->journal,&attributes) == 0) &&
+          (attributes.st_size >= MagickCacheJournalExtent) &&
+          (flock(cache->journal,LOCK_EX | LOCK_NB) == 0))
+        {
+          /*
+            Periodic mode never syncs a payload, the journal is all that
+            catches a torn one; flush them before it is discarded.
+          */
+          if (cache->durability == PeriodicJournalDurability)
+            SyncMagickCacheFileSystems(cache);
+          RecoverMagickCacheJournal(cache);
+          (void) flock(cache->journal,LOCK_UN);
+        }
+    }
+#endif
+  UnlockSemaphoreInfo(cache->journal_semaphore);
+}
+
+static MagickBooleanType BeginMagickCacheJournal(MagickCache *cache,
+  MagickCacheResource *resource,const JournalRecordType type,
+  const MagickOffsetType extent)
+{
+  MagickOffsetType
+    record;
+
+  /*
+    Log a put or delete before any of its files change.  In group mode the
+    record is on disk before the first of them does.  While any is in
+    flight the handle holds a shared lock on the journal, which keeps every
+    process from checkpointing it.  A delete logs the footprint it gives
+    back, so recovery can give it back once.
+  */
+  resource->sequence=0;
+  if (cache->journal == -1)
+    return(MagickTrue);
+  while (resource->sequence == 0)
+    SetRandomKey(cache->random_info,sizeof(resource->sequence),
+      (unsigned char *) &resource->sequence);
+  LockSemaphoreInfo(cache->journal_semaphore);
+#if defined(LOCK_SH)
+  if (cache->journal_pending == 0)
+    (void) flock(cache->journal,LOCK_SH);
+#endif
+  cache->journal_pending++;
+  UnlockSemaphoreInfo(cache->journal_semaphore);
+  record=AppendMagickCacheJournal(cache,type,resource,extent);
+  if ((record < 0) || ((cache->durability == GroupJournalDurability) &&
+      (SyncMagickCacheJournal(cache,record) == MagickFalse)))
+    {
+      ReleaseMagickCacheJournal(cache);
+      resource->sequence=0;
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot write journal","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  return(MagickTrue);
+}
+
+static MagickBooleanType CommitMagickCacheJournal(MagickCache *cache,
+  MagickCacheResource *resource,const JournalRecordType type,
+  const MagickBooleanType status)
+{
+  char
+    *path;
+
+  MagickCache
+    *tier;
+
+  MagickOffsetType
+    extent,
+    record;
+
+  size_t
+    i;
+
+  /*
+    Log the outcome of a put or delete.  A put records its payload extent,
+    which recovery verifies; in group mode the payload, the sentinel, and
+    their directories are on disk before the record is.
+  */
+  if (resource->sequence == 0)
+    return(status);
+  extent=(-1);
+  if ((type == PutJournalRecord) && (status != MagickFalse))
+    {
+      tier=GetMagickCacheTier(cache,resource);
+      if (cache->durability == GroupJournalDurability)
+        {
+          path=AcquireMagickCacheResourcePath(resource,resource->id);
+          (void) SyncMagickCacheFile(tier,path);
+          path=DestroyString(path);
+          for (i=0; (resource->resource_type == ImageResourceType) &&
+               (i < (sizeof(ImageResourceFiles)/sizeof(*ImageResourceFiles)));
+               i++)
+          {
+            path=AcquireMagickCacheResourcePath(resource,resource->id);
+            (void) ConcatenateString(&path,ImageResourceFiles[i]);
+            (void) SyncMagickCacheFile(tier,path);
+            path=DestroyString(path);
+          }
+          path=AcquireMagickCacheResourcePath(resource,
+            MagickCacheResourceSentinel);
+          (void) SyncMagickCacheFile(cache,path);
+          path=DestroyString(path);
+          path=AcquireMagickCacheResourcePath(resource,(const char *) NULL);
+          (void) SyncMagickCacheFile(cache,path);
+          if (tier != cache)
+            (void) SyncMagickCacheFile(tier,path);
+          path=DestroyString(path);
+        }
+      extent=(MagickOffsetType) GetMagickCachePayloadExtent(tier,resource);
+    }
+  record=AppendMagickCacheJournal(cache,CommitJournalRecord,resource,extent);
+  resource->sequence=0;
+  if ((record >= 0) && (SyncMagickCacheJournal(cache,record) == MagickFalse))
+    record=(-1);
+  ReleaseMagickCacheJournal(cache);
+  if (record < 0)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot write journal","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  return(status);
+}
+
+static MagickBooleanType ExpungeMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource,const MagickOffsetType extent)
+{
+  char
+    *path;
+
+  size_t
+    i,
+    length;
+
+  unsigned char
+    *sentinel;
+
+  /*
+    Remove whatever a resource left behind in any root, provided its
+    sentinel is still the one that was logged and not a later put's.  Only
+    then is the logged extent given back, so it is given back once.
+  */
+  path=AcquireMagickCacheResourcePath(resource,MagickCacheResourceSentinel);
+  sentinel=(unsigned char *) ReadMagickCacheFile(cache,path,&length,
+    resource->exception);
+  if ((sentinel == (unsigned char *) NULL) ||
+      (length < (sizeof(unsigned int)+MagickCacheNonceExtent)) ||
+      (memcmp(sentinel+sizeof(unsigned int),GetStringInfoDatum(
+        resource->nonce),MagickCacheNonceExtent) != 0))
+    {
+      if (sentinel != (unsigned char *) NULL)
+        sentinel=(unsigned char *) RelinquishMagickMemory(sentinel);
+      path=DestroyString(path);
+      return(MagickFalse);
+    }
+  sentinel=(unsigned char *) RelinquishMagickMemory(sentinel);
+  for (i=0; i <= cache->number_shards; i++)
+  {
+    RemoveMagickCacheResourcePayload(GetMagickCacheShard(cache,i),resource);
+    if (i != 0)
+      RemoveMagickCacheResourcePath(GetMagickCacheShard(cache,i),resource);
+  }
+  UnmirrorMagickCacheResource(cache,resource);
+  if (cache->cold != (MagickCache *) NULL)
+    {
+      RemoveMagickCacheResourcePayload(cache->cold,resource);
+      RemoveMagickCacheResourcePath(cache->cold,resource);
+    }
+  (void) RemoveMagickCacheFile(cache,path);
+  path=DestroyString(path);
+  UpdateMagickCacheUsage(cache,-((MagickOffsetType)
+    RemoveMagickCacheResourceRenditions(cache,resource)),0);
+  RemoveMagickCacheResourcePath(cache,resource);
+  UpdateMagickCacheUsage(cache,-extent,-1);
+  (void) RecordMagickCacheChange(cache,resource,DeleteChangeType);
+  return(MagickTrue);
+}
+
+static void *DestroyJournalEntry(void *entry)
+{
+  struct JournalEntry
+    *journal_entry;
+
+  journal_entry=(struct JournalEntry *) entry;
+  journal_entry->iri=DestroyString(journal_entry->iri);
+  return(RelinquishMagickMemory(journal_entry));
+}
+
+static void RecoverMagickCacheJournal(MagickCache *cache)
+{
+  char
+    key[MagickPathExtent];
+
+  const struct JournalEntry
+    *entry;
+
+  MagickCacheResource
+    *resource;
+
+  size_t
+    extent,
+    offset;
+
+  SplayTreeInfo
+    *entries;
+
+  struct JournalRecord
+    record;
+
+  unsigned char
+    *journal;
+
+  /*
+    Replay the journal tail: roll back the puts that never committed or
+    whose payload is not the extent they committed, and finish the deletes
+    that never committed.  The tail is then discarded.
+  */
+  journal=(unsigned char *) ReadMagickCacheFile(cache,MagickCacheJournal,
+    &extent,cache->exception);
+  if (journal == (unsigned char *) NULL)
+    return;
+  entries=NewSplayTree(CompareSplayTreeString,RelinquishMagickMemory,
+    DestroyJournalEntry);
+  for (offset=0; (offset+sizeof(record)) <= extent; offset+=record.length)
+  {
+    struct JournalEntry
+      *journal_entry;
+
+    (void) memcpy(&record,journal+offset,sizeof(record));
+    if ((record.length < sizeof(record)) ||
+        (record.length > (sizeof(record)+MagickPathExtent-1)) ||
+        ((offset+record.length) > extent) ||
+        (CRC32(journal+offset+sizeof(record.signature),record.length-
+         sizeof(record.signature)) != record.signature))
+      break;
+    (void) FormatLocaleString(key,MagickPathExtent,"%llx",(unsigned long long)
+      record.sequence);
+    if (record.type == CommitJournalRecord)
+      {
+        journal_entry=(struct JournalEntry *) GetValueFromSplayTree(entries,
+          key);
+        if (journal_entry != (struct JournalEntry *) NULL)
+          {
+            journal_entry->committed=MagickTrue;
+            journal_entry->extent=record.extent;
+          }
+        continue;
+      }
+    journal_entry=(struct JournalEntry *) AcquireCriticalMemory(
+      sizeof(*journal_entry));
+    (void) memset(journal_entry,0,sizeof(*journal_entry));
+    journal_entry->type=(JournalRecordType) record.type;
+    journal_entry->extent=record.extent;
+    (void) memcpy(journal_entry->nonce,record.nonce,MagickCacheNonceExtent);
+    (void) memcpy(journal_entry->id,record.id,MagickCacheDigestExtent);
+    journal_entry->iri=AcquireString((const char *) NULL);
+    (void) memcpy(journal_entry->iri,journal+offset+sizeof(record),
+      record.length-sizeof(record));
+    journal_entry->iri[record.length-sizeof(record)]='\0';
+    (void) AddValueToSplayTree(entries,ConstantString(key),journal_entry);
+  }
+  journal=(unsigned char *) RelinquishMagickMemory(journal);
+  ResetSplayTreeIterator(entries);
+  for (entry=(const struct JournalEntry *) GetNextValueInSplayTree(entries);
+       entry != (const struct JournalEntry *) NULL;
+       entry=(const struct JournalEntry *) GetNextValueInSplayTree(entries))
+  {
+    char
+      *path;
+
+    struct stat
+      attributes;
+
+    if ((entry->type == DeleteJournalRecord) &&
+        (entry->committed != MagickFalse))
+      continue;
+    resource=AcquireMagickCacheResource(cache,entry->iri);
+    (void) CloneString(&resource->id,entry->id);
+    (void) memcpy(GetStringInfoDatum(resource->nonce),entry->nonce,
+      MagickCacheNonceExtent);
+    if ((entry->type == PutJournalRecord) &&
+        (entry->committed != MagickFalse) && (entry->extent >= 0))
+      {
+        MagickBooleanType
+          status;
+
+        path=AcquireMagickCacheResourcePath(resource,resource->id);
+        status=LocateMagickCacheResource(cache,resource->iri,path,&attributes,
+          &resource->shard,&resource->cold);
+        path=DestroyString(path);
+        if ((status != MagickFalse) && ((MagickOffsetType)
+             GetMagickCachePayloadExtent(GetMagickCacheTier(cache,resource),
+             resource) == entry->extent))
+          {
+            resource=RelinquishMagickCacheResource(cache,resource);
+            continue;
+          }
+      }
+    (void) ExpungeMagickCacheResource(cache,resource,
+      MagickCacheMax(entry->extent,0));
+    resource=RelinquishMagickCacheResource(cache,resource);
+  }
+  entries=DestroySplayTree(entries);
+  if (ftruncate(cache->journal,0) == 0)
+    (void) fsync_utf8(cache->journal);
+}
+
+static void CloseMagickCacheJournal(MagickCache *cache)
+{
+  if (cache->journal == -1)
+    return;
+  if (cache->durability != NoJournalDurability)
+    (void) fsync_utf8(cache->journal);
+  (void) close_utf8(cache->journal);
+  cache->journal=(-1);
+  cache->journal_pending=0;
+}
+
+static MagickBooleanType OpenMagickCacheJournal(MagickCache *cache)
+{
+  if (cache->journal != -1)
+    return(MagickTrue);
+  cache->journal=OpenMagickCacheFile(cache,MagickCacheJournal,O_RDWR |
+    O_CREAT | O_APPEND,S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH |
+    S_IWOTH);
+  if (cache->journal == -1)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot open file","`%s'",MagickCacheJournal);
+      return(MagickFalse);
+    }
+  if (cache->journal_semaphore == (SemaphoreInfo *) NULL)
+    cache->journal_semaphore=AcquireSemaphoreInfo();
+  /*
+    Recover only if no process has a put or delete in flight, as the tail
+    may hold their records.
+  */
+#if defined(LOCK_EX)
+  if (flock(cache->journal,LOCK_EX | LOCK_NB) == 0)
+    {
+      RecoverMagickCacheJournal(cache);
+      (void) flock(cache->journal,LOCK_UN);
+    }
+#else
+  RecoverMagickCacheJournal(cache);
+#endif
+  return(MagickTrue);
+}
+
+static MagickBooleanType SyncMagickCacheOptions(MagickCache *cache)
+{
+  const char
+    *value;
+
+  /*
+    Parse the capacity and eviction options.
+  */
+  cache->extent_limit=0;
+  value=GetMagickCacheOption(cache,"capacity:extent");
+  if (value != (const char *) NULL)
+    cache->extent_limit=(MagickSizeType) InterpretSiPrefixValue(value,
+      (char **) NULL);
+  cache->count_limit=0;
+  value=GetMagickCacheOption(cache,"capacity:count");
+  if (value != (const char *) NULL)
+    cache->count_limit=(MagickSizeType) InterpretSiPrefixValue(value,
+      (char **) NULL);
+  cache->watermark=90;
+  value=GetMagickCacheOption(cache,"capacity:watermark");
+  if (value != (const char *) NULL)
+    cache->watermark=(size_t) MagickCacheMin(MagickCacheMax(
+      InterpretLocaleValue(value,(char **) NULL),1.0),100.0);
+  cache->eviction=LRUEvictionPolicy;
+  value=GetMagickCacheOption(cache,"eviction");
+  if ((value != (const char *) NULL) && (LocaleCompare(value,"fifo") == 0))
+    cache->eviction=FIFOEvictionPolicy;
+  if ((value != (const char *) NULL) && (LocaleCompare(value,"lfu") == 0))
+    cache->eviction=LFUEvictionPolicy;
+  cache->promote=2;
+  value=GetMagickCacheOption(cache,"tier:promote");
+  if (value != (const char *) NULL)
+    cache->promote=(size_t) MagickCacheMax(InterpretLocaleValue(value,
+      (char **) NULL),1.0);
+  value=GetMagickCacheOption(cache,"tier:cold");
+  if ((cache->cold != (MagickCache *) NULL) &&
+      ((value == (const char *) NULL) ||
+       (strcmp(value,cache->cold->path) != 0)))
+    cache->cold=DestroyMagickCache(cache->cold);
+  if ((value != (const char *) NULL) && (cache->cold == (MagickCache *) NULL))
+    {
+      cache->cold=AcquireMagickCacheTier(value);
+      if (cache->cold == (MagickCache *) NULL)
+        {
+          (void) ThrowMagickException(cache->exception,GetMagickModule(),
+            CacheError,"cannot open tier","`%s'",value);
+          return(MagickFalse);
+        }
+    }
+  if (SyncMagickCacheRoots(cache,"shard:roots",&cache->shards,
+       &cache->number_shards,&cache->shard_roots) == MagickFalse)
+    return(MagickFalse);
+  if (SyncMagickCacheRoots(cache,"mirror:roots",&cache->mirrors,
+       &cache->number_mirrors,&cache->mirror_roots) == MagickFalse)
+    return(MagickFalse);
+  cache->hedge=50000;
+  value=GetMagickCacheOption(cache,"mirror:latency");
+  if (value != (const char *) NULL)
+    cache->hedge=(MagickOffsetType) (1000.0*InterpretLocaleValue(value,
+      (char **) NULL));
+  if (((cache->extent_limit != 0) || (cache->count_limit != 0)) &&
+      (cache->usage == (struct CacheUsage *) NULL) &&
+      (OpenMagickCacheUsage(cache) == MagickFalse))
+    return(MagickFalse);
+  value=GetMagickCacheOption(cache,"pyramid");
+  cache->pyramid=IsStringTrue(value);
+  value=GetMagickCacheOption(cache,"source");
+  cache->source=IsStringTrue(value);
+  value=GetMagickCacheOption(cache,"source:lazy");
+  cache->lazy=IsStringTrue(value);
+  value=GetMagickCacheOption(cache,"packed");
+  cache->packed=IsStringTrue(value);
+  value=GetMagickCacheOption(cache,"frames");
+  cache->frames=IsStringTrue(value);
+  cache->tiles=0;
+  value=GetMagickCacheOption(cache,"tiles");
+  if (value != (const char *) NULL)
+    {
+      cache->tiles=(size_t) MagickCacheMax(InterpretLocaleValue(value,
+        (char **) NULL),0.0);
+      if ((cache->tiles == 0) && (IsStringTrue(value) != MagickFalse))
+        cache->tiles=MagickCacheTileExtent;
+    }
+  value=GetMagickCacheOption(cache,"changes");
+  if ((value == (const char *) NULL) || (IsStringTrue(value) == MagickFalse))
+    CloseMagickCacheChanges(cache);
+  else
+    if (OpenMagickCacheChanges(cache) == MagickFalse)
+      return(MagickFalse);
+  /*
+    The journal opens last: its recovery needs the roots and the counters.
+  */
+  cache->journal_interval=1;
+  value=GetMagickCacheOption(cache,"journal:interval");
+  if (value != (const char *) NULL)
+    cache->journal_interval=(size_t) MagickCacheMax(InterpretLocaleValue(value,
+      (char **) NULL),0.0);
+  cache->durability=UndefinedJournalDurability;
+  value=GetMagickCacheOption(cache,"journal");
+  if (value != (const char *) NULL)
+    {
+      cache->durability=GroupJournalDurability;
+      if (LocaleCompare(value,"none") == 0)
+        cache->durability=NoJournalDurability;
+      if (LocaleCompare(value,"periodic") == 0)
+        cache->durability=PeriodicJournalDurability;
+    }
+  if (cache->durability == UndefinedJournalDurability)
+    {
+      CloseMagickCacheJournal(cache);
+      return(MagickTrue);
+    }
+  return(OpenMagickCacheJournal(cache));
+}
+
+static struct CacheAccess *AcquireMagickCacheAccess(MagickCache *cache)
+{
+  const char
+    *value;
+
+  int
+    file;
+
+  MagickSizeType
+    extent;
+
+  struct CacheAccess
+    access;
+
+  struct stat
+    attributes;
+
+  /*
+    The access table is a header followed by a fixed number of slots, one per
+    resource ID modulo collisions.  It is created on first use; untouched
+    slots remain a hole in a sparse file.
+  */
+  if (cache->access_opened != MagickFalse)
+    return(cache->access);
+  file=OpenMagickCacheFile(cache,MagickCacheAccess,O_RDWR | O_CREAT | O_EXCL,
+    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (file != -1)
+    {
+      (void) memset(&access,0,sizeof(access));
+      access.slots=MagickCacheAccessSlots;
+      value=GetMagickCacheOption(cache,"access:slots");
+      if (value != (const char *) NULL)
+        access.slots=(MagickOffsetType) MagickCacheMax(InterpretSiPrefixValue(
+          value,(char **) NULL),1.0);
+      extent=sizeof(access)+(MagickSizeType) access.slots*
+        sizeof(struct CacheAccessSlot);
+      if ((WriteMagickCacheBlob(file,&access,sizeof(access)) == MagickFalse) ||
+          (lseek(file,(off_t) extent-1,SEEK_SET) < 0) ||
+          (WriteMagickCacheBlob(file,"",1) == MagickFalse))
+        file=close_utf8(file)-1;
+    }
+  else
+    if (errno == EEXIST)
+      file=OpenMagickCacheFile(cache,MagickCacheAccess,O_RDWR,0);
+  if (file == -1)
+    {
+      cache->access_opened=MagickTrue;
+      return((struct CacheAccess *) NULL);
+    }
+  /*
+    Another process may still be writing the header or sizing the table;
+    it is opened again on the next access rather than given up on.
+  */
+  if ((fstat(file,&attributes) != 0) || (lseek(file,0,SEEK_SET) != 0) ||
+      (read(file,&access,sizeof(access)) != (ssize_t) sizeof(access)) ||
+      (access.slots <= 0))
+    {
+      (void) close_utf8(file);
+      return((struct CacheAccess *) NULL);
+    }
+  extent=sizeof(access)+(MagickSizeType) access.slots*
+    sizeof(struct CacheAccessSlot);
+  if ((MagickSizeType) attributes.st_size < extent)
+    {
+      (void) close_utf8(file);
+      return((struct CacheAccess *) NULL);
+    }
+  cache->access_opened=MagickTrue;
+  cache->access=(struct CacheAccess *) MapResourceBlob(file,IOMode,0,(size_t)
+    extent);
+  (void) close_utf8(file);
+  if (cache->access != (struct CacheAccess *) NULL)
+    cache->access_extent=(size_t) extent;
+  return(cache->access);
+}
+
+static struct CacheAccessSlot *GetMagickCacheAccessSlot(
+  const struct CacheAccess *access,const char *id,MagickOffsetType *tag)
+{
+  MagickSizeType
+    hash;
+
+  size_t
+    i;
+
+  /*
+    The resource ID is a hex digest: its leading 64 bits pick the slot and
+    the next 64 bits tag it, so a slot reused by another ID is recognized.
+  */
+  hash=0;
+  *tag=0;
+  for (i=0; (i < 32) && (id[i] != '\0'); i++)
+  {
+    MagickSizeType
+      nibble;
+
+    nibble=(MagickSizeType) (isdigit((int) ((unsigned char) id[i])) != 0 ?
+      id[i]-'0' : (tolower((int) ((unsigned char) id[i]))-'a'+10) & 0x0f);
+    if (i < 16)
+      hash=(hash << 4) | nibble;
+    else
+      *tag=(MagickOffsetType) (((MagickSizeType) *tag << 4) | nibble);
+  }
+  *tag|=1;
+  return((struct CacheAccessSlot *) (access+1)+(hash % (MagickSizeType)
+    access->slots));
+}
+
+static MagickOffsetType RecordMagickCacheAccess(MagickCache *cache,
+  const MagickCacheResource *resource,const MagickBooleanType hit)
+{
+  MagickOffsetType
+    hits,
+    tag;
+
+  struct CacheAccess
+    *access;
+
+  struct CacheAccessSlot
+    *slot;
+
+  /*
+    Count a hit or miss.  Updates are relaxed and may race, so the counters
+    are approximate, but the hit path never takes a lock or a system call.
+  */
+  access=AcquireMagickCacheAccess(cache);
+  if (access == (struct CacheAccess *) NULL)
+    return(1);
+  if (hit == MagickFalse)
+    {
+      (void) MagickCacheAtomicAdd(&access->misses,1);
+      return(0);
+    }
+  (void) MagickCacheAtomicAdd(&access->hits,1);
+  slot=GetMagickCacheAccessSlot(access,resource->id,&tag);
+  if (MagickCacheAtomicLoad(&slot->tag) != tag)
+    {
+      MagickCacheAtomicStore(&slot->tag,tag);
+      MagickCacheAtomicStore(&slot->hits,0);
+    }
+  hits=MagickCacheAtomicAdd(&slot->hits,1);
+  MagickCacheAtomicStore(&slot->accessed,(MagickOffsetType) time(0));
+  return(hits);
+}
+
+MagickExport MagickCache *AcquireMagickCache(const char *path,
+  const StringInfo *passkey)
+{
+  MagickCache
+    *cache;
+
+  size_t
+    extent;
+
+  struct stat
+    attributes;
+
+  unsigned int
+    signature;
+
+  void
+    *sentinel;
+
+  /*
+    Confirm the path exists.
+  */
+  if (path == (const char *) NULL)
+    return((MagickCache *) NULL);
+  if (GetPathAttributes(path,&attributes) <= 0)
+    return((MagickCache *) NULL);
+  /*
+    Basic sanity check passes, allocate & initialize a MagickCache struture.
+  */
+  cache=(MagickCache *) AcquireCriticalMemory(sizeof(*cache));
+  (void) memset(cache,0,sizeof(*cache));
+  cache->path=ConstantString(path);
+  cache->root=(-1);
+  cache->journal=(-1);
+  cache->changes=(-1);
+  cache->timestamp=(time_t) attributes.st_ctime;
+  cache->random_info=AcquireRandomInfo();
+  cache->nonce=AcquireStringInfo(MagickCacheNonceExtent);
+  if (passkey == (StringInfo *) NULL)
+    cache->passkey=AcquireStringInfo(0);
+  else
+    cache->passkey=CloneStringInfo(passkey);
+  cache->digest=StringInfoToDigest(cache->passkey);
+  cache->exception=AcquireExceptionInfo();
+  cache->directories=NewSplayTree(CompareSplayTreeString,
+    RelinquishMagickMemory,(void *(*)(void *)) NULL);
+  cache->options=NewSplayTree(CompareSplayTreeString,RelinquishMagickMemory,
+    RelinquishMagickMemory);
+  cache->semaphore=AcquireSemaphoreInfo();
+  cache->debug=IsEventLogging();
+  cache->signature=MagickCacheSignature;
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  cache->root=open_utf8(path,O_RDONLY | O_DIRECTORY | O_CLOEXEC,0);
+  if (cache->root == -1)
+    {
+      cache=DestroyMagickCache(cache);
+      return((MagickCache *) NULL);
+    }
+#endif
+  /*
+    Validate the MagickCache sentinel.
+  */
+  sentinel=ReadMagickCacheFile(cache,MagickCacheSentinel,&extent,
+    cache->exception);
+  if (sentinel == NULL)
+    {
+      cache=DestroyMagickCache(cache);
+      return((MagickCache *) NULL);
+    }
+  GetMagickCacheSentinel(cache,(unsigned char *) sentinel);
+  signature=GetMagickCacheSignature(cache->nonce);
+  if (memcmp(&signature,sentinel,sizeof(signature)) != 0)
+    {
+      sentinel=RelinquishMagickMemory(sentinel);
+      cache=DestroyMagickCache(cache);
+      return((MagickCache *) NULL);
+    }
+  sentinel=RelinquishMagickMemory(sentinel);
+  LoadMagickCacheOptions(cache);
+  if (SyncMagickCacheOptions(cache) == MagickFalse)
+    {
+      cache=DestroyMagickCache(cache);
+      return((MagickCache *) NULL);
+    }
+  return(cache);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   A c q u i r e M a g i c k C a c h e R e s o u r c e                       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  AcquireMagickCacheResource() allocates the MagickCacheResource structure.
+%  It is required before you can get or put metadata associated with resource
+%  content.  A resource previously returned to the cache with
+%  RelinquishMagickCacheResource() is reused when one is available.
+%
+%  The format of the AcquireMagickCacheResource method is:
+%
+%      MagickCacheResource *AcquireMagickCacheResource(MagickCache *cache,
+%        const char *iri)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o iri: the IRI.
+%
+*/
+MagickExport MagickCacheResource *AcquireMagickCacheResource(MagickCache *cache,
+  const char *iri)
+{
+  MagickCacheResource
+    *resource;
+
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  LockSemaphoreInfo(cache->semaphore);
+  resource=cache->resources;
+  if (resource != (MagickCacheResource *) NULL)
+    {
+      cache->resources=resource->next;
+      cache->number_resources--;
+    }
+  UnlockSemaphoreInfo(cache->semaphore);
+  if (resource != (MagickCacheResource *) NULL)
+    {
+      resource->next=(MagickCacheResource *) NULL;
+      (void) ResetMagickCacheResource(resource,iri);
+      return(resource);
+    }
+  resource=(MagickCacheResource *) AcquireCriticalMemory(sizeof(*resource));
+  (void) memset(resource,0,sizeof(*resource));
+  resource->nonce=AcquireStringInfo(MagickCacheNonceExtent);
+  resource->version=MagickCacheAPIVersion;
+  resource->exception=AcquireExceptionInfo();
+  resource->signature=MagickCacheSignature;
+  (void) SetMagickCacheResourceIRI(cache,resource,iri);
+  return(resource);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   C l e a r M a g i c k C a c h e E x c e p t i o n                         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  ClearMagickCacheException() clears any exceptions associated with the cache.
+%
+%  The format of the ClearMagickCacheException method is:
+%
+%      MagickBooleanType ClearMagickCacheException(MagickCache *cache)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+*/
+MagickExport MagickBooleanType ClearMagickCacheException(MagickCache *cache)
+{
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  if (cache->debug != MagickFalse)
+    (void) LogMagickEvent(CacheEvent,GetMagickModule(),"%s",
+      cache->path != (char *) NULL ? cache->path : "");
+  ClearMagickException(cache->exception);
+  return(MagickTrue);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   C l e a r M a g i c k C a c h e R e s o u r c e E x c e p t i o n         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  ClearMagickCacheResourceException() clears any exceptions associated with
+%  the resource.
+%
+%  The format of the ClearMagickCacheResourceException method is:
+%
+%      MagickBooleanType ClearMagickCacheResourceException(
+%        MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+MagickExport MagickBooleanType ClearMagickCacheResourceException(
+  MagickCacheResource *resource)
+{
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  if (resource->debug != MagickFalse)
+    (void) LogMagickEvent(CacheEvent,GetMagickModule(),"%s",
+      resource->iri != (char *) NULL ? resource->iri : "");
+  ClearMagickException(resource->exception);
+  return(MagickTrue);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e E x t e n t                   %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceExtent() returns the resource extent associated with
+%  the resource.  That is, the number of bytes the resource consumes on disk.
+%
+%  The format of the GetMagickCacheResourceExtent method is:
+%
+%      size_t GetMagickCacheResourceExtent(const MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+MagickExport size_t GetMagickCacheResourceExtent(
+  const MagickCacheResource *resource)
+{
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(resource->extent);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e D e p t h                     %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceDepth() returns the bit depth of the image associated
+%  with the resource when it was put, e.g. 8 for a JPEG.  It is 0 for other
+%  resources and for images put before the depth was recorded.
+%
+%  The format of the GetMagickCacheResourceDepth method is:
+%
+%      size_t GetMagickCacheResourceDepth(const MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+MagickExport size_t GetMagickCacheResourceDepth(
+  const MagickCacheResource *resource)
+{
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(resource->depth);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   C l o s e M a g i c k C a c h e C u r s o r                               %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  CloseMagickCacheCursor() releases a cursor returned by
+%  OpenMagickCacheCursor().
+%
+%  The format of the CloseMagickCacheCursor method is:
+%
+%      MagickCacheCursor *CloseMagickCacheCursor(MagickCacheCursor *cursor)
+%
+%  A description of each parameter follows:
+%
+%    o cursor: the cursor.
+%
+*/
+static void PopMagickCacheCursorDirectory(MagickCacheCursor *cursor)
+{
+  struct CursorFrame
+    *frame;
+
+  /*
+    Ascend from the directory on top of the stack to its parent.
+  */
+  frame=cursor->frames+cursor->depth-1;
+  (void) closedir(frame->directory);
+  if (frame->names != (char **) NULL)
+    {
+      size_t
+        i;
+
+      for (i=0; i < frame->number_names; i++)
+        frame->names[i]=DestroyString(frame->names[i]);
+      frame->names=(char **) RelinquishMagickMemory(frame->names);
+    }
+  cursor->path[frame->length]='\0';
+  cursor->depth--;
+}
+
+MagickExport MagickCacheCursor *CloseMagickCacheCursor(
+  MagickCacheCursor *cursor)
+{
+  assert(cursor != (MagickCacheCursor *) NULL);
+  assert(cursor->signature == MagickCacheSignature);
+  while (cursor->depth != 0)
+    PopMagickCacheCursorDirectory(cursor);
+  if (cursor->frames != (struct CursorFrame *) NULL)
+    cursor->frames=(struct CursorFrame *) RelinquishMagickMemory(
+      cursor->frames);
+  if (cursor->nonce != (StringInfo *) NULL)
+    cursor->nonce=DestroyStringInfo(cursor->nonce);
+  if (cursor->patterns != (char **) NULL)
+    {
+      size_t
+        i;
+
+      for (i=0; i < cursor->number_patterns; i++)
+        cursor->patterns[i]=DestroyString(cursor->patterns[i]);
+      cursor->patterns=(char **) RelinquishMagickMemory(cursor->patterns);
+    }
+  cursor->signature=(~MagickCacheSignature);
+  cursor=(MagickCacheCursor *) RelinquishMagickMemory(cursor);
+  return(cursor);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   C r e a t e M a g i c k C a c h e                                         %
+%                                                                             %
+%                                                                             % %                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  CreateMagickCache() creates a MagickCache repository suitably prepared for
+%  storing and retrieving images, image sequences, video, and metadata
+%  resources.
+%
+%  The format of the CreateMagickCache method is:
+%
+%      MagickBooleanType CreateMagickCache(const char *path,
+%        const StringInfo *passkey)
+%
+%  A description of each parameter follows:
+%
+%    o path: the MagickCache directory path, absolute (e.g. /myrepo) or
+%      relative (e.g. ./myrepo).
+%
+%    o passkey: the MagickCache passkey.
+*/
+
+static StringInfo *SetMagickCacheSentinel(const char *path,
+  const StringInfo *passkey,const StringInfo *nonce)
+{
+  char
+    *digest;
+
+  RandomInfo
+    *random_info;
+
+  StringInfo
+    *key_info,
+    *cache_key,
+    *sentinel;
+
+  unsigned char
+    *p;
+
+  unsigned int
+    signature;
+
+  /*
+    Create a MagickCache sentinel.
+  */
+  sentinel=AcquireStringInfo(MagickPathExtent);
+  random_info=AcquireRandomInfo();
+  if (nonce == (const StringInfo *) NULL)
+    key_info=GetRandomKey(random_info,MagickCacheNonceExtent);
+  else
+    key_info=CloneStringInfo(nonce);
+  p=GetStringInfoDatum(sentinel);
+  signature=GetMagickCacheSignature(key_info);
+  (void) memcpy(p,&signature,sizeof(signature));
+  p+=sizeof(signature);
+  (void) memcpy(p,GetStringInfoDatum(key_info),MagickCacheNonceExtent);
+  p+=MagickCacheNonceExtent;
+  cache_key=StringToStringInfo(path);
+  if (passkey != (const StringInfo *) NULL)
+    ConcatenateStringInfo(cache_key,passkey);
+  ConcatenateStringInfo(cache_key,key_info);
+  digest=StringInfoToDigest(cache_key);
+  cache_key=DestroyStringInfo(cache_key);
+  (void) memcpy(p,digest,strlen(digest));
+  p+=strlen(digest);
+  SetStringInfoLength(sentinel,(size_t) (p-GetStringInfoDatum(sentinel)));
+  digest=DestroyString(digest);
+  key_info=DestroyStringInfo(key_info);
+  random_info=DestroyRandomInfo(random_info);
+  return(sentinel);
+}
+
+static MagickBooleanType CreateMagickCacheSentinel(const char *path,
+  const StringInfo *passkey,const StringInfo *nonce)
+{
+  char
+    *sentinel_path;
+
+  int
+    file;
+
+  MagickBooleanType
+    status;
+
+  StringInfo
+    *meta;
+
+  /*
+    Create the MagickCache sentinel, exclusively so we never clobber an
+    existing repository.
+  */
+  sentinel_path=AcquireString(path);
+  (void) ConcatenateString(&sentinel_path,"/");
+  (void) ConcatenateString(&sentinel_path,MagickCacheSentinel);
+  file=open_utf8(sentinel_path,O_WRONLY | O_CREAT | O_EXCL | O_BINARY,S_IRUSR |
+    S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  sentinel_path=DestroyString(sentinel_path);
+  if (file == -1)
+    return(MagickFalse);
+  meta=SetMagickCacheSentinel(path,passkey,nonce);
+  status=WriteMagickCacheBlob(file,GetStringInfoDatum(meta),
+    GetStringInfoLength(meta));
+  if (close_utf8(file) == -1)
+    status=MagickFalse;
+  meta=DestroyStringInfo(meta);
+  return(status);
+}
+
+MagickExport MagickBooleanType CreateMagickCache(const char *path,
+  const StringInfo *passkey)
+{
+  /*
+    Create the MagickCache path.
+  */
+  if (MagickCreatePath(path) == MagickFalse)
+    return(MagickFalse);
+  return(CreateMagickCacheSentinel(path,passkey,(const StringInfo *) NULL));
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   D e l e t e M a g i c k C a c h e R e s o u r c e                         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  DeleteMagickCacheResource() deletes a resource within the cache repository.
+%  The renditions of an image are deleted with it.
+%
+%  The format of the DeleteMagickCacheResource method is:
+%
+%      MagickBooleanType DeleteMagickCacheResource(MagickCache *cache,
+%        MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the MagickCache resource.
+%
+*/
+MagickExport MagickBooleanType DeleteMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    status;
+
+  MagickCache
+    *tier;
+
+  MagickCacheChangeType
+    type;
+
+  MagickSizeType
+    extent;
+
+  /*
+    Check that resource id exists in MagickCache.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    return(MagickFalse);
+  extent=0;
+  if (cache->usage != (struct CacheUsage *) NULL)
+    extent=GetMagickCacheResourceFootprint(cache,resource);
+  if (BeginMagickCacheJournal(cache,resource,DeleteJournalRecord,
+       (MagickOffsetType) extent) == MagickFalse)
+    return(MagickFalse);
+  type=DeleteChangeType;
+  if ((resource->ttl != 0) &&
+      ((resource->timestamp+resource->ttl) < time((time_t *) NULL)))
+    type=ExpireChangeType;
+  /*
+    Delete resource ID in MagickCache.
+  */
+  tier=GetMagickCacheTier(cache,resource);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  if (RemoveMagickCacheFile(tier,path) != 0)
+    {
+      path=DestroyString(path);
+      return(CommitMagickCacheJournal(cache,resource,DeleteJournalRecord,
+        MagickFalse));
+    }
+  path=DestroyString(path);
+  RemoveMagickCacheResourceFiles(tier,resource);
+  RemoveMagickCacheResourceLevels(tier,resource);
+  if (tier != cache)
+    RemoveMagickCacheResourcePath(tier,resource);
+  UnmirrorMagickCacheResource(cache,resource);
+  /*
+    Delete resource sentinel in MagickCache.  Its usage is given back only
+    once it is gone: recovery gives it back only if it is still there.
+  */
+  path=AcquireMagickCacheResourcePath(resource,MagickCacheResourceSentinel);
+  if (RemoveMagickCacheFile(cache,path) != 0)
+    {
+      path=DestroyString(path);
+      return(CommitMagickCacheJournal(cache,resource,DeleteJournalRecord,
+        MagickFalse));
+    }
+  path=DestroyString(path);
+  UpdateMagickCacheUsage(cache,-((MagickOffsetType) extent),-1);
+  UpdateMagickCacheUsage(cache,-((MagickOffsetType)
+    RemoveMagickCacheResourceRenditions(cache,resource)),0);
+  /*
+    Delete resource IRI in MagickCache.
+  */
+  RemoveMagickCacheResourcePath(cache,resource);
+  status=CommitMagickCacheJournal(cache,resource,DeleteJournalRecord,
+    MagickTrue);
+  if (status == MagickFalse)
+    return(MagickFalse);
+  (void) RecordMagickCacheChange(cache,resource,type);
+  return(MagickTrue);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   D e s t r o y M a g i c k C a c h e                                       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  DestroyMagickCache() deallocates memory associated with a MagickCache.
+%
+%  The format of the CloseMagickCache method is:
+%
+%      MagickCache *CloseMagickCache(MagickCache *cache)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+*/
+MagickExport MagickCache *DestroyMagickCache(MagickCache *cache)
+{
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  CloseMagickCacheChanges(cache);
+  CloseMagickCacheJournal(cache);
+  CloseMagickCacheUsage(cache);
+  if (cache->access != (struct CacheAccess *) NULL)
+    (void) UnmapResourceBlob(cache->access,cache->access_extent);
+  if (cache->root != -1)
+    (void) close_utf8(cache->root);
+  if (cache->path != (char *) NULL )
+    cache->path=DestroyString(cache->path);
+  if (cache->nonce != (StringInfo *) NULL )
+    cache->nonce=DestroyStringInfo(cache->nonce);
+  if (cache->digest != (char *) NULL )
+    cache->digest=DestroyString(cache->digest);
+  if (cache->random_info != (RandomInfo *) NULL)
+    cache->random_info=DestroyRandomInfo(cache->random_info);
+  if (cache->passkey != (StringInfo *) NULL )
+    cache->passkey=DestroyStringInfo(cache->passkey);
+  if (cache->exception != (ExceptionInfo *) NULL)
+    cache->exception=DestroyExceptionInfo(cache->exception);
+  if (cache->directories != (SplayTreeInfo *) NULL)
+    cache->directories=DestroySplayTree(cache->directories);
+  if (cache->options != (SplayTreeInfo *) NULL)
+    cache->options=DestroySplayTree(cache->options);
+  if (cache->cold != (MagickCache *) NULL)
+    cache->cold=DestroyMagickCache(cache->cold);
+  cache->shards=DestroyMagickCacheRoots(cache->shards,&cache->number_shards);
+  if (cache->shard_roots != (char *) NULL)
+    cache->shard_roots=DestroyString(cache->shard_roots);
+  cache->mirrors=DestroyMagickCacheRoots(cache->mirrors,
+    &cache->number_mirrors);
+  if (cache->mirror_roots != (char *) NULL)
+    cache->mirror_roots=DestroyString(cache->mirror_roots);
+  while (cache->resources != (MagickCacheResource *) NULL)
+  {
+    MagickCacheResource
+      *resource;
+
+    resource=cache->resources;
+    cache->resources=resource->next;
+    resource=DestroyMagickCacheResource(resource);
+  }
+  if (cache->journal_semaphore != (SemaphoreInfo *) NULL)
+    RelinquishSemaphoreInfo(&cache->journal_semaphore);
+  if (cache->semaphore != (SemaphoreInfo *) NULL)
+    RelinquishSemaphoreInfo(&cache->semaphore);
+  cache->signature=(~MagickCacheSignature);
+  cache=(MagickCache *) RelinquishMagickMemory(cache);
+  return(cache);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   D e s t r o y M a g i c k C a c h e R e s o u r c e                       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  DestroyMagickCacheResource() deallocates memory associated with a resource.
+%
+%  The format of the DestroyMagickCacheResource method is:
+%
+%      MagickCacheResource *DestroyMagickCacheResource(
+%        MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+
+static MagickBooleanType UnmapResourceBlob(void *map,const size_t length)
+{
+#if defined(MAGICKCORE_HAVE_MMAP)
+  int
+    status;
+
+  status=munmap(map,length);
+  return(status == -1 ? MagickFalse : MagickTrue);
+#else
+  (void) map;
+  (void) length;
+  return(MagickFalse);
+#endif
+}
+
+static void DestroyMagickCacheResourceBlob(MagickCacheResource *resource)
+{
+  /*
+    The blob of an image resource is its image, unless it holds the original
+    encoded bytes.
+  */
+  if ((resource->resource_type == ImageResourceType) &&
+      (resource->encoded == MagickFalse))
+    resource->blob=DestroyImageList((Image *) resource->blob);
+  else
+    if (resource->memory_mapped == MagickFalse)
+      resource->blob=RelinquishMagickMemory(resource->blob);
+    else
+      {
+        (void) UnmapResourceBlob(resource->blob,resource->extent);
+        resource->memory_mapped=MagickFalse;
+      }
+  resource->encoded=MagickFalse;
+}
+
+MagickExport MagickCacheResource *DestroyMagickCacheResource(
+  MagickCacheResource *resource)
+{
+  /*
+   Deallocate memory associated with a resource.
+  */
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCoreSignature);
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  if (resource->rendition != (MagickCacheResource *) NULL)
+    resource->rendition=DestroyMagickCacheResource(resource->rendition);
+  if (resource->iri != (char *) NULL)
+    resource->iri=DestroyString(resource->iri);
+  if (resource->project != (char *) NULL)
+    resource->project=DestroyString(resource->project);
+  if (resource->type != (char *) NULL)
+    resource->type=DestroyString(resource->type);
+  if (resource->id != (char *) NULL)
+    resource->id=DestroyString(resource->id);
+  if (resource->nonce != (StringInfo *) NULL)
+    resource->nonce=DestroyStringInfo(resource->nonce);
+  if (resource->exception != (ExceptionInfo *) NULL)
+    resource->exception=DestroyExceptionInfo(resource->exception);
+  resource->signature=(~MagickCacheSignature);
+  resource=(MagickCacheResource *) RelinquishMagickMemory(resource);
+  return(resource);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   E v i c t M a g i c k C a c h e R e s o u r c e s                         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  EvictMagickCacheResources() removes resources until the cache is below the
+%  low watermark of its capacity.  The least recently accessed resources are
+%  evicted first, or the least frequently accessed if the eviction option is
+%  lfu, or the oldest if it is fifo.  Only one
+%  process evicts at a time; the others return immediately.  Puts call this
+%  method automatically when the cache has a capacity option.
+%
+%  The format of the EvictMagickCacheResources method is:
+%
+%      MagickBooleanType EvictMagickCacheResources(MagickCache *cache)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+*/
+
+static int EvictionCandidateCompare(const void *x,const void *y)
+{
+  const struct EvictionCandidate
+    *p = (const struct EvictionCandidate *) x,
+    *q = (const struct EvictionCandidate *) y;
+
+  if (p->key < q->key)
+    return(-1);
+  return(p->key > q->key ? 1 : 0);
+}
+
+static void SiftEvictionCandidates(struct EvictionCandidate *candidates,
+  const size_t number_candidates,size_t i)
+{
+  /*
+    Restore the max-heap after the root was replaced.
+  */
+  for ( ; ; )
+  {
+    size_t
+      child,
+      largest;
+
+    struct EvictionCandidate
+      candidate;
+
+    largest=i;
+    for (child=2*i+1; child <= (2*i+2); child++)
+      if ((child < number_candidates) &&
+          (candidates[child].key > candidates[largest].key))
+        largest=child;
+    if (largest == i)
+      break;
+    candidate=candidates[i];
+    candidates[i]=candidates[largest];
+    candidates[largest]=candidate;
+    i=largest;
+  }
+}
+
+static MagickBooleanType DemoteMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  MagickCache
+    *tier;
+
+  MagickSizeType
+    extent;
+
+  /*
+    Move a resource payload from the primary to the cold tier.
+  */
+  if ((GetMagickCacheResource(cache,resource) == MagickFalse) ||
+      (resource->cold != MagickFalse))
+    return(MagickFalse);
+  extent=GetMagickCacheResourceFootprint(cache,resource);
+  tier=GetMagickCacheTier(cache,resource);
+  if (MoveMagickCacheResource(tier,cache->cold,resource) == MagickFalse)
+    return(MagickFalse);
+  if (tier != cache)
+    RemoveMagickCacheResourcePath(tier,resource);
+  UnmirrorMagickCacheResource(cache,resource);
+  resource->cold=MagickTrue;
+  UpdateMagickCacheUsage(cache,-((MagickOffsetType) extent),0);
+  return(MagickTrue);
+}
+
+MagickExport MagickBooleanType EvictMagickCacheResources(MagickCache *cache)
+{
+  const MagickCacheEntry
+    *entry;
+
+  MagickBooleanType
+    status;
+
+  MagickOffsetType
+    claim;
+
+  size_t
+    i,
+    number_candidates;
+
+  struct EvictionCandidate
+    *candidates;
+
+  time_t
+    timestamp;
+
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  if (IsMagickCacheOverCapacity(cache,100) == MagickFalse)
+    return(MagickTrue);
+  /*
+    Claim the eviction; a claim older than the timeout was abandoned.
+  */
+  timestamp=time((time_t *) NULL);
+  claim=MagickCacheAtomicLoad(&cache->usage->evict);
+  if ((claim != 0) && ((timestamp-(time_t) claim) < MagickCacheEvictionTimeout))
+    return(MagickTrue);
+  if (MagickCacheAtomicSwap(&cache->usage->evict,claim,(MagickOffsetType)
+      timestamp) == MagickFalse)
+    return(MagickTrue);
+  candidates=(struct EvictionCandidate *) AcquireQuantumMemory(
+    MagickCacheEvictionExtent,sizeof(*candidates));
+  if (candidates == (struct EvictionCandidate *) NULL)
+    {
+      (void) MagickCacheAtomicSwap(&cache->usage->evict,(MagickOffsetType)
+        timestamp,0);
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        ResourceLimitError,"MemoryAllocationFailed","`%s'",cache->path);
+      return(MagickFalse);
+    }
+  status=MagickTrue;
+  while (IsMagickCacheOverCapacity(cache,cache->watermark) != MagickFalse)
+  {
+    MagickBooleanType
+      demote;
+
+    MagickCacheCursor
+      *cursor;
+
+    size_t
+      number_evicted;
+
+    /*
+      Keep the eviction candidates with the smallest keys in a max-heap, so
+      memory is bounded no matter how many resources the cache holds.  With
+      a cold tier, resources are demoted rather than deleted unless there
+      are too many of them.
+    */
+    demote=MagickFalse;
+    if ((cache->cold != (MagickCache *) NULL) &&
+        (IsMagickCacheOverCount(cache,cache->watermark) == MagickFalse))
+      demote=MagickTrue;
+    number_candidates=0;
+    cursor=OpenMagickCacheCursor(cache,"/",demote != MagickFalse ?
+      NoVerifyCursorFlag : (MagickCacheCursorFlags) (NoStatCursorFlag |
+      NoVerifyCursorFlag));
+    for (entry=NextMagickCacheCursor(cursor);
+         entry != (const MagickCacheEntry *) NULL;
+         entry=NextMagickCacheCursor(cursor))
+    {
+      MagickOffsetType
+        key;
+
+      if ((demote != MagickFalse) && (entry->cold != MagickFalse))
+        continue;
+      key=(MagickOffsetType) entry->accessed;
+      if (cache->eviction == LFUEvictionPolicy)
+        key=(MagickOffsetType) entry->hits;
+      if (cache->eviction == FIFOEvictionPolicy)
+        key=(MagickOffsetType) entry->timestamp;
+      if (number_candidates < MagickCacheEvictionExtent)
+        {
+          /*
+            Sift up.
+          */
+          i=number_candidates++;
+          candidates[i].key=key;
+          candidates[i].iri=ConstantString(entry->iri);
+          while ((i > 0) && (candidates[(i-1)/2].key < candidates[i].key))
+          {
+            struct EvictionCandidate
+              candidate;
+
+            candidate=candidates[i];
+            candidates[i]=candidates[(i-1)/2];
+            candidates[(i-1)/2]=candidate;
+            i=(i-1)/2;
+          }
+          continue;
+        }
+      if (key >= candidates[0].key)
+        continue;
+      candidates[0].key=key;
+      (void) CloneString(&candidates[0].iri,entry->iri);
+      SiftEvictionCandidates(candidates,number_candidates,0);
+    }
+    if (cursor->status == MagickFalse)
+      status=MagickFalse;
+    cursor=CloseMagickCacheCursor(cursor);
+    /*
+      Evict the candidates in order until usage is below the watermark.
+    */
+    qsort(candidates,number_candidates,sizeof(*candidates),
+      EvictionCandidateCompare);
+    number_evicted=0;
+    for (i=0; i < number_candidates; i++)
+    {
+      if (IsMagickCacheOverCapacity(cache,cache->watermark) != MagickFalse)
+        {
+          MagickBooleanType
+            evicted;
+
+          MagickCacheResource
+            *resource;
+
+          resource=AcquireMagickCacheResource(cache,candidates[i].iri);
+          if (demote != MagickFalse)
+            evicted=DemoteMagickCacheResource(cache,resource);
+          else
+            evicted=DeleteMagickCacheResource(cache,resource);
+          if (evicted != MagickFalse)
+            number_evicted++;
+          resource=RelinquishMagickCacheResource(cache,resource);
+        }
+      candidates[i].iri=DestroyString(candidates[i].iri);
+    }
+    if ((status == MagickFalse) || (number_evicted == 0))
+      break;
+  }
+  candidates=(struct EvictionCandidate *) RelinquishMagickMemory(candidates);
+  (void) MagickCacheAtomicSwap(&cache->usage->evict,(MagickOffsetType)
+    timestamp,0);
+  return(status);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e C u r s o r T o k e n                         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheCursorToken() returns an opaque continuation token for the
+%  entry last returned by a sorted cursor, or NULL if there is none.  Pass it
+%  to SeekMagickCacheCursor() on a cursor opened with the same IRI, in this
+%  or another process, to resume the walk just after that entry.  Free the
+%  token with RelinquishMagickMemory().
+%
+%  The format of the GetMagickCacheCursorToken method is:
+%
+%      char *GetMagickCacheCursorToken(const MagickCacheCursor *cursor)
+%
+%  A description of each parameter follows:
+%
+%    o cursor: the cursor.
+%
+*/
+MagickExport char *GetMagickCacheCursorToken(const MagickCacheCursor *cursor)
+{
+  size_t
+    length;
+
+  assert(cursor != (const MagickCacheCursor *) NULL);
+  assert(cursor->signature == MagickCacheSignature);
+  if (((cursor->flags & SortedCursorFlag) == 0) || (*cursor->iri == '\0'))
+    return((char *) NULL);
+  return(Base64Encode((const unsigned char *) cursor->iri,strlen(cursor->iri),
+    &length));
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e E x c e p t i o n                             %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheException() returns the severity, reason, and description of
+%  any exception that occurs associated with the cache repository.
+%
+%  The format of the GetMagickCacheException method is:
+%
+%      char *GetMagickCacheException(const MagickCache *cache,
+%        ExceptionType *severity)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o severity: the severity of the error is returned here.
+%
+*/
+MagickExport char *GetMagickCacheException(const MagickCache *cache,
+  ExceptionType *severity)
+{
+  char
+    *description;
+
+  assert(cache != (const MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  if (cache->debug != MagickFalse)
+    (void) LogMagickEvent(WandEvent,GetMagickModule(),"%s",cache->path);
+  assert(severity != (ExceptionType *) NULL);
+  *severity=cache->exception->severity;
+  description=(char *) AcquireQuantumMemory(2UL*MagickPathExtent,
+    sizeof(*description));
+  if (description == (char *) NULL)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),CacheError,
+        "MemoryAllocationFailed","`%s'",cache->path);
+      return((char *) NULL);
+    }
+  *description='\0';
+  if (cache->exception->reason != (char *) NULL)
+    (void) CopyMagickString(description,GetLocaleExceptionMessage(
+      cache->exception->severity,cache->exception->reason),MagickPathExtent);
+  if (cache->exception->description != (char *) NULL)
+    {
+      (void) ConcatenateMagickString(description," (",MagickPathExtent);
+      (void) ConcatenateMagickString(description,GetLocaleExceptionMessage(
+        cache->exception->severity,cache->exception->description),
+        MagickPathExtent);
+      (void) ConcatenateMagickString(description,")",MagickPathExtent);
+    }
+  return(description);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e O p t i o n                                   %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheOption() returns the value of a cache repository option or
+%  NULL if the option is not set.
+%
+%  The format of the GetMagickCacheOption method is:
+%
+%      const char *GetMagickCacheOption(const MagickCache *cache,
+%        const char *key)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o key: the option key, e.g. capacity:extent.
+%
+*/
+MagickExport const char *GetMagickCacheOption(const MagickCache *cache,
+  const char *key)
+{
+  assert(cache != (const MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  return((const char *) GetValueFromSplayTree(cache->options,key));
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e                               %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResource() get meta content associated with a resource
+%  identified by its IRI.  MagickTrue is returned if the resource exists
+%  otherwise MagickFalse.
+%
+%  The format of the GetMagickCacheResource method is:
+%
+%      MagickBooleanType GetMagickCacheResource(MagickCache *cache,
+%        MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+*/
+
+static void GetMagickCacheResourceSentinel(MagickCacheResource *resource,
+  unsigned char *sentinel,const size_t extent)
+{
+  unsigned char
+    *p;
+
+  unsigned int
+    signature;
+
+  /*
+    Get the MagickCache resource sentinel.
+  */
+  p=sentinel;
+  p+=sizeof(signature);
+  (void) memcpy(GetStringInfoDatum(resource->nonce),p,
+    GetStringInfoLength(resource->nonce));
+  p+=GetStringInfoLength(resource->nonce);
+  (void) memcpy(&resource->ttl,p,sizeof(resource->ttl));
+  p+=sizeof(resource->ttl);
+  (void) memcpy(&resource->columns,p,sizeof(resource->columns));
+  p+=sizeof(resource->columns);
+  (void) memcpy(&resource->rows,p,sizeof(resource->rows));
+  p+=sizeof(resource->rows);
+  if (resource->id != (char *) NULL)
+    resource->id=DestroyString(resource->id);
+  resource->id=StringInfoToDigest(resource->nonce);
+  (void) memcpy(resource->id,p,strlen(resource->id));
+  p+=strlen(resource->id);
+  /*
+    The source depth was added later; older sentinels end before it.
+  */
+  resource->depth=0;
+  if ((size_t) (p-sentinel+sizeof(resource->depth)) <= extent)
+    (void) memcpy(&resource->depth,p,sizeof(resource->depth));
+}
+
+static char *AcquireMagickCacheResourceID(const MagickCache *cache,
+  const char *iri,const StringInfo *nonce)
+{
+  char
+    *digest;
+
+  StringInfo
+    *signature;
+
+  /*
+    Derive a MagickCache resource ID from its IRI, nonce, and the cache keys.
+  */
+  signature=StringToStringInfo(iri);
+  ConcatenateStringInfo(signature,nonce);
+  ConcatenateStringInfo(signature,cache->passkey);
+  ConcatenateStringInfo(signature,cache->nonce);
+  digest=StringInfoToDigest(signature);
+  signature=DestroyStringInfo(signature);
+  return(digest);
+}
+
+static MagickBooleanType IsMagickCacheOwner(const MagickCache *cache)
+{
+  char
+    *digest;
+
+  MagickBooleanType
+    status;
+
+  StringInfo
+    *passkey;
+
+  /*
+    Does the passkey match the one the cache repository was created with?
+  */
+  passkey=StringToStringInfo(cache->path);
+  ConcatenateStringInfo(passkey,cache->passkey);
+  ConcatenateStringInfo(passkey,cache->nonce);
+  digest=StringInfoToDigest(passkey);
+  passkey=DestroyStringInfo(passkey);
+  status=strcmp(cache->digest,digest) == 0 ? MagickTrue : MagickFalse;
+  digest=DestroyString(digest);
+  return(status);
+}
+
+static void SetMagickCacheResourceID(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  /*
+    Set a MagickCache resource ID.
+  */
+  if (resource->id != (char *) NULL)
+    resource->id=DestroyString(resource->id);
+  resource->id=AcquireMagickCacheResourceID(cache,resource->iri,
+    resource->nonce);
+}
+
+MagickExport MagickBooleanType GetMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    status;
+
+  size_t
+    extent;
+
+  struct stat
+    attributes;
+
+  unsigned int
+    signature;
+
+  void
+    *sentinel;
+
+  /*
+    Validate the MagickCache resource sentinel.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  path=AcquireMagickCacheResourcePath(resource,MagickCacheResourceSentinel);
+  sentinel=ReadMagickCacheFile(cache,path,&extent,resource->exception);
+  path=DestroyString(path);
+  if (sentinel == NULL)
+    return(MagickFalse);
+  GetMagickCacheResourceSentinel(resource,(unsigned char *) sentinel,extent);
+  signature=GetMagickCacheSignature(resource->nonce);
+  /*
+    If no cache passkey, generate the resource ID.
+  */
+  if (memcmp(&signature,sentinel,sizeof(signature)) != 0)
+    {
+      sentinel=RelinquishMagickMemory(sentinel);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"resource sentinel signature mismatch","`%s'",
+        resource->iri);
+      return(MagickFalse);
+    }
+  sentinel=RelinquishMagickMemory(sentinel);
+  if (IsMagickCacheOwner(cache) == MagickFalse)
+    SetMagickCacheResourceID(cache,resource);
+  /*
+    Verify resource exists.
+  */
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=LocateMagickCacheResource(cache,resource->iri,path,&attributes,
+    &resource->shard,&resource->cold);
+  if (status == MagickFalse)
+    {
+      path=DestroyString(path);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot access resource sentinel","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  resource->timestamp=(time_t) attributes.st_ctime;
+  resource->extent=(size_t) attributes.st_size;
+  path=DestroyString(path);
+  return(MagickTrue);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e B l o b                       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceBlob() gets a blob associated with a resource
+%  identified by its IRI.
+%
+%  The format of the GetMagickCacheResourceBlob method is:
+%
+%      void *GetMagickCacheResourceBlob(MagickCache *cache,
+%        MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+*/
+
+static void *MapResourceBlob(int file,const MapMode mode,
+  const MagickOffsetType offset,const size_t length)
+{
+#if defined(MAGICKCORE_HAVE_MMAP)
+  int
+    flags,
+    protection;
+
+  void
+    *map;
+
+  /*
+    Map file.
+  */
+  flags=0;
+  if (file == -1)
+#if defined(MAP_ANONYMOUS)
+    flags|=MAP_ANONYMOUS;
+#else
+    return(NULL);
+#endif
+  switch (mode)
+  {
+    case ReadMode:
+    default:
+    {
+      protection=PROT_READ;
+      flags|=MAP_PRIVATE;
+      break;
+    }
+    case WriteMode:
+    {
+      protection=PROT_WRITE;
+      flags|=MAP_SHARED;
+      break;
+    }
+    case IOMode:
+    {
+      protection=PROT_READ | PROT_WRITE;
+      flags|=MAP_SHARED;
+      break;
+    }
+  }
+#if !defined(MAGICKCORE_HAVE_HUGEPAGES) || !defined(MAP_HUGETLB)
+  map=mmap((char *) NULL,length,protection,flags,file,offset);
+#else
+  map=mmap((char *) NULL,length,protection,flags | MAP_HUGETLB,file,offset);
+  if (map == MAP_FAILED)
+    map=mmap((char *) NULL,length,protection,flags,file,offset);
+#endif
+  if (map == MAP_FAILED)
+    return(NULL);
+  return(map);
+#else
+  (void) file;
+  (void) mode;
+  (void) offset;
+  (void) length;
+  return(NULL);
+#endif
+}
+
+static MagickBooleanType ResourceToBlob(const MagickCache *cache,
+  MagickCacheResource *resource,const char *path)
+{
+  int
+    file;
+
+  ssize_t
+    count = 0,
+    i;
+
+  struct stat
+    attributes;
+
+  /*
+    Convert the resource identified by its IRI to a blob.
+  */
+  file=OpenMagickCacheFile(cache,path,O_RDONLY,0);
+  if (file == -1)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot get resource","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  if (fstat(file,&attributes) != 0)
+    {
+      file=close_utf8(file)-1;
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot get resource","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  resource->extent=(size_t) attributes.st_size;
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  resource->blob=MapResourceBlob(file,ReadMode,0,resource->extent);
+  if (resource->blob != NULL)
+    {
+      resource->memory_mapped=MagickTrue;
+      file=close_utf8(file)-1;
+      return(MagickTrue);
+    }
+  resource->blob=AcquireMagickMemory(resource->extent);
+  if (resource->blob == NULL)
+    {
+      file=close_utf8(file)-1;
+      return(MagickFalse);
+    }
+  for (i=0; i < (ssize_t) resource->extent; i+=count)
+  {
+    count=read(file,(unsigned char *) resource->blob+i,(size_t)
+      MagickCacheMin(resource->extent-(size_t) i,(size_t) SSIZE_MAX));
+    if (count == 0)
+      break;
+    if (count < 0)
+      {
+        count=0;
+        if (errno != EINTR)
+          break;
+      }
+  }
+  if (i < (ssize_t) resource->extent)
+    {
+      file=close_utf8(file)-1;
+      resource->blob=RelinquishMagickMemory(resource->blob);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot get resource","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  if (close_utf8(file) == -1)
+    {
+      resource->blob=RelinquishMagickMemory(resource->blob);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot get resource","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  return(MagickTrue);
+}
+
+static MagickBooleanType ReadMagickCacheResourceFile(MagickCache *cache,
+  MagickCacheResource *resource,const char *path)
+{
+  MagickBooleanType
+    status;
+
+  MagickCache
+    *replica;
+
+  MagickOffsetType
+    timestamp;
+
+  /*
+    Read a resource file from its least loaded copy; should a mirror fail,
+    read it from its root instead.
+  */
+  replica=AcquireMagickCacheReplica(cache,resource);
+  timestamp=GetMagickCacheMicroseconds();
+  status=ResourceToBlob(replica,resource,path);
+  RelinquishMagickCacheReplica(replica,timestamp);
+  if ((status == MagickFalse) &&
+      (replica != GetMagickCacheTier(cache,resource)))
+    {
+      ClearMagickException(resource->exception);
+      status=ResourceToBlob(GetMagickCacheTier(cache,resource),resource,path);
+    }
+  return(status);
+}
+
+static MagickBooleanType ReadMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    status;
+
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=ReadMagickCacheResourceFile(cache,resource,path);
+  path=DestroyString(path);
+  return(status);
+}
+
+static MagickBooleanType PromoteMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  /*
+    Count the access; a resource read often enough from the cold tier moves
+    to the primary tier before it is read.  The caller evicts afterwards, so
+    the resource cannot be demoted again while it is being read.
+  */
+  if ((RecordMagickCacheAccess(cache,resource,MagickTrue) <
+       (MagickOffsetType) cache->promote) || (resource->cold == MagickFalse))
+    return(MagickFalse);
+  if (MoveMagickCacheResource(cache->cold,GetMagickCacheShard(cache,
+       resource->shard),resource) == MagickFalse)
+    return(MagickFalse);
+  RemoveMagickCacheResourcePath(cache->cold,resource);
+  resource->cold=MagickFalse;
+  (void) MirrorMagickCacheResource(cache,resource);
+  UpdateMagickCacheUsage(cache,(MagickOffsetType)
+    GetMagickCacheResourceFootprint(cache,resource),0);
+  return(MagickTrue);
+}
+
+MagickExport void *GetMagickCacheResourceBlob(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  MagickBooleanType
+    promoted,
+    status;
+
+  /*
+    Get the blob associated with a resource identified by its IRI.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      (void) RecordMagickCacheAccess(cache,resource,MagickFalse);
+      return(NULL);
+    }
+  promoted=PromoteMagickCacheResource(cache,resource);
+  status=ReadMagickCacheResource(cache,resource);
+  if (promoted != MagickFalse)
+    (void) EvictMagickCacheResources(cache);
+  if (status == MagickFalse)
+    return((void *) NULL);
+  return((void *) resource->blob);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e E x c e p t i o n             %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceException() returns the severity, reason, and
+%  description of any exception that occurs assoicated with a resource.
+%
+%  The format of the GetMagickCacheException method is:
+%
+%      char *GetMagickCacheResourceException(
+%        const MagickCacheResource  *resource,ExceptionType *severity)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the magick resource.
+%
+%    o severity: the severity of the error is returned here.
+%
+*/
+MagickExport char *GetMagickCacheResourceException(
+  const MagickCacheResource *resource,ExceptionType *severity)
+{
+  char
+    *description;
+
+  /*
+    Get a MagickCache resource exception.
+  */
+  assert(resource != (const MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  if (resource->debug != MagickFalse)
+    (void) LogMagickEvent(WandEvent,GetMagickModule(),"%s",resource->iri);
+  assert(severity != (ExceptionType *) NULL);
+  *severity=resource->exception->severity;
+  description=(char *) AcquireQuantumMemory(2UL*MagickPathExtent,
+    sizeof(*description));
+  if (description == (char *) NULL)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"MemoryAllocationFailed","`%s'",resource->iri);
+      return((char *) NULL);
+    }
+  *description='\0';
+  if (resource->exception->reason != (char *) NULL)
+    (void) CopyMagickString(description,GetLocaleExceptionMessage(
+      resource->exception->severity,resource->exception->reason),
+      MagickPathExtent);
+  if (resource->exception->description != (char *) NULL)
+    {
+      (void) ConcatenateMagickString(description," (",MagickPathExtent);
+      (void) ConcatenateMagickString(description,GetLocaleExceptionMessage(
+        resource->exception->severity,resource->exception->description),
+        MagickPathExtent);
+      (void) ConcatenateMagickString(description,")",MagickPathExtent);
+    }
+  return(description);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I D                           %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceID() returns a unique resource ID in the ID parameter.
+%
+%  The format of the GetMagickCacheResourceID method is:
+%
+%      MagickBooleanType GetMagickCacheResourceID(MagickCache *cache,
+%        const size_t length,char *id)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o length: the length of the ID.
+%
+%    o id: a buffer that is at least `length` bytes long.
+%
+*/
+MagickExport MagickBooleanType GetMagickCacheResourceID(MagickCache *cache,
+  const size_t length,char *id)
+{
+  ssize_t
+    i,
+    j;
+
+  StringInfo
+    *passkey;
+
+  unsigned char
+    *code;
+
+  /*
+    Get the MagickCache resource ID.
+  */
+  assert(cache != (const MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  for (j=0; j < (ssize_t) length; j++)
+  {
+    passkey=GetRandomKey(cache->random_info,length);
+    if (passkey == (StringInfo *) NULL)
+      return(MagickFalse);
+    code=GetStringInfoDatum(passkey);
+    for (i=0; i < (ssize_t) length; i++)
+    {
+      if ((code[i] <= 32) || ((code[i] <= 0x9f && code[i] > 0x7F)))
+        continue;
+      id[j++]=(char) code[i];
+      if (j == (ssize_t) length)
+        break;
+    }
+    passkey=DestroyStringInfo(passkey);
+  }
+  return(MagickTrue);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I m a g e                     %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceImage() gets an image associated with a resource
+%  identified by its IRI from the cache repository. To retrieve the entire
+%  image, set the extract parameter to NULL.  Otherwise specify the size and
+%  offset of a portion of the image, e.g. 100x100+0+1.  If you do not specify
+%  the offset, the image is instead resized, e.g. 100x100 returns the image
+%  resized while still retaining the original aspect ratio.  If the image
+%  was put with the pyramid option, a resize starts from the smallest
+%  pyramid level that is at least as large as the geometry.  If it was put
+%  with the tiles option, an extract with an offset decodes only the tiles
+%  it overlaps.
+%
+%  The format of the GetMagickCacheResourceImage method is:
+%
+%      Image *GetMagickCacheResourceImage(MagickCache *cache,
+%        MagickCacheResource *resource,const char *extract)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+%    o extract: the extract geometry.
+%
+*/
+static Image *ReadMagickCacheImageTiles(MagickCache *replica,
+  MagickCacheResource *resource,const char *extract,ExceptionInfo *exception)
+{
+  char
+    *path;
+
+  Image
+    *canvas,
+    *next,
+    *tile;
+
+  ImageInfo
+    *image_info;
+
+  int
+    file;
+
+  MagickBooleanType
+    status;
+
+  MagickOffsetType
+    *offsets;
+
+  MagickStatusType
+    flags;
+
+  RectangleInfo
+    geometry,
+    region;
+
+  size_t
+    extent,
+    length,
+    tiles;
+
+  ssize_t
+    x,
+    y;
+
+  struct TileHeader
+    header;
+
+  void
+    *blob;
+
+  /*
+    Decode only the tiles an extract with an offset overlaps; any other
+    extract resizes the whole image, as the MPC reader does.
+  */
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,".tiles");
+  file=OpenMagickCacheFile(replica,path,O_RDONLY,0);
+  path=DestroyString(path);
+  if (file == -1)
+    return((Image *) NULL);
+  if ((ReadMagickCacheBlob(file,0,&header,sizeof(header)) == MagickFalse) ||
+      (header.signature != MagickCacheSignature) ||
+      (header.length != sizeof(header)) || (header.extent == 0) ||
+      (header.columns <= 0) || (header.rows <= 0))
+    {
+      (void) close_utf8(file);
+      return((Image *) NULL);
+    }
+  extent=(size_t) header.extent;
+  tiles=((size_t) header.columns+extent-1)/extent;
+  region.x=0;
+  region.y=0;
+  region.width=(size_t) header.columns;
+  region.height=(size_t) header.rows;
+  flags=NoValue;
+  if (extract != (const char *) NULL)
+    {
+      (void) memset(&geometry,0,sizeof(geometry));
+      flags=ParseAbsoluteGeometry(extract,&geometry);
+      if (((flags & XValue) != 0) || ((flags & YValue) != 0))
+        {
+          if ((geometry.x < 0) || (geometry.y < 0) ||
+              (geometry.x >= (ssize_t) header.columns) ||
+              (geometry.y >= (ssize_t) header.rows))
+            {
+              (void) close_utf8(file);
+              return((Image *) NULL);
+            }
+          region.x=geometry.x;
+          region.y=geometry.y;
+          region.width-=(size_t) geometry.x;
+          region.height-=(size_t) geometry.y;
+          if (((flags & WidthValue) != 0) && (geometry.width != 0))
+            region.width=MagickCacheMin(region.width,geometry.width);
+          if (((flags & HeightValue) != 0) && (geometry.height != 0))
+            region.height=MagickCacheMin(region.height,geometry.height);
+        }
+    }
+  offsets=(MagickOffsetType *) AcquireQuantumMemory(tiles+1,
+    sizeof(*offsets));
+  if (offsets == (MagickOffsetType *) NULL)
+    {
+      (void) close_utf8(file);
+      return((Image *) NULL);
+    }
+  image_info=AcquireImageInfo();
+  (void) CopyMagickString(image_info->magick,"MIFF",MagickPathExtent);
+  canvas=(Image *) NULL;
+  status=MagickTrue;
+  for (y=region.y/(ssize_t) extent; (status != MagickFalse) &&
+       (y <= (region.y+(ssize_t) region.height-1)/(ssize_t) extent); y++)
+  {
+    ssize_t
+      first = region.x/(ssize_t) extent,
+      last = (region.x+(ssize_t) region.width-1)/(ssize_t) extent;
+
+    /*
+      The offsets of a run of tiles in a row, and the end of the last one.
+    */
+    status=ReadMagickCacheBlob(file,(MagickOffsetType) (sizeof(header)+
+      ((size_t) y*tiles+(size_t) first)*sizeof(*offsets)),offsets,
+      (size_t) (last-first+2)*sizeof(*offsets));
+    for (x=first; (status != MagickFalse) && (x <= last); x++)
+    {
+      if (offsets[x-first+1] <= offsets[x-first])
+        {
+          status=MagickFalse;
+          break;
+        }
+      length=(size_t) (offsets[x-first+1]-offsets[x-first]);
+      blob=AcquireQuantumMemory(length,sizeof(unsigned char));
+      if (blob == (void *) NULL)
+        {
+          status=MagickFalse;
+          break;
+        }
+      status=ReadMagickCacheBlob(file,offsets[x-first],blob,length);
+      tile=(Image *) NULL;
+      if (status != MagickFalse)
+        tile=BlobToImage(image_info,blob,length,exception);
+      blob=RelinquishMagickMemory(blob);
+      if (tile == (Image *) NULL)
+        {
+          status=MagickFalse;
+          break;
+        }
+      geometry.x=MagickCacheMax(region.x,x*(ssize_t) extent);
+      geometry.y=MagickCacheMax(region.y,y*(ssize_t) extent);
+      geometry.width=(size_t) (MagickCacheMin(region.x+(ssize_t) region.width,
+        x*(ssize_t) extent+(ssize_t) tile->columns)-geometry.x);
+      geometry.height=(size_t) (MagickCacheMin(region.y+(ssize_t)
+        region.height,y*(ssize_t) extent+(ssize_t) tile->rows)-geometry.y);
+      if (canvas == (Image *) NULL)
+        {
+          canvas=CloneImage(tile,region.width,region.height,MagickTrue,
+            exception);
+          if (canvas == (Image *) NULL)
+            {
+              tile=DestroyImage(tile);
+              status=MagickFalse;
+              break;
+            }
+          canvas->page.x=tile->page.x-x*(ssize_t) extent+region.x;
+          canvas->page.y=tile->page.y-y*(ssize_t) extent+region.y;
+        }
+      if ((geometry.width != tile->columns) || (geometry.height != tile->rows))
+        {
+          RectangleInfo
+            crop;
+
+          /*
+            Keep the part of an edge tile inside the region.
+          */
+          crop=geometry;
+          crop.x-=x*(ssize_t) extent;
+          crop.y-=y*(ssize_t) extent;
+          next=CropImage(tile,&crop,exception);
+          tile=DestroyImage(tile);
+          tile=next;
+          if (tile == (Image *) NULL)
+            {
+              status=MagickFalse;
+              break;
+            }
+        }
+      status=CompositeImage(canvas,tile,CopyCompositeOp,MagickTrue,
+        geometry.x-region.x,geometry.y-region.y,exception);
+      tile=DestroyImage(tile);
+    }
+  }
+  image_info=DestroyImageInfo(image_info);
+  offsets=(MagickOffsetType *) RelinquishMagickMemory(offsets);
+  (void) close_utf8(file);
+  if ((status == MagickFalse) && (canvas != (Image *) NULL))
+    canvas=DestroyImage(canvas);
+  if ((canvas != (Image *) NULL) && (extract != (const char *) NULL) &&
+      ((flags & (XValue | YValue)) == 0) &&
+      ((flags & (WidthValue | HeightValue)) != 0))
+    {
+      (void) ParseRegionGeometry(canvas,extract,&geometry,exception);
+      if ((geometry.width != canvas->columns) ||
+          (geometry.height != canvas->rows))
+        {
+          next=ResizeImage(canvas,geometry.width,geometry.height,
+            canvas->filter,exception);
+          canvas=DestroyImage(canvas);
+          canvas=next;
+        }
+    }
+  return(canvas);
+}
+
+static Image *ReadMagickCacheImageFrames(MagickCache *replica,
+  MagickCacheResource *resource,const size_t scene,const size_t number_scenes,
+  const char *extract,size_t *frames,ExceptionInfo *exception)
+{
+  char
+    *path;
+
+  Image
+    *frame,
+    *images;
+
+  ImageInfo
+    *image_info;
+
+  int
+    file;
+
+  MagickOffsetType
+    *offsets;
+
+  size_t
+    i,
+    length,
+    number_frames;
+
+  struct FrameHeader
+    header;
+
+  void
+    *blob;
+
+  /*
+    Decode a run of frames from their offsets; the others are not read.  The
+    number of frames is returned whenever the offset table is readable, so a
+    caller can tell a scene out of range from a sequence without one.
+  */
+  *frames=0;
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,".frames");
+  file=OpenMagickCacheFile(replica,path,O_RDONLY,0);
+  path=DestroyString(path);
+  if (file == -1)
+    return((Image *) NULL);
+  if ((ReadMagickCacheBlob(file,0,&header,sizeof(header)) == MagickFalse) ||
+      (header.signature != MagickCacheSignature) ||
+      (header.length != sizeof(header)) || (header.frames <= 0))
+    {
+      (void) close_utf8(file);
+      return((Image *) NULL);
+    }
+  *frames=(size_t) header.frames;
+  if (scene >= (size_t) header.frames)
+    {
+      (void) close_utf8(file);
+      return((Image *) NULL);
+    }
+  number_frames=(size_t) header.frames-scene;
+  if ((number_scenes != 0) && (number_scenes < number_frames))
+    number_frames=number_scenes;
+  offsets=(MagickOffsetType *) AcquireQuantumMemory(number_frames+1,
+    sizeof(*offsets));
+  if ((offsets == (MagickOffsetType *) NULL) ||
+      (ReadMagickCacheBlob(file,(MagickOffsetType) (sizeof(header)+scene*
+         sizeof(*offsets)),offsets,(number_frames+1)*sizeof(*offsets)) ==
+       MagickFalse))
+    {
+      if (offsets != (MagickOffsetType *) NULL)
+        offsets=(MagickOffsetType *) RelinquishMagickMemory(offsets);
+      (void) close_utf8(file);
+      return((Image *) NULL);
+    }
+  image_info=AcquireImageInfo();
+  (void) CopyMagickString(image_info->magick,"MIFF",MagickPathExtent);
+  if (extract != (const char *) NULL)
+    (void) CloneString(&image_info->extract,extract);
+  images=NewImageList();
+  for (i=0; i < number_frames; i++)
+  {
+    frame=(Image *) NULL;
+    blob=(void *) NULL;
+    length=0;
+    if (offsets[i+1] > offsets[i])
+      {
+        length=(size_t) (offsets[i+1]-offsets[i]);
+        blob=AcquireQuantumMemory(length,sizeof(unsigned char));
+      }
+    if ((blob != (void *) NULL) &&
+        (ReadMagickCacheBlob(file,offsets[i],blob,length) != MagickFalse))
+      frame=BlobToImage(image_info,blob,length,exception);
+    if (blob != (void *) NULL)
+      blob=RelinquishMagickMemory(blob);
+    if (frame == (Image *) NULL)
+      {
+        images=DestroyImageList(images);
+        break;
+      }
+    AppendImageToList(&images,frame);
+  }
+  image_info=DestroyImageInfo(image_info);
+  offsets=(MagickOffsetType *) RelinquishMagickMemory(offsets);
+  (void) close_utf8(file);
+  return(images);
+}
+
+static Image *ReadMagickCacheImage(MagickCache *replica,
+  MagickCacheResource *resource,const size_t level,const char *extract)
+{
+  char
+    *path,
+    *relative_path;
+
+  ExceptionInfo
+    *exception;
+
+  Image
+    *image;
+
+  ImageInfo
+    *image_info;
+
+  size_t
+    frames;
+
+  if ((level == 0) && (resource->extent == 0))
+    {
+      /*
+        An empty MPC header: the pixels are in tiles, frames, or not yet
+        decoded.
+      */
+      exception=AcquireExceptionInfo();
+      image=ReadMagickCacheImageTiles(replica,resource,extract,exception);
+      if (image == (Image *) NULL)
+        image=ReadMagickCacheImageFrames(replica,resource,0,0,extract,&frames,
+          exception);
+      exception=DestroyExceptionInfo(exception);
+      if (image != (Image *) NULL)
+        return(image);
+    }
+  relative_path=AcquireMagickCacheLevelPath(resource,level);
+  path=AcquireMagickCachePath(replica,relative_path);
+  relative_path=DestroyString(relative_path);
+  if (extract != (const char *) NULL)
+    {
+      (void) ConcatenateString(&path,"[");
+      (void) ConcatenateString(&path,extract);
+      (void) ConcatenateString(&path,"]");
+    }
+  if (strlen(path) > (MagickPathExtent-2))
+    {
+      path=DestroyString(path);
+      errno=ENAMETOOLONG;
+      return((Image *) NULL);
+    }
+  image_info=AcquireImageInfo();
+  (void) CopyMagickString(image_info->filename,path,MagickPathExtent);
+  (void) CopyMagickString(image_info->magick,"MPC",MagickPathExtent);
+  exception=AcquireExceptionInfo();
+  image=ReadImage(image_info,exception);
+  exception=DestroyExceptionInfo(exception);
+  path=DestroyString(path);
+  image_info=DestroyImageInfo(image_info);
+  return(image);
+}
+
+static size_t SelectMagickCacheResourceLevel(MagickCache *cache,
+  const MagickCacheResource *resource,const char *extract)
+{
+  char
+    *path;
+
+  MagickStatusType
+    flags;
+
+  RectangleInfo
+    geometry;
+
+  size_t
+    level,
+    levels;
+
+  struct stat
+    attributes;
+
+  /*
+    Only a plain resize, e.g. 100x100 or 100x100!, can start from a smaller
+    level; a crop, percent, area, or enlarge-only geometry needs level 0.
+  */
+  if ((resource->resource_type != ImageResourceType) ||
+      (extract == (const char *) NULL))
+    return(0);
+  (void) memset(&geometry,0,sizeof(geometry));
+  flags=ParseAbsoluteGeometry(extract,&geometry);
+  if (((flags & WidthValue) == 0) || ((flags & HeightValue) == 0) ||
+      ((flags & (XValue | YValue | PercentValue | AreaValue | LessValue)) != 0))
+    return(0);
+  if ((geometry.width == 0) || (geometry.height == 0))
+    return(0);
+  levels=GetMagickCacheResourceLevels(resource->columns,resource->rows);
+  for (level=0; level < levels; level++)
+    if (((resource->columns >> (level+1)) < geometry.width) ||
+        ((resource->rows >> (level+1)) < geometry.height))
+      break;
+  if (level == 0)
+    return(0);
+  path=AcquireMagickCacheLevelPath(resource,level);
+  if (GetMagickCacheFileAttributes(GetMagickCacheTier(cache,resource),path,
+       &attributes) == MagickFalse)
+    level=0;
+  path=DestroyString(path);
+  return(level);
+}
+
+static Image *GetMagickCacheResourceLevelImage(MagickCache *cache,
+  MagickCacheResource *resource,const ssize_t level,const char *extract)
+{
+  MagickBooleanType
+    promoted,
+    status;
+
+  MagickCache
+    *replica;
+
+  MagickOffsetType
+    timestamp;
+
+  size_t
+    selected;
+
+  /*
+    Return a pyramid level of the resource as an image; a negative level
+    selects one from the extract geometry.
+  */
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      (void) RecordMagickCacheAccess(cache,resource,MagickFalse);
+      return((Image *) NULL);
+    }
+  if (level < 0)
+    selected=SelectMagickCacheResourceLevel(cache,resource,extract);
+  else
+    {
+      selected=(size_t) level;
+      if (selected > GetMagickCacheResourceLevels(resource->columns,
+            resource->rows))
+        {
+          (void) ThrowMagickException(resource->exception,GetMagickModule(),
+            CacheError,"no such pyramid level","`%s'",resource->iri);
+          return((Image *) NULL);
+        }
+    }
+  promoted=PromoteMagickCacheResource(cache,resource);
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  replica=AcquireMagickCacheReplica(cache,resource);
+  timestamp=GetMagickCacheMicroseconds();
+  resource->blob=(void *) ReadMagickCacheImage(replica,resource,selected,
+    extract);
+  RelinquishMagickCacheReplica(replica,timestamp);
+  if ((resource->blob == (void *) NULL) &&
+      (replica != GetMagickCacheTier(cache,resource)))
+    resource->blob=(void *) ReadMagickCacheImage(GetMagickCacheTier(cache,
+      resource),resource,selected,extract);
+  if ((resource->blob == (void *) NULL) && (level < 0) && (selected != 0))
+    resource->blob=(void *) ReadMagickCacheImage(GetMagickCacheTier(cache,
+      resource),resource,0,extract);
+  if ((resource->blob == (void *) NULL) &&
+      (MaterializeMagickCacheResource(cache,resource) != MagickFalse))
+    resource->blob=(void *) ReadMagickCacheImage(GetMagickCacheTier(cache,
+      resource),resource,selected,extract);
+  if (resource->blob == (void *) NULL)
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"cannot get resource","`%s'",resource->iri);
+  else
+    {
+      const Image *image = (const Image *) resource->blob;
+      resource->columns=image->columns;
+      resource->rows=image->rows;
+    }
+  if (promoted != MagickFalse)
+    (void) EvictMagickCacheResources(cache);
+  return((Image *) resource->blob);
+}
+
+MagickExport Image *GetMagickCacheResourceImage(MagickCache *cache,
+  MagickCacheResource *resource,const char *extract)
+{
+  /*
+    Return the resource identified by its IRI as an image.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(GetMagickCacheResourceLevelImage(cache,resource,-1,extract));
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I m a g e F r a m e s         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceImageFrames() gets a run of frames of an image
+%  sequence, e.g. a GIF or video frames, identified by its IRI from the cache
+%  repository.  With the frames option, a sequence is put with an offset table
+%  so only the frames asked for are read and decoded, whatever their number;
+%  otherwise the whole sequence is read and the frames selected from it.
+%
+%  The format of the GetMagickCacheResourceImageFrames method is:
+%
+%      Image *GetMagickCacheResourceImageFrames(MagickCache *cache,
+%        MagickCacheResource *resource,const size_t scene,
+%        const size_t number_scenes,const char *extract)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+%    o scene: the first frame, starting from 0.
+%
+%    o number_scenes: the number of frames, 0 for all that follow.
+%
+%    o extract: the extract geometry, applied to each frame.
+%
+*/
+static Image *SelectMagickCacheImageFrames(Image *images,const size_t scene,
+  const size_t number_scenes,ExceptionInfo *exception)
+{
+  char
+    scenes[MagickPathExtent];
+
+  Image
+    *frames;
+
+  size_t
+    number_frames;
+
+  /*
+    Select the frames from a whole sequence read from its MPC.
+  */
+  number_frames=GetImageListLength(images);
+  if (scene >= number_frames)
+    {
+      images=DestroyImageList(images);
+      return((Image *) NULL);
+    }
+  if ((number_scenes == 0) || (number_scenes > (number_frames-scene)))
+    (void) FormatLocaleString(scenes,MagickPathExtent,"%.20g-%.20g",(double)
+      scene,(double) number_frames-1);
+  else
+    (void) FormatLocaleString(scenes,MagickPathExtent,"%.20g-%.20g",(double)
+      scene,(double) (scene+number_scenes-1));
+  frames=CloneImages(images,scenes,exception);
+  images=DestroyImageList(images);
+  return(frames);
+}
+
+MagickExport Image *GetMagickCacheResourceImageFrames(MagickCache *cache,
+  MagickCacheResource *resource,const size_t scene,const size_t number_scenes,
+  const char *extract)
+{
+  ExceptionInfo
+    *exception;
+
+  Image
+    *images;
+
+  MagickBooleanType
+    promoted,
+    status;
+
+  MagickCache
+    *replica;
+
+  MagickOffsetType
+    timestamp;
+
+  size_t
+    frames;
+
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      (void) RecordMagickCacheAccess(cache,resource,MagickFalse);
+      return((Image *) NULL);
+    }
+  promoted=PromoteMagickCacheResource(cache,resource);
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  exception=AcquireExceptionInfo();
+  replica=AcquireMagickCacheReplica(cache,resource);
+  timestamp=GetMagickCacheMicroseconds();
+  images=ReadMagickCacheImageFrames(replica,resource,scene,number_scenes,
+    extract,&frames,exception);
+  RelinquishMagickCacheReplica(replica,timestamp);
+  if ((images == (Image *) NULL) && ((frames == 0) || (scene < frames)) &&
+      (replica != GetMagickCacheTier(cache,resource)))
+    images=ReadMagickCacheImageFrames(GetMagickCacheTier(cache,resource),
+      resource,scene,number_scenes,extract,&frames,exception);
+  if ((images == (Image *) NULL) && (frames != 0) && (scene >= frames))
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"frame out of range","`%s'",resource->iri);
+  if ((images == (Image *) NULL) && (frames == 0))
+    {
+      /*
+        No offset table: select the frames from the whole sequence.
+      */
+      images=ReadMagickCacheImage(GetMagickCacheTier(cache,resource),resource,
+        0,extract);
+      if ((images == (Image *) NULL) &&
+          (MaterializeMagickCacheResource(cache,resource) != MagickFalse))
+        images=ReadMagickCacheImage(GetMagickCacheTier(cache,resource),
+          resource,0,extract);
+      if (images != (Image *) NULL)
+        images=SelectMagickCacheImageFrames(images,scene,number_scenes,
+          exception);
+    }
+  exception=DestroyExceptionInfo(exception);
+  resource->blob=(void *) images;
+  if (resource->blob == (void *) NULL)
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"cannot get resource frames","`%s'",resource->iri);
+  if (promoted != MagickFalse)
+    (void) EvictMagickCacheResources(cache);
+  return((Image *) resource->blob);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I m a g e L e v e l           %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceImageLevel() gets a level of the image pyramid of a
+%  resource identified by its IRI from the cache repository.  Level 0 is the
+%  image itself and each level after it halves the width and height of the
+%  one before, down to 256 pixels or less.  The levels are only stored for
+%  images put with the pyramid option.  The extract geometry is relative to
+%  the level, e.g. 256x256+512+256 gets a deep zoom tile.
+%
+%  The format of the GetMagickCacheResourceImageLevel method is:
+%
+%      Image *GetMagickCacheResourceImageLevel(MagickCache *cache,
+%        MagickCacheResource *resource,const size_t level,const char *extract)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+%    o level: the pyramid level.
+%
+%    o extract: the extract geometry.
+%
+*/
+MagickExport Image *GetMagickCacheResourceImageLevel(MagickCache *cache,
+  MagickCacheResource *resource,const size_t level,const char *extract)
+{
+  /*
+    Return a pyramid level of the resource identified by its IRI.
   */
-  if (path == (const char *) NULL)
-    return((MagickCache *) NULL);
-  if (GetPathAttributes(path,&attributes) <= 0)
-    return((MagickCache *) NULL);
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(GetMagickCacheResourceLevelImage(cache,resource,(ssize_t) level,
+    extract));
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I m a g e R e g i o n s       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceImageRegions() gets a list of regions, e.g. the
+%  sprites of an atlas, of an image resource identified by its IRI from the
+%  cache repository.  The resource is validated and its pixel cache opened
+%  once for all the regions, which are then cropped in parallel.  A region is
+%  returned for each geometry, in order; regions may overlap.  If the image
+%  was put with the tiles or packed option and each geometry has a size and
+%  offset, only the tiles the regions overlap are decoded.
+%
+%  The format of the GetMagickCacheResourceImageRegions method is:
+%
+%      Image *GetMagickCacheResourceImageRegions(MagickCache *cache,
+%        MagickCacheResource *resource,const char **geometries,
+%        const size_t number_geometries)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+%    o geometries: the region geometries, e.g. 64x64+128+0.
+%
+%    o number_geometries: the number of region geometries.
+%
+*/
+MagickExport Image *GetMagickCacheResourceImageRegions(MagickCache *cache,
+  MagickCacheResource *resource,const char **geometries,
+  const size_t number_geometries)
+{
+  char
+    extract[MagickPathExtent];
+
+  const char
+    *bounds;
+
+  Image
+    *image,
+    *images,
+    **regions;
+
+  MagickBooleanType
+    promoted,
+    status;
+
+  MagickCache
+    *replica;
+
+  MagickOffsetType
+    timestamp;
+
+  RectangleInfo
+    area;
+
+  ssize_t
+    i;
+
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  assert(geometries != (const char **) NULL);
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      (void) RecordMagickCacheAccess(cache,resource,MagickFalse);
+      return((Image *) NULL);
+    }
+  if (number_geometries == 0)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"no region geometries","`%s'",resource->iri);
+      return((Image *) NULL);
+    }
+  promoted=PromoteMagickCacheResource(cache,resource);
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
   /*
-    Basic sanity check passes, allocate & initialize a MagickCache struture.
+    An image without an MPC, e.g. tiles, is read only as far as the bounding
+    box of the regions reaches, when each region has a size and offset.
   */
-  cache=(MagickCache *) AcquireCriticalMemory(sizeof(*cache));
-  (void) memset(cache,0,sizeof(*cache));
-  cache->path=ConstantString(path);
-  cache->timestamp=(time_t) attributes.st_ctime;
-  cache->random_info=AcquireRandomInfo();
-  cache->nonce=AcquireStringInfo(MagickCacheNonceExtent);
-  if (passkey == (StringInfo *) NULL)
-    cache->passkey=AcquireStringInfo(0);
-  else
-    cache->passkey=CloneStringInfo(passkey);
-  cache->digest=StringInfoToDigest(cache->passkey);
-  cache->exception=AcquireExceptionInfo();
-  cache->debug=IsEventLogging();
-  cache->signature=MagickCacheSignature;
+  (void) memset(&area,0,sizeof(area));
+  for (i=0; (resource->extent == 0) && (i < (ssize_t) number_geometries); i++)
+  {
+    MagickStatusType
+      flags;
+
+    RectangleInfo
+      geometry;
+
+    ssize_t
+      x,
+      y;
+
+    flags=NoValue;
+    (void) memset(&geometry,0,sizeof(geometry));
+    if (geometries[i] != (const char *) NULL)
+      flags=ParseAbsoluteGeometry(geometries[i],&geometry);
+    if (((flags & (WidthValue | HeightValue | XValue | YValue)) !=
+         (WidthValue | HeightValue | XValue | YValue)) ||
+        ((flags & (PercentValue | AspectValue | AreaValue)) != 0) ||
+        (geometry.width == 0) || (geometry.height == 0) ||
+        (geometry.x < 0) || (geometry.y < 0))
+      {
+        area.width=0;
+        break;
+      }
+    if (area.width == 0)
+      {
+        area=geometry;
+        continue;
+      }
+    x=MagickCacheMax(area.x+(ssize_t) area.width,geometry.x+(ssize_t)
+      geometry.width);
+    y=MagickCacheMax(area.y+(ssize_t) area.height,geometry.y+(ssize_t)
+      geometry.height);
+    area.x=MagickCacheMin(area.x,geometry.x);
+    area.y=MagickCacheMin(area.y,geometry.y);
+    area.width=(size_t) (x-area.x);
+    area.height=(size_t) (y-area.y);
+  }
+  bounds=(const char *) NULL;
+  if (area.width != 0)
+    {
+      (void) FormatLocaleString(extract,MagickPathExtent,
+        "%.20gx%.20g%+.20g%+.20g",(double) area.width,(double) area.height,
+        (double) area.x,(double) area.y);
+      bounds=extract;
+    }
   /*
-    Validate the MagickCache sentinel.
+    Open the pixel cache once; the regions are all cut from it.
   */
-  sentinel_path=AcquireString(path);
-  (void) ConcatenateString(&sentinel_path,"/");
-  (void) ConcatenateString(&sentinel_path,MagickCacheSentinel);
-  sentinel=FileToBlob(sentinel_path,~0UL,&extent,cache->exception);
-  sentinel_path=DestroyString(sentinel_path);
-  if (sentinel == NULL)
+  replica=AcquireMagickCacheReplica(cache,resource);
+  timestamp=GetMagickCacheMicroseconds();
+  image=ReadMagickCacheImage(replica,resource,0,bounds);
+  RelinquishMagickCacheReplica(replica,timestamp);
+  if ((image == (Image *) NULL) &&
+      (replica != GetMagickCacheTier(cache,resource)))
+    image=ReadMagickCacheImage(GetMagickCacheTier(cache,resource),resource,0,
+      bounds);
+  if ((image == (Image *) NULL) &&
+      (MaterializeMagickCacheResource(cache,resource) != MagickFalse))
+    image=ReadMagickCacheImage(GetMagickCacheTier(cache,resource),resource,0,
+      bounds);
+  if (image == (Image *) NULL)
     {
-      cache=DestroyMagickCache(cache);
-      return((MagickCache *) NULL);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot get resource","`%s'",resource->iri);
+      if (promoted != MagickFalse)
+        (void) EvictMagickCacheResources(cache);
+      return((Image *) NULL);
     }
-  GetMagickCacheSentinel(cache,(unsigned char *) sentinel);
-  signature=GetMagickCacheSignature(cache->nonce);
-  if (memcmp(&signature,sentinel,sizeof(signature)) != 0)
+  regions=(Image **) AcquireQuantumMemory(number_geometries,sizeof(*regions));
+  if (regions == (Image **) NULL)
     {
-      sentinel=RelinquishMagickMemory(sentinel);
-      cache=DestroyMagickCache(cache);
-      return((MagickCache *) NULL);
+      image=DestroyImageList(image);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        ResourceLimitError,"memory allocation failed","`%s'",resource->iri);
+      if (promoted != MagickFalse)
+        (void) EvictMagickCacheResources(cache);
+      return((Image *) NULL);
     }
-  sentinel=RelinquishMagickMemory(sentinel);
-  return(cache);
+  (void) memset(regions,0,number_geometries*sizeof(*regions));
+  if (bounds != (const char *) NULL)
+    {
+      /*
+        The regions are cut relative to the bounding box that was read.
+      */
+      image->page.width=image->columns;
+      image->page.height=image->rows;
+      image->page.x=0;
+      image->page.y=0;
+    }
+  /*
+    Each crop only reads the shared pixels, so regions are cut in parallel,
+    whether or not they overlap.
+  */
+#if defined(MAGICKCORE_OPENMP_SUPPORT)
+  #pragma omp parallel for schedule(dynamic) shared(status)
+#endif
+  for (i=0; i < (ssize_t) number_geometries; i++)
+  {
+    RectangleInfo
+      geometry;
+
+    if (status == MagickFalse)
+      continue;
+    (void) memset(&geometry,0,sizeof(geometry));
+    if (geometries[i] != (const char *) NULL)
+      (void) ParseRegionGeometry(image,geometries[i],&geometry,
+        resource->exception);
+    if (bounds != (const char *) NULL)
+      {
+        geometry.x-=area.x;
+        geometry.y-=area.y;
+      }
+    if ((geometry.width != 0) && (geometry.height != 0))
+      regions[i]=CropImage(image,&geometry,resource->exception);
+    if (regions[i] == (Image *) NULL)
+      status=MagickFalse;
+    else
+      if (bounds != (const char *) NULL)
+        {
+          regions[i]->page.x+=area.x;
+          regions[i]->page.y+=area.y;
+        }
+  }
+  image=DestroyImageList(image);
+  images=NewImageList();
+  for (i=0; i < (ssize_t) number_geometries; i++)
+    if (regions[i] != (Image *) NULL)
+      AppendImageToList(&images,regions[i]);
+  regions=(Image **) RelinquishMagickMemory(regions);
+  if ((status == MagickFalse) && (images != (Image *) NULL))
+    images=DestroyImageList(images);
+  resource->blob=(void *) images;
+  if (resource->blob == (void *) NULL)
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"cannot get resource regions","`%s'",resource->iri);
+  if (promoted != MagickFalse)
+    (void) EvictMagickCacheResources(cache);
+  return((Image *) resource->blob);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I m a g e S o u r c e         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceImageSource() gets the original encoded bytes of an
+%  image resource identified by its IRI, as put with
+%  PutMagickCacheResourceImageBlob() while the source option was set.  The
+%  bytes are mapped from the cache rather than copied when possible; they are
+%  owned by the resource and valid until the next call.
+%
+%  The format of the GetMagickCacheResourceImageSource method is:
+%
+%      void *GetMagickCacheResourceImageSource(MagickCache *cache,
+%        MagickCacheResource *resource,size_t *extent)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o resource: the resource.
+%
+%    o extent: the number of bytes returned.
+%
+*/
+MagickExport void *GetMagickCacheResourceImageSource(MagickCache *cache,
+  MagickCacheResource *resource,size_t *extent)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    promoted,
+    status;
+
+  /*
+    Return the original encoded bytes of an image resource.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  assert(extent != (size_t *) NULL);
+  *extent=0;
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      (void) RecordMagickCacheAccess(cache,resource,MagickFalse);
+      return((void *) NULL);
+    }
+  if (resource->resource_type != ImageResourceType)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"not an image resource","`%s'",resource->iri);
+      return((void *) NULL);
+    }
+  promoted=PromoteMagickCacheResource(cache,resource);
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,".source");
+  status=ReadMagickCacheResourceFile(cache,resource,path);
+  path=DestroyString(path);
+  if (promoted != MagickFalse)
+    (void) EvictMagickCacheResources(cache);
+  if (status == MagickFalse)
+    return((void *) NULL);
+  resource->encoded=MagickTrue;
+  *extent=resource->extent;
+  return(resource->blob);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e I R I                         %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceIRI() gets a resource identified by its IRI in the
+%  cache repository.
+%
+%  The format of the GetMagickCacheResourceIRI method is:
+%
+%      char *GetMagickCacheResourceIRI(MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+MagickExport char *GetMagickCacheResourceIRI(
+  const MagickCacheResource *resource)
+{
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(resource->iri);
 }
 
 /*
@@ -310,42 +5656,53 @@ MagickExport MagickCache *AcquireMagickCache(const char *path,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   A c q u i r e M a g i c k C a c h e R e s o u r c e                       %
+%   G e t M a g i c k C a c h e R e s o u r c e M e t a                       %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  AcquireMagickCacheResource() allocates the MagickCacheResource structure.
-%  It is required before you can get or put metadata associated with resource
-%  content.
+%  GetMagickCacheResourceMeta() gets any metadata associated with the resource
+%  in the cache repository..
 %
-%  The format of the AcquireMagickCacheResource method is:
+%  The format of the GetMagickCacheResourceMeta method is:
 %
-%      MagickCacheResource *AcquireMagickCacheResource(MagickCache *cache,
-%        const char *iri)
+%      char *GetMagickCacheResourceMeta(MagickCacheResource *resource)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o iri: the IRI.
+%    o resource: the resource.
 %
 */
-MagickExport MagickCacheResource *AcquireMagickCacheResource(MagickCache *cache,
-  const char *iri)
+MagickExport char *GetMagickCacheResourceMeta(MagickCache *cache,
+  MagickCacheResource *resource)
 {
-  MagickCacheResource
-    *resource;
+  MagickBooleanType
+    promoted,
+    status;
 
-  resource=(MagickCacheResource *) AcquireCriticalMemory(sizeof(*resource));
-  (void) memset(resource,0,sizeof(*resource));
-  resource->nonce=GetRandomKey(cache->random_info,MagickCacheNonceExtent);
-  resource->version=MagickCacheAPIVersion;
-  resource->exception=AcquireExceptionInfo();
-  resource->signature=MagickCacheSignature;
-  (void) SetMagickCacheResourceIRI(cache,resource,iri);
-  return(resource);
+  /*
+    Return the resource identified by its IRI as metadata.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      (void) RecordMagickCacheAccess(cache,resource,MagickFalse);
+      return((char *) NULL);
+    }
+  promoted=PromoteMagickCacheResource(cache,resource);
+  status=ReadMagickCacheResource(cache,resource);
+  if (promoted != MagickFalse)
+    (void) EvictMagickCacheResources(cache);
+  if (status == MagickFalse)
+    return((char *) NULL);
+  return((char *) resource->blob);
 }
 
 /*
@@ -353,32 +5710,220 @@ MagickExport MagickCacheResource *AcquireMagickCacheResource(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   C l e a r M a g i c k C a c h e E x c e p t i o n                         %
+%   G e t M a g i c k C a c h e R e s o u r c e R e n d i t i o n             %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  ClearMagickCacheException() clears any exceptions associated with the cache.
+%  GetMagickCacheResourceRendition() gets an image resource identified by its
+%  IRI as encoded in the given image format, after the extract geometry of
+%  GetMagickCacheResourceImage() is applied.  The encoded bytes are kept in
+%  the cache as a rendition of the image, so the next request for the same
+%  geometry and format returns them without decoding the image.  Renditions
+%  are kept beside the image, not as resources of their own, count toward
+%  the capacity limits, and are deleted with it.  Those encoded from an
+%  image put earlier under the same IRI are never returned.  Without an
+%  extract geometry, the original encoded bytes kept with the source option
+%  are returned if they are in the requested format.  The returned bytes are
+%  owned by the resource and valid until the next call.
 %
-%  The format of the ClearMagickCacheException method is:
+%  The format of the GetMagickCacheResourceRendition method is:
 %
-%      MagickBooleanType ClearMagickCacheException(MagickCache *cache)
+%      void *GetMagickCacheResourceRendition(MagickCache *cache,
+%        MagickCacheResource *resource,const char *extract,const char *format,
+%        size_t *extent)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
+%    o resource: the resource.
+%
+%    o extract: the extract geometry.
+%
+%    o format: the image format, e.g. WEBP.
+%
+%    o extent: the number of bytes returned.
+%
 */
-MagickExport MagickBooleanType ClearMagickCacheException(MagickCache *cache)
+static void GetMagickCacheTransform(const char *extract,const char *format,
+  const size_t version,char *transform)
+{
+  char
+    geometry[MagickPathExtent],
+    magick[MagickPathExtent];
+
+  MagickStatusType
+    flags;
+
+  size_t
+    height,
+    width;
+
+  ssize_t
+    x,
+    y;
+
+  /*
+    Normalize the geometry and format so equivalent requests share a
+    rendition, e.g. 100X100 and 100x100.
+  */
+  *geometry='\0';
+  if (extract != (const char *) NULL)
+    {
+      width=0;
+      height=0;
+      x=0;
+      y=0;
+      flags=GetGeometry(extract,&x,&y,&width,&height);
+      (void) FormatLocaleString(geometry,MagickPathExtent,"%.20gx%.20g",
+        (double) width,(double) height);
+      if ((flags & (XValue | YValue)) != 0)
+        (void) FormatLocaleString(geometry+strlen(geometry),MagickPathExtent-
+          strlen(geometry),"%+.20g%+.20g",(double) x,(double) y);
+      if ((flags & PercentValue) != 0)
+        (void) ConcatenateMagickString(geometry,"%",MagickPathExtent);
+      if ((flags & AspectValue) != 0)
+        (void) ConcatenateMagickString(geometry,"!",MagickPathExtent);
+      if ((flags & LessValue) != 0)
+        (void) ConcatenateMagickString(geometry,"<",MagickPathExtent);
+      if ((flags & GreaterValue) != 0)
+        (void) ConcatenateMagickString(geometry,">",MagickPathExtent);
+      if ((flags & MinimumValue) != 0)
+        (void) ConcatenateMagickString(geometry,"^",MagickPathExtent);
+      if ((flags & AreaValue) != 0)
+        (void) ConcatenateMagickString(geometry,"@",MagickPathExtent);
+    }
+  (void) CopyMagickString(magick,format,MagickPathExtent);
+  LocaleUpper(magick);
+  (void) FormatLocaleString(transform,MagickPathExtent,"%s:%s:%.20g",
+    geometry,magick,(double) version);
+}
+
+MagickExport void *GetMagickCacheResourceRendition(MagickCache *cache,
+  MagickCacheResource *resource,const char *extract,const char *format,
+  size_t *extent)
 {
+  char
+    *id,
+    magick[MagickPathExtent],
+    *path,
+    *temporary_path,
+    transform[MagickPathExtent];
+
+  Image
+    *image;
+
+  ImageInfo
+    *image_info;
+
+  MagickCacheResource
+    *rendition;
+
+  size_t
+    length;
+
+  StringInfo
+    *key;
+
+  void
+    *blob;
+
+  /*
+    Return the cached encoding of an image resource, encoding it on a miss.
+  */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  if (cache->debug != MagickFalse)
-    (void) LogMagickEvent(CacheEvent,GetMagickModule(),"%s",
-      cache->path != (char *) NULL ? cache->path : "");
-  ClearMagickException(cache->exception);
-  return(MagickTrue);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  assert(format != (const char *) NULL);
+  assert(extent != (size_t *) NULL);
+  *extent=0;
+  if (GetMagickCacheResource(cache,resource) == MagickFalse)
+    return((void *) NULL);
+  if (resource->resource_type != ImageResourceType)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"not an image resource","`%s'",resource->iri);
+      return((void *) NULL);
+    }
+  if ((extract == (const char *) NULL) && (cache->source != MagickFalse))
+    {
+      /*
+        The original encoded bytes serve a request for the same format.
+      */
+      blob=GetMagickCacheResourceImageSource(cache,resource,&length);
+      if ((blob != (void *) NULL) && (GetImageMagick((const unsigned char *)
+           blob,length,magick) != MagickFalse) &&
+          (LocaleCompare(magick,format) == 0))
+        {
+          *extent=length;
+          return(blob);
+        }
+      ClearMagickException(resource->exception);
+    }
+  GetMagickCacheTransform(extract,format,resource->version,transform);
+  path=AcquireMagickCacheRenditionPath(resource,transform);
+  if (resource->rendition == (MagickCacheResource *) NULL)
+    resource->rendition=AcquireMagickCacheResource(cache,resource->iri);
+  rendition=resource->rendition;
+  if (ResourceToBlob(cache,rendition,path) != MagickFalse)
+    {
+      path=DestroyString(path);
+      rendition->encoded=MagickTrue;
+      *extent=rendition->extent;
+      return(rendition->blob);
+    }
+  ClearMagickException(rendition->exception);
+  /*
+    Miss: decode, transform, and encode the image, then keep the result.
+  */
+  image=GetMagickCacheResourceImage(cache,resource,extract);
+  if (image == (Image *) NULL)
+    {
+      path=DestroyString(path);
+      return((void *) NULL);
+    }
+  image_info=AcquireImageInfo();
+  (void) CopyMagickString(image_info->magick,format,MagickPathExtent);
+  (void) CopyMagickString(image->magick,format,MagickPathExtent);
+  length=0;
+  blob=ImagesToBlob(image_info,image,&length,resource->exception);
+  image_info=DestroyImageInfo(image_info);
+  if (blob == (void *) NULL)
+    {
+      path=DestroyString(path);
+      return((void *) NULL);
+    }
+  /*
+    Write under a random name and rename it in place, so a reader never
+    sees a partial rendition.
+  */
+  key=GetRandomKey(cache->random_info,MagickCacheNonceExtent);
+  id=StringInfoToHexString(key);
+  key=DestroyStringInfo(key);
+  temporary_path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&temporary_path,"-");
+  (void) ConcatenateString(&temporary_path,id);
+  (void) ConcatenateString(&temporary_path,MagickCacheRenditionSuffix);
+  id=DestroyString(id);
+  if ((WriteMagickCacheFile(cache,temporary_path,O_EXCL,blob,length,
+       rendition->exception) != MagickFalse) &&
+      (RenameMagickCacheFile(cache,temporary_path,path) == 0))
+    UpdateMagickCacheUsage(cache,(MagickOffsetType) length,0);
+  else
+    (void) RemoveMagickCacheFile(cache,temporary_path);
+  temporary_path=DestroyString(temporary_path);
+  path=DestroyString(path);
+  ClearMagickException(rendition->exception);
+  if (rendition->blob != NULL)
+    DestroyMagickCacheResourceBlob(rendition);
+  rendition->blob=blob;
+  rendition->extent=length;
+  rendition->encoded=MagickTrue;
+  *extent=length;
+  return(blob);
 }
 
 /*
@@ -386,35 +5931,32 @@ MagickExport MagickBooleanType ClearMagickCacheException(MagickCache *cache)
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   C l e a r M a g i c k C a c h e R e s o u r c e E x c e p t i o n         %
+%   G e t M a g i c k C a c h e R e s o u r c e S i z e                       %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  ClearMagickCacheResourceException() clears any exceptions associated with
-%  the resource.
+%  GetMagickCacheResourceSize() returns the size of the image associated with
+%  the resource in the cache repository.
 %
-%  The format of the ClearMagickCacheResourceException method is:
+%  The format of the GetMagickCacheResourceSize method is:
 %
-%      MagickBooleanType ClearMagickCacheResourceException(
-%        MagickCacheResource *resource)
+%      void GetMagickCacheResourceSize(
+%        const MagickCacheResource *resource,size_t *columns,size_t *rows)
 %
 %  A description of each parameter follows:
 %
 %    o resource: the resource.
 %
 */
-MagickExport MagickBooleanType ClearMagickCacheResourceException(
-  MagickCacheResource *resource)
+MagickExport void GetMagickCacheResourceSize(
+  const MagickCacheResource *resource,size_t *columns,size_t *rows)
 {
   assert(resource != (MagickCacheResource *) NULL);
   assert(resource->signature == MagickCacheSignature);
-  if (resource->debug != MagickFalse)
-    (void) LogMagickEvent(CacheEvent,GetMagickModule(),"%s",
-      resource->iri != (char *) NULL ? resource->iri : "");
-  ClearMagickException(resource->exception);
-  return(MagickTrue);
+  *columns=resource->columns;
+  *rows=resource->rows;
 }
 
 /*
@@ -422,30 +5964,31 @@ MagickExport MagickBooleanType ClearMagickCacheResourceException(
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e E x t e n t                   %
+%   G e t M a g i c k C a c h e R e s o u r c e T i m e s t a m p             %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResourceExtent() returns the resource extent associated with
-%  the resource.  That is, the number of bytes the resource consumes on disk.
+%  GetMagickCacheResourceTimestamp() returns the timestamp associated with a
+%  resource in the cache repository.
 %
-%  The format of the GetMagickCacheResourceExtent method is:
+%  The format of the GetMagickCacheResourceTimestamp method is:
 %
-%      size_t GetMagickCacheResourceExtent(const MagickCacheResource *resource)
+%      time_t GetMagickCacheResourceTimestamp(
+%        const MagickCacheResource *resource)
 %
 %  A description of each parameter follows:
 %
 %    o resource: the resource.
 %
 */
-MagickExport size_t GetMagickCacheResourceExtent(
+MagickExport time_t GetMagickCacheResourceTimestamp(
   const MagickCacheResource *resource)
 {
   assert(resource != (MagickCacheResource *) NULL);
   assert(resource->signature == MagickCacheSignature);
-  return(resource->extent);
+  return(resource->timestamp);
 }
 
 /*
@@ -453,115 +5996,94 @@ MagickExport size_t GetMagickCacheResourceExtent(
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   C r e a t e M a g i c k C a c h e                                         %
+%   G e t M a g i c k C a c h e R e s o u r c e T T L                         %
+%                                                                             %
+%                                                                             %
 %                                                                             %
-%                                                                             % %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  CreateMagickCache() creates a MagickCache repository suitably prepared for
-%  storing and retrieving images, image sequences, video, and metadata
-%  resources.
+%  GetMagickCacheResourceTTL() returns the time-to-live associated with a
+%  resource in the cache repository.
 %
-%  The format of the CreateMagickCache method is:
+%  The format of the GetMagickCacheResourceTTL method is:
 %
-%      MagickBooleanType CreateMagickCache(const char *path,
-%        const StringInfo *passkey)
+%      time_t GetMagickCacheResourceTTL(const MagickCacheResource *resource)
 %
 %  A description of each parameter follows:
 %
-%    o path: the MagickCache directory path, absolute (e.g. /myrepo) or
-%      relative (e.g. ./myrepo).
+%    o resource: the resource.
 %
-%    o passkey: the MagickCache passkey.
 */
-
-static StringInfo *SetMagickCacheSentinel(const char *path,
-  const StringInfo *passkey)
+MagickExport time_t GetMagickCacheResourceTTL(
+  const MagickCacheResource *resource)
 {
-  char
-    *digest;
-
-  RandomInfo
-    *random_info;
-
-  StringInfo
-    *key_info,
-    *cache_key,
-    *sentinel;
-
-  unsigned char
-    *p;
-
-  unsigned int
-    signature;
-
-  /*
-    Create a MagickCache sentinel.
-  */
-  sentinel=AcquireStringInfo(MagickPathExtent);
-  random_info=AcquireRandomInfo();
-  key_info=GetRandomKey(random_info,MagickCacheNonceExtent);
-  p=GetStringInfoDatum(sentinel);
-  signature=GetMagickCacheSignature(key_info);
-  (void) memcpy(p,&signature,sizeof(signature));
-  p+=sizeof(signature);
-  (void) memcpy(p,GetStringInfoDatum(key_info),MagickCacheNonceExtent);
-  p+=MagickCacheNonceExtent;
-  cache_key=StringToStringInfo(path);
-  if (passkey != (const StringInfo *) NULL)
-    ConcatenateStringInfo(cache_key,passkey);
-  ConcatenateStringInfo(cache_key,key_info);
-  digest=StringInfoToDigest(cache_key);
-  cache_key=DestroyStringInfo(cache_key);
-  (void) memcpy(p,digest,strlen(digest));
-  p+=strlen(digest);
-  SetStringInfoLength(sentinel,(size_t) (p-GetStringInfoDatum(sentinel)));
-  digest=DestroyString(digest);
-  key_info=DestroyStringInfo(key_info);
-  random_info=DestroyRandomInfo(random_info);
-  return(sentinel);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(resource->ttl);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e T y p e                       %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceType() returns the type associated with a resource in
+%  the cache respository.
+%
+%  The format of the GetMagickCacheResourceType method is:
+%
+%      MagickCacheResourceType GetMagickCacheResourceType(
+%        const MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+MagickExport MagickCacheResourceType GetMagickCacheResourceType(
+  const MagickCacheResource *resource)
+{
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(resource->resource_type);
 }
-
-MagickExport MagickBooleanType CreateMagickCache(const char *path,
-  const StringInfo *passkey)
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   G e t M a g i c k C a c h e R e s o u r c e V e r s i o n                 %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  GetMagickCacheResourceVersion() returns the version associated with a
+%  resource in the cache repository.
+%
+%  The format of the GetMagickCacheResourceVersion method is:
+%
+%      size_t GetMagickCacheResourceVersion(
+%        const MagickCacheResource *resource)
+%
+%  A description of each parameter follows:
+%
+%    o resource: the resource.
+%
+*/
+MagickExport size_t GetMagickCacheResourceVersion(
+  const MagickCacheResource *resource)
 {
-  char
-    *sentinel_path;
-
-  ExceptionInfo
-    *exception;
-
-  MagickBooleanType
-    status;
-
-  StringInfo
-    *meta;
-
-  /*
-    Create the MagickCache path.
-  */
-  if (MagickCreatePath(path) == MagickFalse)
-    return(MagickFalse);
-  /*
-    Create the MagickCache sentinel.
-  */
-  sentinel_path=AcquireString(path);
-  (void) ConcatenateString(&sentinel_path,"/");
-  (void) ConcatenateString(&sentinel_path,MagickCacheSentinel);
-  if (IsPathAccessible(sentinel_path) != MagickFalse)
-    {
-      sentinel_path=DestroyString(sentinel_path);
-      errno=EEXIST;
-      return(MagickFalse);
-    }
-  meta=SetMagickCacheSentinel(path,passkey);
-  exception=AcquireExceptionInfo();
-  status=BlobToFile(sentinel_path,GetStringInfoDatum(meta),
-    GetStringInfoLength(meta),exception);
-  exception=DestroyExceptionInfo(exception);
-  meta=DestroyStringInfo(meta);
-  sentinel_path=DestroyString(sentinel_path);
-  return(status);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  return(resource->version);
 }
 
 /*
@@ -569,95 +6091,51 @@ MagickExport MagickBooleanType CreateMagickCache(const char *path,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   D e l e t e M a g i c k C a c h e R e s o u r c e                         %
+%   G e t M a g i c k C a c h e S t a t i s t i c s                           %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  DeleteMagickCacheResource() deletes a resource within the cache repository.
+%  GetMagickCacheStatistics() returns the hits and misses of the cache
+%  repository, accumulated by every process since its access table was
+%  created, and, if it has a capacity, its size in bytes and resources.
+%  MagickFalse is returned if the cache has no access table.
 %
-%  The format of the DeleteMagickCacheResource method is:
+%  The format of the GetMagickCacheStatistics method is:
 %
-%      MagickBooleanType DeleteMagickCacheResource(MagickCache *cache,
-%        MagickCacheResource *resource)
+%      MagickBooleanType GetMagickCacheStatistics(MagickCache *cache,
+%        MagickCacheStatistics *statistics)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o resource: the MagickCache resource.
+%    o statistics: the statistics are returned here.
 %
 */
-MagickExport MagickBooleanType DeleteMagickCacheResource(MagickCache *cache,
-  MagickCacheResource *resource)
+MagickExport MagickBooleanType GetMagickCacheStatistics(MagickCache *cache,
+  MagickCacheStatistics *statistics)
 {
-  char
-    *iri,
-    *path;
-
-  MagickBooleanType
-    status;
+  struct CacheAccess
+    *access;
 
-  /*
-    Check that resource id exists in MagickCache.
-  */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  status=GetMagickCacheResource(cache,resource);
-  if (status == MagickFalse)
-    return(MagickFalse);
-  /*
-    Delete resource ID in MagickCache.
-  */
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  if (remove_utf8(path) != 0)
-    {
-      path=DestroyString(path);
-      return(MagickFalse);
-    }
-  if (resource->resource_type == ImageResourceType)
+  assert(statistics != (MagickCacheStatistics *) NULL);
+  (void) memset(statistics,0,sizeof(*statistics));
+  if (cache->usage != (struct CacheUsage *) NULL)
     {
-      /*
-        Delete image cache file.
-      */
-      (void) ConcatenateString(&path,".cache");
-      (void) remove_utf8(path);
-    }
-  path=DestroyString(path);
-  /*
-    Delete resource sentinel in MagickCache.
-  */
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,MagickCacheResourceSentinel);
-  if (remove_utf8(path) != 0)
-    {
-      path=DestroyString(path);
-      return(MagickFalse);
+      statistics->extent=(MagickSizeType) MagickCacheMax(MagickCacheAtomicLoad(
+        &cache->usage->extent),0);
+      statistics->count=(MagickSizeType) MagickCacheMax(MagickCacheAtomicLoad(
+        &cache->usage->count),0);
     }
-  path=DestroyString(path);
-  /*
-    Delete resource IRI in MagickCache.
-  */
-  iri=AcquireString(resource->iri);
-  for ( ; *iri != '\0'; GetPathComponent(iri,HeadPath,iri))
-  {
-    path=AcquireString(cache->path);
-    (void) ConcatenateString(&path,"/");
-    (void) ConcatenateString(&path,iri);
-    (void) remove_utf8(path);
-    path=DestroyString(path);
-  }
-  iri=DestroyString(iri);
+  access=AcquireMagickCacheAccess(cache);
+  if (access == (struct CacheAccess *) NULL)
+    return(MagickFalse);
+  statistics->hits=(MagickSizeType) MagickCacheAtomicLoad(&access->hits);
+  statistics->misses=(MagickSizeType) MagickCacheAtomicLoad(&access->misses);
   return(MagickTrue);
 }
 
@@ -666,42 +6144,29 @@ MagickExport MagickBooleanType DeleteMagickCacheResource(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   D e s t r o y M a g i c k C a c h e                                       %
+%   G e t M a g i c k C a c h e T i m e s t a m p                             %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  DestroyMagickCache() deallocates memory associated with a MagickCache.
+%  GetMagickCacheTimestamp() returns the timestamp associated with the cache
+%  repository.
 %
-%  The format of the CloseMagickCache method is:
+%  The format of the GetMagickCacheResource method is:
 %
-%      MagickCache *CloseMagickCache(MagickCache *cache)
+%      time_t GetMagickCacheResourceTimestamp(const MagickCache *cache)
 %
 %  A description of each parameter follows:
 %
-%    o cache: the cache repository.
+%    o resource: the resource.
 %
 */
-MagickExport MagickCache *DestroyMagickCache(MagickCache *cache)
+MagickExport time_t GetMagickCacheTimestamp(const MagickCache *cache)
 {
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  if (cache->path != (char *) NULL )
-    cache->path=DestroyString(cache->path);
-  if (cache->nonce != (StringInfo *) NULL )
-    cache->nonce=DestroyStringInfo(cache->nonce);
-  if (cache->digest != (char *) NULL )
-    cache->digest=DestroyString(cache->digest);
-  if (cache->random_info != (RandomInfo *) NULL)
-    cache->random_info=DestroyRandomInfo(cache->random_info);
-  if (cache->passkey != (StringInfo *) NULL )
-    cache->passkey=DestroyStringInfo(cache->passkey);
-  if (cache->exception != (ExceptionInfo *) NULL)
-    cache->exception=DestroyExceptionInfo(cache->exception);
-  cache->signature=(~MagickCacheSignature);
-  cache=(MagickCache *) RelinquishMagickMemory(cache);
-  return(cache);
+  return(cache->timestamp);
 }
 
 /*
@@ -709,79 +6174,70 @@ MagickExport MagickCache *DestroyMagickCache(MagickCache *cache)
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   D e s t r o y M a g i c k C a c h e R e s o u r c e                       %
+%   I d e n t i f y M a g i c k C a c h e R e s o u r c e                     %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  DestroyMagickCacheResource() deallocates memory associated with a resource.
+%  IdentifyMagickCacheResource() identifies a resource within the cache
+%  repository.
 %
-%  The format of the DestroyMagickCacheResource method is:
+%  The format of the IdentifyMagickCacheResource method is:
 %
-%      MagickCacheResource *DestroyMagickCacheResource(
-%        MagickCacheResource *resource)
+%      MagickBooleanType IdentifyMagickCacheResource(MagickCache *cache,
+%        MagickCacheResource *resource,FILE *file)
 %
 %  A description of each parameter follows:
 %
-%    o resource: the resource.
+%    o cache: the cache repository.
+%
+%    o iri: the IRI.
+%
+%    o file: the file.
 %
 */
-
-static MagickBooleanType UnmapResourceBlob(void *map,const size_t length)
+MagickExport MagickBooleanType IdentifyMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource,FILE *file)
 {
-#if defined(MAGICKCORE_HAVE_MMAP)
+  char
+    extent[MagickPathExtent],
+    iso8601[sizeof("9999-99-99T99:99:99Z")],
+    size[MagickPathExtent];
+
   int
-    status;
+    expired;
 
-  status=munmap(map,length);
-  return(status == -1 ? MagickFalse : MagickTrue);
-#else
-  (void) map;
-  (void) length;
-  return(MagickFalse);
-#endif
-}
+  MagickBooleanType
+    status;
 
-static void DestroyMagickCacheResourceBlob(MagickCacheResource *resource)
-{
-  if (resource->resource_type == ImageResourceType)
-    resource->blob=DestroyImageList((Image *) resource->blob);
-  else
-    if (resource->memory_mapped == MagickFalse)
-      resource->blob=RelinquishMagickMemory(resource->blob);
-    else
-      {
-        (void) UnmapResourceBlob(resource->blob,resource->extent);
-        resource->memory_mapped=MagickFalse;
-      }
-}
+  struct tm
+    timestamp;
 
-MagickExport MagickCacheResource *DestroyMagickCacheResource(
-  MagickCacheResource *resource)
-{
   /*
-   Deallocate memory associated with a resource.
+    If the resource ID exists, identify it.
   */
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCoreSignature);
-  if (resource->blob != NULL)
-    DestroyMagickCacheResourceBlob(resource);
-  if (resource->iri != (char *) NULL)
-    resource->iri=DestroyString(resource->iri);
-  if (resource->project != (char *) NULL)
-    resource->project=DestroyString(resource->project);
-  if (resource->type != (char *) NULL)
-    resource->type=DestroyString(resource->type);
-  if (resource->id != (char *) NULL)
-    resource->id=DestroyString(resource->id);
-  if (resource->nonce != (StringInfo *) NULL)
-    resource->nonce=DestroyStringInfo(resource->nonce);
-  if (resource->exception != (ExceptionInfo *) NULL)
-    resource->exception=DestroyExceptionInfo(resource->exception);
-  resource->signature=(~MagickCacheSignature);
-  resource=(MagickCacheResource *) RelinquishMagickMemory(resource);
-  return(resource);
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  status=GetMagickCacheResource(cache,resource);
+  *size='\0';
+  if (resource->resource_type == ImageResourceType)
+    (void) snprintf(size,MagickPathExtent,"[%gx%g]",(double) resource->columns,
+      (double) resource->rows);
+  (void) FormatMagickSize(GetMagickCacheResourceExtent(resource),MagickTrue,
+    "B",MagickPathExtent,extent);
+  (void) GetMagickUTCTime(&resource->timestamp,&timestamp);
+  (void) strftime(iso8601,sizeof(iso8601),"%FT%TZ",&timestamp);
+  expired=' ';
+  if ((resource->ttl != 0) && ((resource->timestamp+resource->ttl) < time(0)))
+    expired='*';
+  (void) fprintf(file,"%s%s %s %g:%02g:%02g:%02g%c %s\n",
+    GetMagickCacheResourceIRI(resource),size,extent,
+    ceil((double) (resource->ttl/(3600*24))),
+    ceil((double) ((resource->ttl % (24*3600))/3600)),
+    ceil((double) ((resource->ttl % 3600)/60)),
+    ceil((double) ((resource->ttl % 3600) % 60)),expired,iso8601);
+  return(status);
 }
 
 /*
@@ -789,60 +6245,47 @@ MagickExport MagickCacheResource *DestroyMagickCacheResource(
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e E x c e p t i o n                             %
+%   I s M a g i c k C a c h e R e s o u r c e E x p i r e d                   %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheException() returns the severity, reason, and description of
-%  any exception that occurs associated with the cache repository.
+%  IsMagickCacheResourceExpired() returns MagickTrue if the resource creation
+%  date plus the time to live is greater than or equal to the current time.
+%  Note, a resource with a time to live of zero, never expires.
 %
-%  The format of the GetMagickCacheException method is:
+%  The format of the IsMagickCacheResourceExpired method is:
 %
-%      char *GetMagickCacheException(const MagickCache *cache,
-%        ExceptionType *severity)
+%      MagickBooleanType IsMagickCacheResourceExpired(MagickCache *cache,
+%        MagickCacheResource *resource)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o severity: the severity of the error is returned here.
+%    o iri: the IRI.
 %
 */
-MagickExport char *GetMagickCacheException(const MagickCache *cache,
-  ExceptionType *severity)
+MagickExport MagickBooleanType IsMagickCacheResourceExpired(MagickCache *cache,
+  MagickCacheResource *resource)
 {
-  char
-    *description;
+  MagickBooleanType
+    status;
 
-  assert(cache != (const MagickCache *) NULL);
+  assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  if (cache->debug != MagickFalse)
-    (void) LogMagickEvent(WandEvent,GetMagickModule(),"%s",cache->path);
-  assert(severity != (ExceptionType *) NULL);
-  *severity=cache->exception->severity;
-  description=(char *) AcquireQuantumMemory(2UL*MagickPathExtent,
-    sizeof(*description));
-  if (description == (char *) NULL)
-    {
-      (void) ThrowMagickException(cache->exception,GetMagickModule(),CacheError,
-        "MemoryAllocationFailed","`%s'",cache->path);
-      return((char *) NULL);
-    }
-  *description='\0';
-  if (cache->exception->reason != (char *) NULL)
-    (void) CopyMagickString(description,GetLocaleExceptionMessage(
-      cache->exception->severity,cache->exception->reason),MagickPathExtent);
-  if (cache->exception->description != (char *) NULL)
+  status=GetMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    return(status);
+  if ((resource->ttl != 0) && ((resource->timestamp+resource->ttl) < time(0)))
     {
-      (void) ConcatenateMagickString(description," (",MagickPathExtent);
-      (void) ConcatenateMagickString(description,GetLocaleExceptionMessage(
-        cache->exception->severity,cache->exception->description),
-        MagickPathExtent);
-      (void) ConcatenateMagickString(description,")",MagickPathExtent);
+#if defined(ESTALE)
+      errno=ESTALE;
+#endif
+      return(MagickTrue);
     }
-  return(description);
+  return(MagickFalse);
 }
 
 /*
@@ -850,348 +6293,965 @@ MagickExport char *GetMagickCacheException(const MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e                               %
+%   I t e r a t e M a g i c k C a c h e C h a n g e s                         %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResource() get meta content associated with a resource
-%  identified by its IRI.  MagickTrue is returned if the resource exists
-%  otherwise MagickFalse.
+%  IterateMagickCacheChanges() calls the callback() method once for each put,
+%  delete, or expiry recorded in the change feed after the given sequence, in
+%  the order they completed, with three arguments: the MagickCache, the
+%  change, and a user context.  Pass 0 to start from the first change and the
+%  sequence of the last change handled to resume from there; only the changes
+%  since are read.  The feed is kept while the changes option is true.  A put
+%  means the IRI may differ from what a copy holds and a delete or expiry that
+%  it is gone; check the cache for the current state.  To terminate the
+%  iteration, have callback() return MagickFalse.
 %
-%  The format of the GetMagickCacheResource method is:
+%  The format of the IterateMagickCacheChanges method is:
 %
-%      MagickBooleanType GetMagickCacheResource(MagickCache *cache,
-%        MagickCacheResource *resource)
+%      MagickBooleanType IterateMagickCacheChanges(MagickCache *cache,
+%        const MagickSizeType sequence,const void *context,
+%        MagickBooleanType (*callback)(MagickCache *cache,
+%        const MagickCacheChange *change,const void *context))
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o resource: the resource.
+%    o sequence: return the changes after this sequence.
+%
+%    o context: the user context.
+%
+%    o callback: the method called for each change.
 %
 */
-
-static void GetMagickCacheResourceSentinel(MagickCacheResource *resource,
-  unsigned char *sentinel)
-{
-  unsigned char
-    *p;
-
-  unsigned int
-    signature;
-
-  /*
-    Get the MagickCache resource sentinel.
-  */
-  p=sentinel;
-  p+=sizeof(signature);
-  (void) memcpy(GetStringInfoDatum(resource->nonce),p,
-    GetStringInfoLength(resource->nonce));
-  p+=GetStringInfoLength(resource->nonce);
-  (void) memcpy(&resource->ttl,p,sizeof(resource->ttl));
-  p+=sizeof(resource->ttl);
-  (void) memcpy(&resource->columns,p,sizeof(resource->columns));
-  p+=sizeof(resource->columns);
-  (void) memcpy(&resource->rows,p,sizeof(resource->rows));
-  p+=sizeof(resource->rows);
-  if (resource->id != (char *) NULL)
-    resource->id=DestroyString(resource->id);
-  resource->id=StringInfoToDigest(resource->nonce);
-  (void) memcpy(resource->id,p,strlen(resource->id));
-  p+=strlen(resource->id);
-}
-
-static void SetMagickCacheResourceID(MagickCache *cache,
-  MagickCacheResource *resource)
+MagickExport MagickBooleanType IterateMagickCacheChanges(MagickCache *cache,
+  const MagickSizeType sequence,const void *context,MagickBooleanType
+  (*callback)(MagickCache *cache,const MagickCacheChange *change,
+  const void *context))
 {
   char
-    *digest;
+    iri[MagickPathExtent];
 
-  StringInfo
-    *signature;
+  int
+    file;
 
-  /*
-    Set a MagickCache resource ID.
-  */
-  signature=StringToStringInfo(resource->iri);
-  ConcatenateStringInfo(signature,resource->nonce);
-  ConcatenateStringInfo(signature,cache->passkey);
-  ConcatenateStringInfo(signature,cache->nonce);
-  digest=StringInfoToDigest(signature);
-  signature=DestroyStringInfo(signature);
-  if (resource->id != (char *) NULL)
-    resource->id=DestroyString(resource->id);
-  resource->id=digest;
-}
+  MagickBooleanType
+    status;
 
-MagickExport MagickBooleanType GetMagickCacheResource(MagickCache *cache,
-  MagickCacheResource *resource)
-{
-  char
-    *digest,
-    *path;
+  MagickCacheChange
+    change;
 
-  size_t
-    extent;
+  MagickSizeType
+    offset;
 
-  StringInfo
-    *passkey;
+  size_t
+    extent,
+    i,
+    length;
 
-  struct stat
-    attributes;
+  ssize_t
+    count;
 
-  unsigned int
-    signature;
+  struct ChangeRecord
+    record;
 
-  void
-    *sentinel;
+  unsigned char
+    *buffer;
 
   /*
-    Validate the MagickCache resource sentinel.
+    Read the feed from the sequence on in large chunks; a record at the tail
+    that is still being written is left for the next iteration.
   */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,MagickCacheResourceSentinel);
-  sentinel=FileToBlob(path,~0UL,&extent,resource->exception);
-  path=DestroyString(path);
-  if (sentinel == NULL)
-    return(MagickFalse);
-  GetMagickCacheResourceSentinel(resource,(unsigned char *) sentinel);
-  signature=GetMagickCacheSignature(resource->nonce);
-  /*
-    If no cache passkey, generate the resource ID.
-  */
-  if (memcmp(&signature,sentinel,sizeof(signature)) != 0)
+  file=OpenMagickCacheFile(cache,MagickCacheChanges,O_RDONLY,0);
+  if (file == -1)
     {
-      sentinel=RelinquishMagickMemory(sentinel);
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"resource sentinel signature mismatch","`%s'",path);
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot open file","`%s'",MagickCacheChanges);
       return(MagickFalse);
     }
-  sentinel=RelinquishMagickMemory(sentinel);
-  passkey=StringToStringInfo(cache->path);
-  ConcatenateStringInfo(passkey,cache->passkey);
-  ConcatenateStringInfo(passkey,cache->nonce);
-  digest=StringInfoToDigest(passkey);
-  passkey=DestroyStringInfo(passkey);
-  if (strcmp(cache->digest,digest) != 0)
-    SetMagickCacheResourceID(cache,resource);
-  digest=DestroyString(digest);
+  buffer=(unsigned char *) AcquireQuantumMemory(MagickCacheTierExtent,
+    sizeof(*buffer));
+  if ((buffer == (unsigned char *) NULL) ||
+      (lseek(file,(off_t) sequence,SEEK_SET) < 0))
+    {
+      if (buffer != (unsigned char *) NULL)
+        buffer=(unsigned char *) RelinquishMagickMemory(buffer);
+      (void) close_utf8(file);
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot read change feed","`%s'",MagickCacheChanges);
+      return(MagickFalse);
+    }
+  status=MagickTrue;
+  offset=sequence;
+  extent=0;
+  i=0;
+  for ( ; ; )
+  {
+    if ((extent-i) >= sizeof(record))
+      {
+        (void) memcpy(&record,buffer+i,sizeof(record));
+        if ((record.length < sizeof(record)) ||
+            (record.length >= (sizeof(record)+MagickPathExtent)))
+          {
+            (void) ThrowMagickException(cache->exception,GetMagickModule(),
+              CacheError,"invalid change sequence","`%g'",(double) (offset+i));
+            status=MagickFalse;
+            break;
+          }
+        if ((extent-i) >= record.length)
+          {
+            if (CRC32(buffer+i+sizeof(record.signature),record.length-
+                sizeof(record.signature)) != record.signature)
+              {
+                (void) ThrowMagickException(cache->exception,GetMagickModule(),
+                  CacheError,"invalid change sequence","`%g'",(double)
+                  (offset+i));
+                status=MagickFalse;
+                break;
+              }
+            length=record.length-sizeof(record);
+            (void) memcpy(iri,buffer+i+sizeof(record),length);
+            iri[length]='\0';
+            i+=record.length;
+            change.sequence=offset+i;
+            change.type=(MagickCacheChangeType) record.type;
+            change.timestamp=(time_t) record.timestamp;
+            change.iri=iri;
+            status=callback(cache,&change,context);
+            if (status == MagickFalse)
+              break;
+            continue;
+          }
+      }
+    /*
+      Keep the partial record and read the next chunk after it.
+    */
+    (void) memmove(buffer,buffer+i,extent-i);
+    offset+=i;
+    extent-=i;
+    i=0;
+    count=read(file,buffer+extent,MagickCacheTierExtent-extent);
+    if ((count < 0) && (errno == EINTR))
+      continue;
+    if (count <= 0)
+      {
+        if (count < 0)
+          status=MagickFalse;
+        break;
+      }
+    extent+=(size_t) count;
+  }
+  buffer=(unsigned char *) RelinquishMagickMemory(buffer);
+  (void) close_utf8(file);
+  return(status);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   I t e r a t e M a g i c k C a c h e R e s o u r c e s                     %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  IterateMagickCacheResources() iterates over all the resources in the
+%  MagickCache and calls the callback() method once for each resource
+%  discovered with three arguments: the MagickCache, the current resource, and
+%  a user context.  Use the resource `get` methods to retrieve any associated
+%  metadata such as the IRI or time-to-live.  To terminate the iteration, have
+%  callback() return MagickFalse.  The walk is the one of
+%  OpenMagickCacheCursor(): the IRI may hold wildcards and the walk has the
+%  same memory ceiling.
+%
+%  The format of the IterateMagickCacheResources method is:
+%
+%      MagickBooleanType IterateMagickCacheResources(MagickCache *cache,
+%        const char *iri,MagickBooleanType (*callback)(MagickCache *cache,
+%        MagickCacheResource *resource,const void *context))
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o iri: the IRI.
+%
+*/
+MagickExport MagickBooleanType IterateMagickCacheResources(MagickCache *cache,
+  const char *iri,const void *context,MagickBooleanType (*callback)(
+  MagickCache *cache,MagickCacheResource *resource,const void *context))
+{
+  const MagickCacheEntry
+    *entry;
+
+  MagickBooleanType
+    status;
+
+  MagickCacheCursor
+    *cursor;
+
+  MagickCacheResource
+    *resource;
+
+  /*
+    Check that resource id exists in MagickCache.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  status=MagickTrue;
+  resource=AcquireMagickCacheResource(cache,iri);
+  cursor=OpenMagickCacheCursor(cache,iri,(MagickCacheCursorFlags)
+    (NoStatCursorFlag | NoVerifyCursorFlag));
+  for (entry=NextMagickCacheCursor(cursor);
+       entry != (const MagickCacheEntry *) NULL;
+       entry=NextMagickCacheCursor(cursor))
+  {
+    (void) ResetMagickCacheResource(resource,entry->iri);
+    if (GetMagickCacheResource(cache,resource) == MagickFalse)
+      continue;
+    status=callback(cache,resource,context);
+    if (status == MagickFalse)
+      break;
+  }
+  if (cursor->status == MagickFalse)
+    status=MagickFalse;
+  cursor=CloseMagickCacheCursor(cursor);
+  resource=RelinquishMagickCacheResource(cache,resource);
+  return(status);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   M a t e r i a l i z e M a g i c k C a c h e R e s o u r c e s             %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  MaterializeMagickCacheResources() decodes each image below the IRI that
+%  was put with the source:lazy option and not yet accessed, so its first
+%  reader does not pay for the decode.  Run it in the background after a
+%  bulk ingest.
+%
+%  The format of the MaterializeMagickCacheResources method is:
+%
+%      MagickBooleanType MaterializeMagickCacheResources(MagickCache *cache,
+%        const char *iri)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o iri: the IRI.
+%
+*/
+static MagickBooleanType MaterializeResource(MagickCache *cache,
+  MagickCacheResource *resource,const void *context)
+{
+  char
+    *path;
+
+  MagickBooleanType
+    status;
+
+  struct stat
+    attributes;
+
+  (void) context;
+  if (resource->resource_type != ImageResourceType)
+    return(MagickTrue);
   /*
-    Verify resource exists.
+    A lazily put image has an empty MPC header and no tiles or frames.
   */
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  if (GetPathAttributes(path,&attributes) <= 0)
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=GetMagickCacheFileAttributes(GetMagickCacheTier(cache,resource),path,
+    &attributes);
+  if ((status != MagickFalse) && (attributes.st_size == 0))
     {
       path=DestroyString(path);
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"cannot access resource sentinel","`%s'",path);
-      return(MagickFalse);
+      path=AcquireMagickCacheResourcePath(resource,resource->id);
+      (void) ConcatenateString(&path,".tiles");
+      status=GetMagickCacheFileAttributes(GetMagickCacheTier(cache,resource),
+        path,&attributes);
+      if (status == MagickFalse)
+        {
+          path=DestroyString(path);
+          path=AcquireMagickCacheResourcePath(resource,resource->id);
+          (void) ConcatenateString(&path,".frames");
+          status=GetMagickCacheFileAttributes(GetMagickCacheTier(cache,
+            resource),path,&attributes);
+        }
     }
-  resource->timestamp=(time_t) attributes.st_ctime;
-  resource->extent=(size_t) attributes.st_size;
   path=DestroyString(path);
+  if (status != MagickFalse)
+    return(MagickTrue);
+  if (MaterializeMagickCacheResource(cache,resource) == MagickFalse)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot materialize resource","`%s'",resource->iri);
+      return(MagickFalse);
+    }
   return(MagickTrue);
 }
+
+MagickExport MagickBooleanType MaterializeMagickCacheResources(
+  MagickCache *cache,const char *iri)
+{
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  return(IterateMagickCacheResources(cache,iri,(const void *) NULL,
+    MaterializeResource));
+}
 
 /*
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e B l o b                       %
+%   N e x t M a g i c k C a c h e C u r s o r                                 %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResourceBlob() gets a blob associated with a resource
-%  identified by its IRI.
+%  NextMagickCacheCursor() returns the next resource below the cursor IRI or
+%  NULL once there are no more.  Only the resource sentinel is read, so the
+%  entry is far cheaper than a resource from GetMagickCacheResource().  The
+%  entry is owned by the cursor and overwritten by the next call.  On a NULL
+%  return check the cache exception to distinguish the end of the walk from a
+%  failure.
 %
-%  The format of the GetMagickCacheResourceBlob method is:
+%  The format of the NextMagickCacheCursor method is:
 %
-%      void *GetMagickCacheResourceBlob(MagickCache *cache,
-%        MagickCacheResource *resource)
+%      const MagickCacheEntry *NextMagickCacheCursor(
+%        MagickCacheCursor *cursor)
 %
 %  A description of each parameter follows:
 %
-%    o cache: the cache repository.
-%
-%    o resource: the resource.
+%    o cursor: the cursor.
 %
 */
 
-static void *MapResourceBlob(int file,const MapMode mode,
-  const MagickOffsetType offset,const size_t length)
+static MagickCacheResourceType GetMagickCacheIRIType(const char *iri)
 {
-#if defined(MAGICKCORE_HAVE_MMAP)
-  int
-    flags,
-    protection;
+  const char
+    *p,
+    *q;
 
-  void
-    *map;
+  /*
+    The resource type is the second component of the IRI.
+  */
+  for (p=iri; *p == '/'; p++) ;
+  p=strchr(p,'/');
+  if (p == (const char *) NULL)
+    return(UndefinedResourceType);
+  for ( ; *p == '/'; p++) ;
+  for (q=p; (*q != '/') && (*q != '\0'); q++) ;
+  if (((q-p) == 4) && (LocaleNCompare(p,"blob",4) == 0))
+    return(BlobResourceType);
+  if (((q-p) == 5) && (LocaleNCompare(p,"image",5) == 0))
+    return(ImageResourceType);
+  if (((q-p) == 4) && (LocaleNCompare(p,"meta",4) == 0))
+    return(MetaResourceType);
+  return(UndefinedResourceType);
+}
+
+static DIR *OpenMagickCacheCursorDirectory(MagickCacheCursor *cursor,
+  const char *name)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  DIR
+    *directory;
+
+  int
+    file;
 
   /*
-    Map file.
+    Open a child of the directory on top of the stack by descriptor.
   */
-  flags=0;
+  if (cursor->depth == 0)
+    return(OpenMagickCacheDirectory(cursor->cache,cursor->path));
+  file=openat(dirfd(cursor->frames[cursor->depth-1].directory),name,O_RDONLY |
+    O_DIRECTORY | O_CLOEXEC);
   if (file == -1)
-#if defined(MAP_ANONYMOUS)
-    flags|=MAP_ANONYMOUS;
+    return((DIR *) NULL);
+  directory=fdopendir(file);
+  if (directory == (DIR *) NULL)
+    (void) close_utf8(file);
+  return(directory);
 #else
-    return(NULL);
+  (void) name;
+  return(OpenMagickCacheDirectory(cursor->cache,cursor->path));
 #endif
-  switch (mode)
-  {
-    case ReadMode:
-    default:
+}
+
+static int OpenMagickCacheCursorFile(MagickCacheCursor *cursor,
+  const char *name)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(openat(dirfd(cursor->frames[cursor->depth-1].directory),name,
+    O_RDONLY | O_BINARY | O_CLOEXEC));
+#else
+  char
+    path[MagickPathExtent];
+
+  (void) FormatLocaleString(path,MagickPathExtent,"%s/%s",cursor->path,name);
+  return(OpenMagickCacheFile(cursor->cache,path,O_RDONLY,0));
+#endif
+}
+
+static MagickBooleanType GetMagickCacheCursorAttributes(
+  MagickCacheCursor *cursor,const char *name,struct stat *attributes)
+{
+#if defined(MAGICKCACHE_HAVE_OPENAT)
+  return(fstatat(dirfd(cursor->frames[cursor->depth-1].directory),name,
+    attributes,0) == 0 ? MagickTrue : MagickFalse);
+#else
+  char
+    path[MagickPathExtent];
+
+  (void) FormatLocaleString(path,MagickPathExtent,"%s/%s",cursor->path,name);
+  return(GetMagickCacheFileAttributes(cursor->cache,path,attributes));
+#endif
+}
+
+static MagickBooleanType GetMagickCacheCursorEntry(MagickCacheCursor *cursor)
+{
+  char
+    id[MagickCacheDigestExtent+1];
+
+  int
+    file;
+
+  MagickCacheEntry
+    *entry;
+
+  ssize_t
+    count;
+
+  struct stat
+    attributes;
+
+  unsigned char
+    sentinel[MagickPathExtent],
+    *q;
+
+  unsigned int
+    signature;
+
+  /*
+    Decode the resource sentinel of the directory on top of the stack.
+  */
+  entry=(&cursor->entry);
+  file=OpenMagickCacheCursorFile(cursor,MagickCacheResourceSentinel);
+  if (file == -1)
+    return(MagickFalse);
+  count=read(file,sentinel,sizeof(sentinel));
+  if (fstat(file,&attributes) != 0)
+    count=(-1);
+  (void) close_utf8(file);
+  if (count < (ssize_t) (sizeof(signature)+MagickCacheNonceExtent+
+       sizeof(entry->ttl)+sizeof(entry->columns)+sizeof(entry->rows)+
+       MagickCacheDigestExtent))
+    return(MagickFalse);
+  (void) CopyMagickString(cursor->iri,cursor->path,MagickPathExtent);
+  q=sentinel+sizeof(signature);
+  (void) memcpy(GetStringInfoDatum(cursor->nonce),q,MagickCacheNonceExtent);
+  q+=MagickCacheNonceExtent;
+  (void) memcpy(&entry->ttl,q,sizeof(entry->ttl));
+  q+=sizeof(entry->ttl);
+  (void) memcpy(&entry->columns,q,sizeof(entry->columns));
+  q+=sizeof(entry->columns);
+  (void) memcpy(&entry->rows,q,sizeof(entry->rows));
+  q+=sizeof(entry->rows);
+  (void) memcpy(id,q,MagickCacheDigestExtent);
+  id[MagickCacheDigestExtent]='\0';
+  if ((cursor->flags & NoVerifyCursorFlag) == 0)
     {
-      protection=PROT_READ;
-      flags|=MAP_PRIVATE;
-      break;
+      signature=GetMagickCacheSignature(cursor->nonce);
+      if (memcmp(&signature,sentinel,sizeof(signature)) != 0)
+        return(MagickFalse);
     }
-    case WriteMode:
+  if (cursor->owner == MagickFalse)
     {
-      protection=PROT_WRITE;
-      flags|=MAP_SHARED;
-      break;
+      char
+        *digest;
+
+      /*
+        Only the owner passkey yields the ID stored in the sentinel.
+      */
+      digest=AcquireMagickCacheResourceID(cursor->cache,cursor->iri,
+        cursor->nonce);
+      (void) CopyMagickString(id,digest,sizeof(id));
+      digest=DestroyString(digest);
     }
-    case IOMode:
+  entry->iri=cursor->iri;
+  entry->type=GetMagickCacheIRIType(cursor->iri);
+  entry->extent=0;
+  entry->timestamp=(time_t) attributes.st_mtime;
+  entry->accessed=entry->timestamp;
+  entry->hits=0;
+  if (AcquireMagickCacheAccess(cursor->cache) != (struct CacheAccess *) NULL)
     {
-      protection=PROT_READ | PROT_WRITE;
-      flags|=MAP_SHARED;
-      break;
+      MagickOffsetType
+        tag;
+
+      struct CacheAccessSlot
+        *slot;
+
+      slot=GetMagickCacheAccessSlot(cursor->cache->access,id,&tag);
+      if (MagickCacheAtomicLoad(&slot->tag) == tag)
+        {
+          entry->accessed=(time_t) MagickCacheMax(MagickCacheAtomicLoad(
+            &slot->accessed),(MagickOffsetType) entry->accessed);
+          entry->hits=(MagickSizeType) MagickCacheAtomicLoad(&slot->hits);
+        }
+    }
+  entry->cold=MagickFalse;
+  if ((cursor->flags & NoStatCursorFlag) == 0)
+    {
+      if ((cursor->cache->number_shards != 0) ||
+          (GetMagickCacheCursorAttributes(cursor,id,&attributes) ==
+           MagickFalse))
+        {
+          char
+            path[MagickPathExtent];
+
+          size_t
+            shard;
+
+          (void) FormatLocaleString(path,MagickPathExtent,"%s/%s",cursor->iri,
+            id);
+          if (LocateMagickCacheResource(cursor->cache,cursor->iri,path,
+                &attributes,&shard,&entry->cold) == MagickFalse)
+            return(MagickFalse);
+        }
+      entry->extent=(size_t) attributes.st_size;
+      entry->timestamp=(time_t) attributes.st_ctime;
     }
+  return(MagickTrue);
+}
+
+static MagickSizeType GetMagickCacheCursorClosure(
+  const MagickCacheCursor *cursor,MagickSizeType states)
+{
+  size_t
+    i;
+
+  /*
+    A ** pattern component also matches no directory at all.
+  */
+  for (i=0; i < cursor->number_patterns; i++)
+    if (((states & ((MagickSizeType) 1 << i)) != 0) &&
+        (strcmp(cursor->patterns[i],"**") == 0))
+      states|=(MagickSizeType) 1 << (i+1);
+  return(states);
+}
+
+static MagickSizeType MatchMagickCacheCursorName(
+  const MagickCacheCursor *cursor,const MagickSizeType states,const char *name)
+{
+  MagickSizeType
+    next;
+
+  size_t
+    i;
+
+  /*
+    Advance the set of pattern states past one directory name.  State i
+    expects pattern component i next; the accept state matches anything
+    below it, as if the pattern had a trailing **.  An empty result means no
+    resource below the directory can match.
+  */
+  next=states & cursor->accept;
+  for (i=0; i < cursor->number_patterns; i++)
+  {
+    if ((states & ((MagickSizeType) 1 << i)) == 0)
+      continue;
+    if (strcmp(cursor->patterns[i],"**") == 0)
+      next|=(MagickSizeType) 1 << i;
+    else
+      if (IsMagickCacheGlobMatch(cursor->patterns[i],name) != MagickFalse)
+        next|=(MagickSizeType) 1 << (i+1);
   }
-#if !defined(MAGICKCORE_HAVE_HUGEPAGES) || !defined(MAP_HUGETLB)
-  map=mmap((char *) NULL,length,protection,flags,file,offset);
-#else
-  map=mmap((char *) NULL,length,protection,flags | MAP_HUGETLB,file,offset);
-  if (map == MAP_FAILED)
-    map=mmap((char *) NULL,length,protection,flags,file,offset);
-#endif
-  if (map == MAP_FAILED)
-    return(NULL);
-  return(map);
-#else
-  (void) file;
-  (void) mode;
-  (void) offset;
-  (void) length;
-  return(NULL);
+  return(GetMagickCacheCursorClosure(cursor,next));
+}
+
+static MagickBooleanType IsMagickCacheCursorDirectory(
+  MagickCacheCursor *cursor,const struct dirent *entry)
+{
+  struct stat
+    attributes;
+
+#if defined(DT_DIR)
+  if ((entry->d_type != DT_UNKNOWN) && (entry->d_type != DT_LNK))
+    return(entry->d_type == DT_DIR ? MagickTrue : MagickFalse);
 #endif
+  if (GetMagickCacheCursorAttributes(cursor,entry->d_name,&attributes) ==
+      MagickFalse)
+    return(MagickFalse);
+  return(S_ISDIR(attributes.st_mode) != 0 ? MagickTrue : MagickFalse);
+}
+
+static int MagickCacheCursorNameCompare(const void *x,const void *y)
+{
+  return(strcmp(*(char *const *) x,*(char *const *) y));
+}
+
+static MagickBooleanType ReadMagickCacheCursorNames(MagickCacheCursor *cursor)
+{
+  size_t
+    extent;
+
+  struct CursorFrame
+    *frame;
+
+  struct dirent
+    *entry;
+
+  /*
+    Read and sort the subdirectory names of the directory on top of the stack.
+  */
+  frame=cursor->frames+cursor->depth-1;
+  extent=0;
+  while ((entry=readdir(frame->directory)) != (struct dirent *) NULL)
+  {
+    if ((strcmp(entry->d_name,".") == 0) || (strcmp(entry->d_name,"..") == 0))
+      continue;
+    if (strcmp(entry->d_name,MagickCacheResourceSentinel) == 0)
+      {
+        frame->pending=MagickTrue;
+        continue;
+      }
+    if ((MatchMagickCacheCursorName(cursor,frame->states,entry->d_name) == 0) ||
+        (IsMagickCacheCursorDirectory(cursor,entry) == MagickFalse))
+      continue;
+    if (frame->number_names == extent)
+      {
+        char
+          **names;
+
+        names=(char **) ResizeQuantumMemory(frame->names,MagickCacheMax(
+          2*extent,16),sizeof(*frame->names));
+        if (names == (char **) NULL)
+          {
+            errno=ENOMEM;
+            return(MagickFalse);
+          }
+        frame->names=names;
+        extent=MagickCacheMax(2*extent,16);
+      }
+    frame->names[frame->number_names++]=ConstantString(entry->d_name);
+  }
+  if (frame->number_names > 1)
+    qsort(frame->names,frame->number_names,sizeof(*frame->names),
+      MagickCacheCursorNameCompare);
+  return(MagickTrue);
+}
+
+static MagickBooleanType PushMagickCacheCursorDirectory(
+  MagickCacheCursor *cursor,const char *name,const MagickSizeType states)
+{
+  DIR
+    *directory;
+
+  size_t
+    length;
+
+  /*
+    Descend into a directory: extend the relative path and open it.
+  */
+  length=strlen(cursor->path);
+  if (cursor->depth != 0)
+    {
+      if ((length+strlen(name)+2) > MagickPathExtent)
+        {
+          errno=ENAMETOOLONG;
+          return(MagickFalse);
+        }
+      if (*cursor->path == '\0')
+        (void) CopyMagickString(cursor->path,name,MagickPathExtent);
+      else
+        {
+          cursor->path[length]='/';
+          (void) CopyMagickString(cursor->path+length+1,name,MagickPathExtent-
+            length-1);
+        }
+    }
+  directory=OpenMagickCacheCursorDirectory(cursor,name);
+  if (directory == (DIR *) NULL)
+    {
+      cursor->path[length]='\0';
+      return(MagickFalse);
+    }
+  if (cursor->depth == cursor->number_frames)
+    {
+      struct CursorFrame
+        *frames;
+
+      frames=(struct CursorFrame *) ResizeQuantumMemory(cursor->frames,
+        cursor->number_frames+16,sizeof(*cursor->frames));
+      if (frames == (struct CursorFrame *) NULL)
+        {
+          (void) closedir(directory);
+          cursor->path[length]='\0';
+          errno=ENOMEM;
+          return(MagickFalse);
+        }
+      cursor->frames=frames;
+      cursor->number_frames+=16;
+    }
+  (void) memset(cursor->frames+cursor->depth,0,sizeof(*cursor->frames));
+  cursor->frames[cursor->depth].directory=directory;
+  cursor->frames[cursor->depth].length=length;
+  cursor->frames[cursor->depth].states=states;
+  cursor->depth++;
+  if (((cursor->flags & SortedCursorFlag) != 0) &&
+      (ReadMagickCacheCursorNames(cursor) == MagickFalse))
+    {
+      PopMagickCacheCursorDirectory(cursor);
+      errno=ENOMEM;
+      return(MagickFalse);
+    }
+  return(MagickTrue);
+}
+
+MagickExport const MagickCacheEntry *NextMagickCacheCursor(
+  MagickCacheCursor *cursor)
+{
+  assert(cursor != (MagickCacheCursor *) NULL);
+  assert(cursor->signature == MagickCacheSignature);
+  while (cursor->depth != 0)
+  {
+    const char
+      *name;
+
+    MagickSizeType
+      states;
+
+    struct CursorFrame
+      *frame;
+
+    frame=cursor->frames+cursor->depth-1;
+    if ((cursor->flags & SortedCursorFlag) != 0)
+      {
+        /*
+          Sorted walk: a directory's own resource precedes its subdirectories.
+        */
+        if (frame->pending != MagickFalse)
+          {
+            frame->pending=MagickFalse;
+            if (((frame->states & cursor->accept) != 0) &&
+                (GetMagickCacheCursorEntry(cursor) != MagickFalse))
+              return(&cursor->entry);
+            continue;
+          }
+        if (frame->index >= frame->number_names)
+          {
+            PopMagickCacheCursorDirectory(cursor);
+            continue;
+          }
+        name=frame->names[frame->index++];
+        states=MatchMagickCacheCursorName(cursor,frame->states,name);
+      }
+    else
+      {
+        struct dirent
+          *entry;
+
+        entry=readdir(frame->directory);
+        if (entry == (struct dirent *) NULL)
+          {
+            PopMagickCacheCursorDirectory(cursor);
+            continue;
+          }
+        if ((strcmp(entry->d_name,".") == 0) ||
+            (strcmp(entry->d_name,"..") == 0))
+          continue;
+        if (strcmp(entry->d_name,MagickCacheResourceSentinel) == 0)
+          {
+            if (((frame->states & cursor->accept) != 0) &&
+                (GetMagickCacheCursorEntry(cursor) != MagickFalse))
+              return(&cursor->entry);
+            continue;
+          }
+        states=MatchMagickCacheCursorName(cursor,frame->states,entry->d_name);
+        if ((states == 0) ||
+            (IsMagickCacheCursorDirectory(cursor,entry) == MagickFalse))
+          continue;
+        name=entry->d_name;
+      }
+    if ((PushMagickCacheCursorDirectory(cursor,name,states) == MagickFalse) &&
+        (errno != ENOENT))
+      {
+        (void) ThrowMagickException(cursor->cache->exception,
+          GetMagickModule(),CacheError,"cannot open directory","`%s/%s'",
+          cursor->path,name);
+        cursor->status=MagickFalse;
+      }
+  }
+  return((const MagickCacheEntry *) NULL);
 }
-
-static MagickBooleanType ResourceToBlob(MagickCacheResource *resource,
-  const char *path)
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   O p e n M a g i c k C a c h e C u r s o r                                 %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  OpenMagickCacheCursor() returns a cursor that walks the resources below an
+%  IRI.  Pass NoStatCursorFlag to skip the stat of each resource payload; the
+%  entry extent is then zero and its timestamp is that of the sentinel.  Pass
+%  NoVerifyCursorFlag to trust the sentinel without checking its signature.
+%
+%  The walk is depth-first and holds one open directory and one stack frame
+%  per level below the IRI, plus a fixed path buffer.  Memory and descriptor
+%  use are therefore bounded by the depth of the namespace, never by the
+%  number of directories or resources in the repository.  Resources deleted
+%  during the walk are skipped.
+%
+%  IRI components may hold glob wildcards: * and ? within a component,
+%  character classes such as [a-z] or [!0-9], and a ** component for any
+%  number of directories.  A type component of * walks images, blobs, and
+%  metadata at once.  Only resources at or below a match are returned.  To
+%  walk an IRI that holds a literal *, ?, [, or \, escape each with a
+%  backslash, e.g. sprites/frame\[1\].  The pattern is compiled once and
+%  applied one component at a time, so a directory that cannot lead to a
+%  match is skipped without being opened.
+%
+%  Pass SortedCursorFlag for a walk in IRI order, where a resource precedes
+%  the resources below it and siblings are ordered by strcmp().  Each level
+%  then also holds the sorted names of its subdirectories, so memory is
+%  bounded by the widest directory along the current path.  Only a sorted
+%  walk can be resumed with GetMagickCacheCursorToken() and
+%  SeekMagickCacheCursor().
+%
+%  The format of the OpenMagickCacheCursor method is:
+%
+%      MagickCacheCursor *OpenMagickCacheCursor(MagickCache *cache,
+%        const char *iri,const MagickCacheCursorFlags flags)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o iri: the IRI.
+%
+%    o flags: cursor flags.
+%
+*/
+static MagickBooleanType CompileMagickCacheCursorPattern(
+  MagickCacheCursor *cursor)
 {
-  int
-    file;
-
-  ssize_t
-    count = 0,
-    i;
+  char
+    *glob,
+    **patterns,
+    *p,
+    *q;
 
-  struct stat
-    attributes;
+  size_t
+    extent;
 
   /*
-    Convert the resource identified by its IRI to a blob.
+    The walk starts at the longest literal prefix of the IRI; the remaining
+    components, from the first one with a wildcard, become the pattern.
   */
-  if (GetPathAttributes(path,&attributes) == MagickFalse)
-    {
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"cannot get resource","`%s'",resource->iri);
-      return(MagickFalse);
-    }
-  resource->extent=(size_t) attributes.st_size;
-  file=open_utf8(path,O_RDONLY | O_BINARY,0);
-  if (resource->blob != NULL)
-    DestroyMagickCacheResourceBlob(resource);
-  resource->blob=MapResourceBlob(file,ReadMode,0,resource->extent);
-  if (resource->blob != NULL)
-    {
-      resource->memory_mapped=MagickTrue;
-      file=close_utf8(file)-1;
-      return(MagickTrue);
-    }
-  resource->blob=AcquireMagickMemory(resource->extent);
-  if (resource->blob == NULL)
-    return(MagickFalse);
-  for (i=0; i < (ssize_t) resource->extent; i+=count)
+  cursor->accept=1;
+  glob=strpbrk(cursor->path,"*?[\\");
+  if (glob == (char *) NULL)
+    return(MagickTrue);
+  for ( ; (glob > cursor->path) && (*(glob-1) != '/'); glob--) ;
+  extent=0;
+  for (p=glob; *p != '\0'; )
   {
-    ssize_t
-      count;
-
-    count=read(file,(unsigned char *) resource->blob+i,(size_t)
-      MagickCacheMin(resource->extent-(size_t) i,(size_t) SSIZE_MAX));
-    if (count <= 0)
+    for (q=p; (*q != '/') && (*q != '\0'); q++) ;
+    if (q != p)
       {
-        count=0;
-        if (errno != EINTR)
-          break;
+        if (cursor->number_patterns >= 63)
+          return(MagickFalse);
+        if (cursor->number_patterns == extent)
+          {
+            patterns=(char **) ResizeQuantumMemory(cursor->patterns,extent+8,
+              sizeof(*cursor->patterns));
+            if (patterns == (char **) NULL)
+              return(MagickFalse);
+            cursor->patterns=patterns;
+            extent+=8;
+          }
+        cursor->patterns[cursor->number_patterns]=AcquireString(p);
+        cursor->patterns[cursor->number_patterns][q-p]='\0';
+        cursor->number_patterns++;
       }
+    p=(*q == '/') ? q+1 : q;
   }
-  if (i < (ssize_t) resource->extent)
-    {
-      file=close_utf8(file)-1;
-      resource->blob=RelinquishMagickMemory(resource->blob);
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"cannot get resource","`%s'",resource->iri);
-      return(MagickFalse);
-    }
-  if (close_utf8(file) == -1)
-    {
-      resource->blob=RelinquishMagickMemory(resource->blob);
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"cannot get resource","`%s'",resource->iri);
-      return(MagickFalse);
-    }
+  cursor->accept=(MagickSizeType) 1 << cursor->number_patterns;
+  if (glob == cursor->path)
+    (void) CopyMagickString(cursor->path,".",MagickPathExtent);
+  else
+    *(glob-1)='\0';
   return(MagickTrue);
 }
 
-MagickExport void *GetMagickCacheResourceBlob(MagickCache *cache,
-  MagickCacheResource *resource)
+MagickExport MagickCacheCursor *OpenMagickCacheCursor(MagickCache *cache,
+  const char *iri,const MagickCacheCursorFlags flags)
 {
-  char
-    *path;
+  MagickCacheCursor
+    *cursor;
 
-  MagickBooleanType
-    status;
+  size_t
+    length;
 
-  /*
-    Get the blob associated with a resource identified by its IRI.
-  */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  status=GetMagickCacheResource(cache,resource);
-  if (status == MagickFalse)
-    return(NULL);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  status=ResourceToBlob(resource,path);
-  path=DestroyString(path);
-  if (status == MagickFalse)
-    return((void *) NULL);
-  return((void *) resource->blob);
+  cursor=(MagickCacheCursor *) AcquireCriticalMemory(sizeof(*cursor));
+  (void) memset(cursor,0,sizeof(*cursor));
+  cursor->cache=cache;
+  cursor->flags=flags;
+  cursor->nonce=AcquireStringInfo(MagickCacheNonceExtent);
+  cursor->owner=IsMagickCacheOwner(cache);
+  cursor->status=MagickTrue;
+  cursor->signature=MagickCacheSignature;
+  (void) CopyMagickString(cursor->path,GetMagickCacheRelativePath(iri),
+    MagickPathExtent);
+  for (length=strlen(cursor->path); length > 1; length--)
+    if (cursor->path[length-1] == '/')
+      cursor->path[length-1]='\0';
+    else
+      break;
+  if (CompileMagickCacheCursorPattern(cursor) == MagickFalse)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"too many wildcard components","`%s'",iri);
+      cursor->status=MagickFalse;
+      return(cursor);
+    }
+  if (PushMagickCacheCursorDirectory(cursor,cursor->path,
+        GetMagickCacheCursorClosure(cursor,1)) == MagickFalse)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot open directory","`%s'",iri);
+      cursor->status=MagickFalse;
+    }
+  if (strcmp(cursor->path,".") == 0)
+    *cursor->path='\0';
+  if (cursor->depth != 0)
+    cursor->frames[0].length=strlen(cursor->path);
+  return(cursor);
 }
 
 /*
@@ -1199,64 +7259,178 @@ MagickExport void *GetMagickCacheResourceBlob(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e E x c e p t i o n             %
+%   P u t M a g i c k C a c h e R e s o u r c e                               %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResourceException() returns the severity, reason, and
-%  description of any exception that occurs assoicated with a resource.
+%  PutMagickCacheResource() puts an image, image sequence, video, or metadata
+%  resource in the MagickCache identified by its IRI.  If the IRI already
+%  exists, an exception is returned.
 %
-%  The format of the GetMagickCacheException method is:
+%  The format of the PutMagickCacheResource method is:
 %
-%      char *GetMagickCacheResourceException(
-%        const MagickCacheResource  *resource,ExceptionType *severity)
+%      MagickBooleanType PutMagickCacheResource(MagickCache *cache,
+%        const MagickCacheResource *resource)
 %
 %  A description of each parameter follows:
 %
-%    o resource: the magick resource.
+%    o cache: the cache repository.
 %
-%    o severity: the severity of the error is returned here.
+%    o resource: the resource.
+%
+%    o blob: the blob.
 %
 */
-MagickExport char *GetMagickCacheResourceException(
-  const MagickCacheResource *resource,ExceptionType *severity)
+
+static StringInfo *SetMagickCacheResourceSentinel(
+  const MagickCacheResource *resource)
+{
+  StringInfo
+    *meta;
+
+  unsigned char
+    *p;
+
+  unsigned int
+    signature;
+
+  /*
+    Set the MagickCache resource sentinel.
+  */
+  meta=AcquireStringInfo(MagickPathExtent);
+  p=GetStringInfoDatum(meta);
+  signature=GetMagickCacheSignature(resource->nonce);
+  (void) memcpy(p,&signature,sizeof(signature));
+  p+=sizeof(signature);
+  (void) memcpy(p,GetStringInfoDatum(resource->nonce),
+    GetStringInfoLength(resource->nonce));
+  p+=GetStringInfoLength(resource->nonce);
+  (void) memcpy(p,&resource->ttl,sizeof(resource->ttl));
+  p+=sizeof(resource->ttl);
+  (void) memcpy(p,&resource->columns,sizeof(resource->columns));
+  p+=sizeof(resource->columns);
+  (void) memcpy(p,&resource->rows,sizeof(resource->rows));
+  p+=sizeof(resource->rows);
+  (void) memcpy(p,resource->id,MagickCacheDigestExtent);
+  p+=MagickCacheDigestExtent;
+  (void) memcpy(p,&resource->depth,sizeof(resource->depth));
+  p+=sizeof(resource->depth);
+  SetStringInfoLength(meta,(size_t) (p-GetStringInfoDatum(meta)));
+  return(meta);
+}
+
+static void ChargeMagickCacheResource(MagickCache *cache,
+  const MagickCacheResource *resource,const MagickBooleanType status)
+{
+  /*
+    Account for a resource payload and make room if the cache is over capacity.
+    A put that failed gives back the count its sentinel was charged.
+  */
+  if (cache->usage == (struct CacheUsage *) NULL)
+    return;
+  if (status == MagickFalse)
+    {
+      UpdateMagickCacheUsage(cache,0,-1);
+      return;
+    }
+  UpdateMagickCacheUsage(cache,(MagickOffsetType)
+    GetMagickCacheResourceFootprint(cache,resource),0);
+  (void) EvictMagickCacheResources(cache);
+}
+
+MagickExport MagickBooleanType PutMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
 {
   char
-    *description;
+    *path;
+
+  int
+    file;
+
+  MagickBooleanType
+    status;
+
+  StringInfo
+    *meta;
 
   /*
-    Get a MagickCache resource exception.
+    Create the resource path as defined by the IRI.
   */
-  assert(resource != (const MagickCacheResource *) NULL);
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(resource != (MagickCacheResource *) NULL);
   assert(resource->signature == MagickCacheSignature);
-  if (resource->debug != MagickFalse)
-    (void) LogMagickEvent(WandEvent,GetMagickModule(),"%s",resource->iri);
-  assert(severity != (ExceptionType *) NULL);
-  *severity=resource->exception->severity;
-  description=(char *) AcquireQuantumMemory(2UL*MagickPathExtent,
-    sizeof(*description));
-  if (description == (char *) NULL)
+  status=GetMagickCacheResource(cache,resource);
+  if (status != MagickFalse)
     {
       (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"MemoryAllocationFailed","`%s'",resource->iri);
-      return((char *) NULL);
+        CacheError,"cannot overwrite resource","`%s'",resource->iri);
+      return(MagickFalse);
     }
-  *description='\0';
-  if (resource->exception->reason != (char *) NULL)
-    (void) CopyMagickString(description,GetLocaleExceptionMessage(
-      resource->exception->severity,resource->exception->reason),
-      MagickPathExtent);
-  if (resource->exception->description != (char *) NULL)
+  if (CreateMagickCachePath(cache,resource->iri) == MagickFalse)
     {
-      (void) ConcatenateMagickString(description," (",MagickPathExtent);
-      (void) ConcatenateMagickString(description,GetLocaleExceptionMessage(
-        resource->exception->severity,resource->exception->description),
-        MagickPathExtent);
-      (void) ConcatenateMagickString(description,")",MagickPathExtent);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot put resource","`%s'",resource->iri);
+      return(MagickFalse);
     }
-  return(description);
+  /*
+    Export the MagickCache resource metadata.
+  */
+  SetRandomKey(cache->random_info,GetStringInfoLength(resource->nonce),
+    GetStringInfoDatum(resource->nonce));
+  SetMagickCacheResourceID(cache,resource);
+  if (BeginMagickCacheJournal(cache,resource,PutJournalRecord,0) ==
+      MagickFalse)
+    return(MagickFalse);
+  path=AcquireMagickCacheResourcePath(resource,MagickCacheResourceSentinel);
+  file=OpenMagickCacheFile(cache,path,O_WRONLY | O_CREAT | O_EXCL,S_IRUSR |
+    S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if ((file == -1) && (errno == ENOENT))
+    {
+      /*
+        A directory we remembered was removed behind our back, start over.
+      */
+      ResetSplayTree(cache->directories);
+      if (CreateMagickCachePath(cache,resource->iri) != MagickFalse)
+        file=OpenMagickCacheFile(cache,path,O_WRONLY | O_CREAT | O_EXCL,
+          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    }
+  if (file == -1)
+    {
+      if (errno != EEXIST)
+        (void) ThrowMagickException(resource->exception,GetMagickModule(),
+          CacheError,"cannot put resource","`%s'",resource->iri);
+      path=DestroyString(path);
+      return(CommitMagickCacheJournal(cache,resource,PutJournalRecord,
+        MagickFalse));
+    }
+  meta=SetMagickCacheResourceSentinel(resource);
+  status=WriteMagickCacheBlob(file,GetStringInfoDatum(meta),
+    GetStringInfoLength(meta));
+  if (close_utf8(file) == -1)
+    status=MagickFalse;
+  /*
+    The payload goes to the root the IRI hashes to.
+  */
+  resource->cold=MagickFalse;
+  resource->shard=GetMagickCacheShardPlacement(cache,resource->iri);
+  if ((status != MagickFalse) && (resource->shard != 0))
+    status=CreateMagickCachePath(GetMagickCacheShard(cache,resource->shard),
+      resource->iri);
+  if (status == MagickFalse)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot put resource","`%s'",resource->iri);
+      status=CommitMagickCacheJournal(cache,resource,PutJournalRecord,
+        MagickFalse);
+    }
+  else
+    UpdateMagickCacheUsage(cache,0,1);
+  meta=DestroyStringInfo(meta);
+  path=DestroyString(path);
+  return(status);
 }
 
 /*
@@ -1264,63 +7438,56 @@ MagickExport char *GetMagickCacheResourceException(
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e I D                           %
+%   P u t M a g i c k C a c h e R e s o u r c e B l o b                       %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResourceID() returns a unique resource ID in the ID parameter.
+%  PutMagickCacheResource() puts a blob resource in the MagickCache identified
+%  by its IRI.  If the IRI already exists, an exception is returned.
 %
-%  The format of the GetMagickCacheResourceID method is:
+%  The format of the PutMagickCacheResource method is:
 %
-%      MagickBooleanType GetMagickCacheResourceID(MagickCache *cache,
-%        const size_t length,char *id)
+%      MagickBooleanType PutMagickCacheResourceBlob(MagickCache *cache,
+%        const MagickCacheResource *resource,const size_t extent,
+%        const void blob)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o length: the length of the ID.
+%    o resource: the resource.
 %
-%    o id: a buffer that is at least `length` bytes long.
+%    o blob: the blob.
 %
 */
-MagickExport MagickBooleanType GetMagickCacheResourceID(MagickCache *cache,
-  const size_t length,char *id)
+MagickExport MagickBooleanType PutMagickCacheResourceBlob(MagickCache *cache,
+  MagickCacheResource *resource,const size_t extent,const void *blob)
 {
-  ssize_t
-    i,
-    j;
-
-  StringInfo
-    *passkey;
+  char
+    *path;
 
-  unsigned char
-    *code;
+  MagickBooleanType
+    status;
 
   /*
-    Get the MagickCache resource ID.
+    Puts a blob resource in the MagickCache identified by its IRI.
   */
-  assert(cache != (const MagickCache *) NULL);
-  assert(cache->signature == MagickCacheSignature);
-  for (j=0; j < (ssize_t) length; j++)
-  {
-    passkey=GetRandomKey(cache->random_info,length);
-    if (passkey == (StringInfo *) NULL)
-      return(MagickFalse);
-    code=GetStringInfoDatum(passkey);
-    for (i=0; i < (ssize_t) length; i++)
-    {
-      if ((code[i] <= 32) || ((code[i] <= 0x9f && code[i] > 0x7F)))
-        continue;
-      id[j++]=(char) code[i];
-      if (j == (ssize_t) length)
-        break;
-    }
-    passkey=DestroyStringInfo(passkey);
-  }
-  return(MagickTrue);
+  status=PutMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    return(MagickFalse);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=WriteMagickCacheFile(GetMagickCacheTier(cache,resource),path,O_TRUNC,
+    blob,extent,cache->exception);
+  path=DestroyString(path);
+  status=CommitMagickCacheJournal(cache,resource,PutJournalRecord,status);
+  if (status != MagickFalse)
+    (void) MirrorMagickCacheResource(cache,resource);
+  ChargeMagickCacheResource(cache,resource,status);
+  if (status != MagickFalse)
+    (void) RecordMagickCacheChange(cache,resource,PutChangeType);
+  return(status);
 }
 
 /*
@@ -1328,23 +7495,22 @@ MagickExport MagickBooleanType GetMagickCacheResourceID(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e I m a g e                     %
+%   P u t M a g i c k C a c h e R e s o u r c e I m a g e                     %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResourceImage() gets an image associated with a resource
-%  identified by its IRI from the cache repository. To retrieve the entire
-%  image, set the extract parameter to NULL.  Otherwise specify the size and
-%  offset of a portion of the image, e.g. 100x100+0+1.  If you do not specify
-%  the offset, the image is instead resized, e.g. 100x100 returns the image
-%  resized while still retaining the original aspect ratio.
+%  PutMagickCacheResourceImage() puts an image resource in the MagickCache
+%  identified by its IRI.  If the IRI already exists, an exception is returned.
+%  With the pyramid option, the pyramid levels of a single frame image are
+%  put with it.  With the tiles option, a single frame image is stored as
+%  independently compressed tiles rather than as an MPC.
 %
-%  The format of the GetMagickCacheResourceImage method is:
+%  The format of the PutMagickCacheResourceImage method is:
 %
-%      Image *GetMagickCacheResourceImage(MagickCache *cache,
-%        MagickCacheResource *resource,const char *extract)
+%      MagickBooleanType PutMagickCacheResourceImage(MagickCache *cache,
+%        const MagickCacheResource *resource,const Image *image)
 %
 %  A description of each parameter follows:
 %
@@ -1352,17 +7518,447 @@ MagickExport MagickBooleanType GetMagickCacheResourceID(MagickCache *cache,
 %
 %    o resource: the resource.
 %
-%    o extract: the extract geometry.
+%    o image: the image.
 %
 */
-MagickExport Image *GetMagickCacheResourceImage(MagickCache *cache,
-  MagickCacheResource *resource,const char *extract)
+static MagickBooleanType WriteMagickCacheResourceLevels(MagickCache *cache,
+  MagickCacheResource *resource,const Image *image)
+{
+  char
+    *path,
+    *relative_path;
+
+  const Image
+    *previous;
+
+  Image
+    *next;
+
+  ImageInfo
+    *image_info;
+
+  MagickBooleanType
+    status;
+
+  size_t
+    level,
+    levels;
+
+  /*
+    Each level is a box filtered reduction by 2 of the one before.
+  */
+  RemoveMagickCacheResourceLevels(GetMagickCacheTier(cache,resource),
+    resource);
+  levels=GetMagickCacheResourceLevels(image->columns,image->rows);
+  image_info=AcquireImageInfo();
+  status=MagickTrue;
+  previous=image;
+  for (level=1; level <= levels; level++)
+  {
+    next=ResizeImage(previous,(previous->columns+1)/2,(previous->rows+1)/2,
+      BoxFilter,resource->exception);
+    if (previous != image)
+      (void) DestroyImage((Image *) previous);
+    previous=next;
+    if (next == (Image *) NULL)
+      {
+        status=MagickFalse;
+        break;
+      }
+    relative_path=AcquireMagickCacheLevelPath(resource,level);
+    path=AcquireMagickCachePath(GetMagickCacheTier(cache,resource),
+      relative_path);
+    relative_path=DestroyString(relative_path);
+    (void) FormatLocaleString(next->filename,MagickPathExtent,"mpc:%s",path);
+    path=DestroyString(path);
+    status=WriteImage(image_info,next,resource->exception);
+    if (status == MagickFalse)
+      break;
+  }
+  if ((previous != (const Image *) NULL) && (previous != image))
+    (void) DestroyImage((Image *) previous);
+  image_info=DestroyImageInfo(image_info);
+  return(status);
+}
+
+static inline MagickBooleanType IsMagickCacheImageTiled(
+  const MagickCache *cache,const Image *image)
+{
+  if ((cache->tiles == 0) && (cache->packed == MagickFalse))
+    return(MagickFalse);
+  return(GetNextImageInList(image) == (Image *) NULL ? MagickTrue :
+    MagickFalse);
+}
+
+static MagickBooleanType OpenMagickCacheTiles(MagickCache *cache,
+  MagickCacheResource *resource,const size_t columns,const size_t rows,
+  struct TileStream *tiles)
+{
+  char
+    *id;
+
+  StringInfo
+    *key;
+
+  /*
+    Each tile is a MIFF, at the source depth and with the tiles option zip
+    compressed on its own, located by an index of offsets after the header.
+    The tiles are written under a random name and renamed in place.
+  */
+  (void) memset(tiles,0,sizeof(*tiles));
+  tiles->file=(-1);
+  tiles->extent=cache->tiles != 0 ? cache->tiles : MagickCacheTileExtent;
+  tiles->columns=(columns+tiles->extent-1)/tiles->extent;
+  tiles->number_tiles=tiles->columns*((rows+tiles->extent-1)/tiles->extent);
+  tiles->offsets=(MagickOffsetType *) AcquireQuantumMemory(
+    tiles->number_tiles+1,sizeof(*tiles->offsets));
+  if (tiles->offsets == (MagickOffsetType *) NULL)
+    return(MagickFalse);
+  tiles->header.signature=MagickCacheSignature;
+  tiles->header.length=(unsigned int) sizeof(tiles->header);
+  tiles->header.extent=(unsigned int) tiles->extent;
+  tiles->header.columns=(MagickOffsetType) columns;
+  tiles->header.rows=(MagickOffsetType) rows;
+  key=GetRandomKey(cache->random_info,MagickCacheNonceExtent);
+  id=StringInfoToHexString(key);
+  key=DestroyStringInfo(key);
+  tiles->path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&tiles->path,"-");
+  (void) ConcatenateString(&tiles->path,id);
+  id=DestroyString(id);
+  tiles->file=OpenMagickCacheFile(GetMagickCacheTier(cache,resource),
+    tiles->path,O_WRONLY | O_CREAT | O_TRUNC,S_IRUSR | S_IWUSR | S_IRGRP |
+    S_IWGRP | S_IROTH | S_IWOTH);
+  if (tiles->file == -1)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot open file","`%s'",tiles->path);
+      tiles->path=DestroyString(tiles->path);
+      tiles->offsets=(MagickOffsetType *) RelinquishMagickMemory(
+        tiles->offsets);
+      return(MagickFalse);
+    }
+  tiles->offsets[0]=(MagickOffsetType) (sizeof(tiles->header)+
+    (tiles->number_tiles+1)*sizeof(*tiles->offsets));
+  tiles->image_info=AcquireImageInfo();
+  (void) CopyMagickString(tiles->image_info->magick,"MIFF",MagickPathExtent);
+  return(lseek(tiles->file,(off_t) tiles->offsets[0],SEEK_SET) ==
+    (off_t) tiles->offsets[0] ? MagickTrue : MagickFalse);
+}
+
+static MagickBooleanType WriteMagickCacheTiles(MagickCache *cache,
+  MagickCacheResource *resource,const Image *image,const ssize_t y,
+  const size_t rows,struct TileStream *tiles)
+{
+  Image
+    *tile;
+
+  MagickBooleanType
+    status;
+
+  RectangleInfo
+    geometry;
+
+  size_t
+    i,
+    length;
+
+  void
+    *blob;
+
+  /*
+    Append the next row of tiles, cut from the given rows of the image.
+  */
+  status=MagickTrue;
+  for (i=0; (status != MagickFalse) && (i < tiles->columns); i++)
+  {
+    if (tiles->index >= tiles->number_tiles)
+      return(MagickFalse);
+    geometry.x=(ssize_t) (i*tiles->extent);
+    geometry.y=y;
+    geometry.width=MagickCacheMin(tiles->extent,image->columns-(size_t)
+      geometry.x);
+    geometry.height=rows;
+    tile=CropImage(image,&geometry,resource->exception);
+    if (tile == (Image *) NULL)
+      return(MagickFalse);
+    /*
+      Tiles keep the source depth.  With the tiles option they are zip
+      compressed at level 1: tiles are decoded on each extract, so favor speed.
+    */
+    (void) CopyMagickString(tile->magick,"MIFF",MagickPathExtent);
+    if (resource->depth != 0)
+      tile->depth=resource->depth;
+    tile->compression=NoCompression;
+    if (cache->tiles != 0)
+      {
+        tile->compression=ZipCompression;
+        tile->quality=10;
+      }
+    length=0;
+    blob=ImageToBlob(tiles->image_info,tile,&length,resource->exception);
+    tile=DestroyImage(tile);
+    if (blob == (void *) NULL)
+      return(MagickFalse);
+    status=WriteMagickCacheBlob(tiles->file,blob,length);
+    blob=RelinquishMagickMemory(blob);
+    tiles->offsets[tiles->index+1]=tiles->offsets[tiles->index]+
+      (MagickOffsetType) length;
+    tiles->index++;
+  }
+  return(status);
+}
+
+static MagickBooleanType CloseMagickCacheTiles(MagickCache *cache,
+  MagickCacheResource *resource,struct TileStream *tiles,
+  MagickBooleanType status)
+{
+  char
+    *path;
+
+  MagickCache
+    *tier;
+
+  /*
+    Write the header and index once every tile is, then rename the tiles in
+    place.
+  */
+  if (tiles->file == -1)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot write tiles","`%s'",resource->iri);
+      return(MagickFalse);
+    }
+  tier=GetMagickCacheTier(cache,resource);
+  if (tiles->index != tiles->number_tiles)
+    status=MagickFalse;
+  if ((status != MagickFalse) && (lseek(tiles->file,0,SEEK_SET) != 0))
+    status=MagickFalse;
+  if (status != MagickFalse)
+    status=WriteMagickCacheBlob(tiles->file,&tiles->header,
+      sizeof(tiles->header));
+  if (status != MagickFalse)
+    status=WriteMagickCacheBlob(tiles->file,tiles->offsets,
+      (tiles->number_tiles+1)*sizeof(*tiles->offsets));
+  if (close_utf8(tiles->file) == -1)
+    status=MagickFalse;
+  tiles->file=(-1);
+  tiles->image_info=DestroyImageInfo(tiles->image_info);
+  tiles->offsets=(MagickOffsetType *) RelinquishMagickMemory(tiles->offsets);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,".tiles");
+  if ((status != MagickFalse) &&
+      (RenameMagickCacheFile(tier,tiles->path,path) != 0))
+    status=MagickFalse;
+  (void) RemoveMagickCacheFile(tier,tiles->path);
+  tiles->path=DestroyString(tiles->path);
+  path=DestroyString(path);
+  if (status == MagickFalse)
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"cannot write tiles","`%s'",resource->iri);
+  return(status);
+}
+
+static MagickBooleanType WriteMagickCacheResourceTiles(MagickCache *cache,
+  MagickCacheResource *resource,const Image *image)
+{
+  MagickBooleanType
+    status;
+
+  size_t
+    y;
+
+  struct TileStream
+    tiles;
+
+  status=OpenMagickCacheTiles(cache,resource,image->columns,image->rows,
+    &tiles);
+  for (y=0; (status != MagickFalse) && (y < image->rows); y+=tiles.extent)
+    status=WriteMagickCacheTiles(cache,resource,image,(ssize_t) y,
+      MagickCacheMin(tiles.extent,image->rows-y),&tiles);
+  return(CloseMagickCacheTiles(cache,resource,&tiles,status));
+}
+
+static MagickBooleanType WriteMagickCacheResourceFrames(MagickCache *cache,
+  MagickCacheResource *resource,const Image *images)
+{
+  char
+    *id,
+    *path,
+    *temporary_path;
+
+  const Image
+    *next;
+
+  Image
+    *frame;
+
+  ImageInfo
+    *image_info;
+
+  int
+    file;
+
+  MagickBooleanType
+    status;
+
+  MagickCache
+    *tier;
+
+  MagickOffsetType
+    *offsets;
+
+  size_t
+    i,
+    length,
+    number_frames;
+
+  StringInfo
+    *key;
+
+  struct FrameHeader
+    header;
+
+  void
+    *blob;
+
+  /*
+    Each frame is a MIFF, located by an index of offsets after the header, so
+    any frame is read in constant time.  The frames are written under a
+    random name and renamed in place.
+  */
+  number_frames=GetImageListLength(images);
+  offsets=(MagickOffsetType *) AcquireQuantumMemory(number_frames+1,
+    sizeof(*offsets));
+  if (offsets == (MagickOffsetType *) NULL)
+    return(MagickFalse);
+  (void) memset(&header,0,sizeof(header));
+  header.signature=MagickCacheSignature;
+  header.length=(unsigned int) sizeof(header);
+  header.frames=(MagickOffsetType) number_frames;
+  tier=GetMagickCacheTier(cache,resource);
+  key=GetRandomKey(cache->random_info,MagickCacheNonceExtent);
+  id=StringInfoToHexString(key);
+  key=DestroyStringInfo(key);
+  temporary_path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&temporary_path,"-");
+  (void) ConcatenateString(&temporary_path,id);
+  id=DestroyString(id);
+  file=OpenMagickCacheFile(tier,temporary_path,O_WRONLY | O_CREAT | O_TRUNC,
+    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+  if (file == -1)
+    {
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot open file","`%s'",temporary_path);
+      temporary_path=DestroyString(temporary_path);
+      offsets=(MagickOffsetType *) RelinquishMagickMemory(offsets);
+      return(MagickFalse);
+    }
+  offsets[0]=(MagickOffsetType) (sizeof(header)+(number_frames+1)*
+    sizeof(*offsets));
+  status=lseek(file,(off_t) offsets[0],SEEK_SET) == (off_t) offsets[0] ?
+    MagickTrue : MagickFalse;
+  image_info=AcquireImageInfo();
+  (void) CopyMagickString(image_info->magick,"MIFF",MagickPathExtent);
+  next=images;
+  for (i=0; (status != MagickFalse) && (i < number_frames); i++)
+  {
+    /*
+      A clone shares the frame pixels; it is encoded on its own.
+    */
+    frame=CloneImage(next,0,0,MagickTrue,resource->exception);
+    if (frame == (Image *) NULL)
+      {
+        status=MagickFalse;
+        break;
+      }
+    (void) CopyMagickString(frame->magick,"MIFF",MagickPathExtent);
+    if (cache->tiles != 0)
+      {
+        frame->compression=ZipCompression;
+        frame->quality=10;
+      }
+    length=0;
+    blob=ImageToBlob(image_info,frame,&length,resource->exception);
+    frame=DestroyImage(frame);
+    if (blob == (void *) NULL)
+      {
+        status=MagickFalse;
+        break;
+      }
+    status=WriteMagickCacheBlob(file,blob,length);
+    blob=RelinquishMagickMemory(blob);
+    offsets[i+1]=offsets[i]+(MagickOffsetType) length;
+    next=GetNextImageInList(next);
+  }
+  image_info=DestroyImageInfo(image_info);
+  if ((status != MagickFalse) && (lseek(file,0,SEEK_SET) != 0))
+    status=MagickFalse;
+  if (status != MagickFalse)
+    status=WriteMagickCacheBlob(file,&header,sizeof(header));
+  if (status != MagickFalse)
+    status=WriteMagickCacheBlob(file,offsets,(number_frames+1)*
+      sizeof(*offsets));
+  if (close_utf8(file) == -1)
+    status=MagickFalse;
+  offsets=(MagickOffsetType *) RelinquishMagickMemory(offsets);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,".frames");
+  if ((status != MagickFalse) &&
+      (RenameMagickCacheFile(tier,temporary_path,path) != 0))
+    status=MagickFalse;
+  (void) RemoveMagickCacheFile(tier,temporary_path);
+  temporary_path=DestroyString(temporary_path);
+  path=DestroyString(path);
+  if (status == MagickFalse)
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"cannot write frames","`%s'",resource->iri);
+  return(status);
+}
+
+static MagickBooleanType WriteMagickCacheResourceMarker(MagickCache *cache,
+  MagickCacheResource *resource)
 {
   char
     *path;
 
-  ExceptionInfo
-    *exception;
+  MagickBooleanType
+    status;
+
+  /*
+    An image put lazily, as tiles, or as frames has an empty MPC header: the
+    resource exists, but its pixels are elsewhere.
+  */
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=WriteMagickCacheFile(GetMagickCacheTier(cache,resource),path,O_TRUNC,
+    "",0,resource->exception);
+  path=DestroyString(path);
+  return(status);
+}
+
+static MagickBooleanType CommitMagickCacheImage(MagickCache *cache,
+  MagickCacheResource *resource,MagickBooleanType status)
+{
+  status=CommitMagickCacheJournal(cache,resource,PutJournalRecord,status);
+  if (status != MagickFalse)
+    (void) MirrorMagickCacheResource(cache,resource);
+  ChargeMagickCacheResource(cache,resource,status);
+  if (status != MagickFalse)
+    (void) RecordMagickCacheChange(cache,resource,PutChangeType);
+  return(status);
+}
+
+static MagickBooleanType MaterializeMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource)
+{
+  char
+    *cache_path,
+    *id,
+    *path,
+    *temporary_path;
+
+  Image
+    *image;
 
   ImageInfo
     *image_info;
@@ -1370,274 +7966,209 @@ MagickExport Image *GetMagickCacheResourceImage(MagickCache *cache,
   MagickBooleanType
     status;
 
+  MagickCache
+    *tier;
+
+  MagickSizeType
+    footprint;
+
+  size_t
+    extent;
+
+  StringInfo
+    *key;
+
+  void
+    *blob;
+
   /*
-    Return the resource identified by its IRI as an image.
+    Decode the encoded bytes of a lazily put image into its MPC.  The MPC is
+    written under a random name and renamed in place, its image cache first,
+    so a concurrent reader finds either no MPC or a whole one.
   */
-  assert(cache != (MagickCache *) NULL);
-  assert(cache->signature == MagickCacheSignature);
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  status=GetMagickCacheResource(cache,resource);
-  if (status == MagickFalse)
-    return((Image *) NULL);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  if (extract != (const char *) NULL)
+  if (resource->resource_type != ImageResourceType)
+    return(MagickFalse);
+  tier=GetMagickCacheTier(cache,resource);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  (void) ConcatenateString(&path,".source");
+  blob=ReadMagickCacheFile(tier,path,&extent,resource->exception);
+  path=DestroyString(path);
+  if (blob == (void *) NULL)
+    return(MagickFalse);
+  image_info=AcquireImageInfo();
+  image=BlobToImage(image_info,blob,extent,resource->exception);
+  blob=RelinquishMagickMemory(blob);
+  if (image == (Image *) NULL)
     {
-      (void) ConcatenateString(&path,"[");
-      (void) ConcatenateString(&path,extract);
-      (void) ConcatenateString(&path,"]");
+      image_info=DestroyImageInfo(image_info);
+      return(MagickFalse);
     }
-  if (strlen(path) > (MagickPathExtent-2))
+  footprint=GetMagickCacheResourceFootprint(cache,resource);
+  if (IsMagickCacheImageTiled(cache,image) != MagickFalse)
+    status=WriteMagickCacheResourceTiles(cache,resource,image);
+  else if ((cache->frames != MagickFalse) &&
+           (GetNextImageInList(image) != (Image *) NULL))
+    status=WriteMagickCacheResourceFrames(cache,resource,image);
+  else
     {
+      key=GetRandomKey(cache->random_info,MagickCacheNonceExtent);
+      id=StringInfoToHexString(key);
+      key=DestroyStringInfo(key);
+      path=AcquireMagickCacheResourcePath(resource,resource->id);
+      (void) ConcatenateString(&path,"-");
+      (void) ConcatenateString(&path,id);
+      id=DestroyString(id);
+      temporary_path=AcquireMagickCachePath(tier,path);
+      (void) FormatLocaleString(image->filename,MagickPathExtent,"mpc:%s",
+        temporary_path);
+      temporary_path=DestroyString(temporary_path);
+      status=WriteImages(image_info,image,image->filename,
+        resource->exception);
+      temporary_path=AcquireString(path);
+      (void) ConcatenateString(&temporary_path,".cache");
+      path=DestroyString(path);
+      path=AcquireMagickCacheResourcePath(resource,resource->id);
+      cache_path=AcquireString(path);
+      (void) ConcatenateString(&cache_path,".cache");
+      if ((status != MagickFalse) &&
+          (RenameMagickCacheFile(tier,temporary_path,cache_path) != 0))
+        status=MagickFalse;
+      cache_path=DestroyString(cache_path);
+      (void) RemoveMagickCacheFile(tier,temporary_path);
+      temporary_path[strlen(temporary_path)-6]='\0';
+      if ((status != MagickFalse) &&
+          (RenameMagickCacheFile(tier,temporary_path,path) != 0))
+        status=MagickFalse;
+      (void) RemoveMagickCacheFile(tier,temporary_path);
+      temporary_path=DestroyString(temporary_path);
       path=DestroyString(path);
-      errno=ENAMETOOLONG;
-      return((Image *) NULL);
     }
-  image_info=AcquireImageInfo();
-  (void) CopyMagickString(image_info->filename,path,MagickPathExtent);
-  (void) CopyMagickString(image_info->magick,"MPC",MagickPathExtent);
-  exception=AcquireExceptionInfo();
-  if (resource->blob != NULL)
-    DestroyMagickCacheResourceBlob(resource);
-  resource->blob=(void *) ReadImage(image_info,exception);
-  exception=DestroyExceptionInfo(exception);
-  if (resource->blob == (void *) NULL)
-    (void) ThrowMagickException(resource->exception,GetMagickModule(),
-      CacheError,"cannot get resource","`%s'",resource->iri);
-  else
+  image_info=DestroyImageInfo(image_info);
+  if ((status != MagickFalse) && (cache->pyramid != MagickFalse) &&
+      (GetNextImageInList(image) == (Image *) NULL))
+    (void) WriteMagickCacheResourceLevels(cache,resource,image);
+  image=DestroyImageList(image);
+  if (status == MagickFalse)
     {
-      const Image *image = (const Image *) resource->blob;
-      resource->columns=image->columns;
-      resource->rows=image->rows;
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot materialize resource","`%s'",resource->iri);
+      return(MagickFalse);
     }
-  path=DestroyString(path);
-  image_info=DestroyImageInfo(image_info);
-  return((Image *) resource->blob);
-}
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e I R I                         %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheResourceIRI() gets a resource identified by its IRI in the
-%  cache repository.
-%
-%  The format of the GetMagickCacheResourceIRI method is:
-%
-%      char *GetMagickCacheResourceIRI(MagickCacheResource *resource)
-%
-%  A description of each parameter follows:
-%
-%    o resource: the resource.
-%
-*/
-MagickExport char *GetMagickCacheResourceIRI(
-  const MagickCacheResource *resource)
-{
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  return(resource->iri);
+  UpdateMagickCacheUsage(cache,(MagickOffsetType)
+    (GetMagickCacheResourceFootprint(cache,resource)-footprint),0);
+  (void) MirrorMagickCacheResource(cache,resource);
+  return(MagickTrue);
 }
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e M e t a                       %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheResourceMeta() gets any metadata associated with the resource
-%  in the cache repository..
-%
-%  The format of the GetMagickCacheResourceMeta method is:
-%
-%      char *GetMagickCacheResourceMeta(MagickCacheResource *resource)
-%
-%  A description of each parameter follows:
-%
-%    o cache: the cache repository.
-%
-%    o resource: the resource.
-%
-*/
-MagickExport char *GetMagickCacheResourceMeta(MagickCache *cache,
-  MagickCacheResource *resource)
+
+static MagickBooleanType PutMagickCacheImage(MagickCache *cache,
+  MagickCacheResource *resource,const Image *image,
+  const MagickBooleanType owned,const MagickBooleanType lazy,
+  const size_t extent,const void *source)
 {
   char
-    *path;
+    *path,
+    *relative_path;
+
+  Image
+    *images;
+
+  ImageInfo
+    *image_info;
 
   MagickBooleanType
     status;
 
   /*
-    Return the resource identified by its IRI as metadata.
+    Puts an image resource in the MagickCache identified by its IRI.
   */
-  assert(cache != (MagickCache *) NULL);
-  assert(cache->signature == MagickCacheSignature);
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  status=GetMagickCacheResource(cache,resource);
+  resource->columns=image->columns;
+  resource->rows=image->rows;
+  resource->depth=image->depth;
+  status=PutMagickCacheResource(cache,resource);
   if (status == MagickFalse)
-    return((char *) NULL);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  if (strlen(path) > (MagickPathExtent-2))
+    return(status);
+  if (lazy != MagickFalse)
     {
+      /*
+        Only the encoded bytes are put; the image is decoded on first use.
+      */
+      path=AcquireMagickCacheResourcePath(resource,resource->id);
+      (void) ConcatenateString(&path,".source");
+      status=WriteMagickCacheFile(GetMagickCacheTier(cache,resource),path,
+        O_TRUNC,source,extent,resource->exception);
       path=DestroyString(path);
-      errno=ENAMETOOLONG;
-      return((char *) NULL);
+      if (status != MagickFalse)
+        status=WriteMagickCacheResourceMarker(cache,resource);
+      return(CommitMagickCacheImage(cache,resource,status));
     }
-  status=ResourceToBlob(resource,path);
-  path=DestroyString(path);
-  if (status == MagickFalse)
-    return((char *) NULL);
-  return((char *) resource->blob);
-}
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e S i z e                       %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheResourceSize() returns the size of the image associated with
-%  the resource in the cache repository.
-%
-%  The format of the GetMagickCacheResourceSize method is:
-%
-%      void GetMagickCacheResourceSize(
-%        const MagickCacheResource *resource,size_t *columns,size_t *rows)
-%
-%  A description of each parameter follows:
-%
-%    o resource: the resource.
-%
-*/
-MagickExport void GetMagickCacheResourceSize(
-  const MagickCacheResource *resource,size_t *columns,size_t *rows)
-{
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  *columns=resource->columns;
-  *rows=resource->rows;
-}
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e T i m e s t a m p             %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheResourceTimestamp() returns the timestamp associated with a
-%  resource in the cache repository.
-%
-%  The format of the GetMagickCacheResourceTimestamp method is:
-%
-%      time_t GetMagickCacheResourceTimestamp(
-%        const MagickCacheResource *resource)
-%
-%  A description of each parameter follows:
-%
-%    o resource: the resource.
-%
-*/
-MagickExport time_t GetMagickCacheResourceTimestamp(
-  const MagickCacheResource *resource)
-{
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  return(resource->timestamp);
-}
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e T T L                         %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheResourceTTL() returns the time-to-live associated with a
-%  resource in the cache repository.
-%
-%  The format of the GetMagickCacheResourceTTL method is:
-%
-%      time_t GetMagickCacheResourceTTL(const MagickCacheResource *resource)
-%
-%  A description of each parameter follows:
-%
-%    o resource: the resource.
-%
-*/
-MagickExport time_t GetMagickCacheResourceTTL(
-  const MagickCacheResource *resource)
-{
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  return(resource->ttl);
+  if (IsMagickCacheImageTiled(cache,image) != MagickFalse)
+    {
+      /*
+        The tiles take the place of the MPC.
+      */
+      status=WriteMagickCacheResourceTiles(cache,resource,image);
+      if (status != MagickFalse)
+        status=WriteMagickCacheResourceMarker(cache,resource);
+    }
+  else if ((cache->frames != MagickFalse) &&
+           (GetNextImageInList(image) != (Image *) NULL))
+    {
+      /*
+        So do the frames of a sequence.
+      */
+      status=WriteMagickCacheResourceFrames(cache,resource,image);
+      if (status != MagickFalse)
+        status=WriteMagickCacheResourceMarker(cache,resource);
+    }
+  else
+    {
+      /*
+        Writing an MPC renames the frames and moves their pixels to the MPC
+        image cache.  An image we own is written as is; the frames of a
+        caller's image are cloned first, which shares their pixels rather
+        than copying them, so the caller's image is left alone.
+      */
+      images=(Image *) image;
+      if (owned == MagickFalse)
+        {
+          images=CloneImageList(image,resource->exception);
+          if (images == (Image *) NULL)
+            return(CommitMagickCacheImage(cache,resource,MagickFalse));
+        }
+      relative_path=AcquireMagickCacheResourcePath(resource,resource->id);
+      path=AcquireMagickCachePath(GetMagickCacheTier(cache,resource),
+        relative_path);
+      relative_path=DestroyString(relative_path);
+      (void) FormatLocaleString(images->filename,MagickPathExtent,"mpc:%s",
+        path);
+      path=DestroyString(path);
+      image_info=AcquireImageInfo();
+      status=WriteImages(image_info,images,images->filename,
+        resource->exception);
+      image_info=DestroyImageInfo(image_info);
+      if (owned == MagickFalse)
+        images=DestroyImageList(images);
+    }
+  if ((status != MagickFalse) && (cache->pyramid != MagickFalse) &&
+      (GetNextImageInList(image) == (Image *) NULL))
+    status=WriteMagickCacheResourceLevels(cache,resource,image);
+  if ((status != MagickFalse) && (source != (const void *) NULL) &&
+      (cache->source != MagickFalse))
+    {
+      path=AcquireMagickCacheResourcePath(resource,resource->id);
+      (void) ConcatenateString(&path,".source");
+      status=WriteMagickCacheFile(GetMagickCacheTier(cache,resource),path,
+        O_TRUNC,source,extent,resource->exception);
+      path=DestroyString(path);
+    }
+  return(CommitMagickCacheImage(cache,resource,status));
 }
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e T y p e                       %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheResourceType() returns the type associated with a resource in
-%  the cache respository.
-%
-%  The format of the GetMagickCacheResourceType method is:
-%
-%      MagickCacheResourceType GetMagickCacheResourceType(
-%        const MagickCacheResource *resource)
-%
-%  A description of each parameter follows:
-%
-%    o resource: the resource.
-%
-*/
-MagickExport MagickCacheResourceType GetMagickCacheResourceType(
-  const MagickCacheResource *resource)
+
+MagickExport MagickBooleanType PutMagickCacheResourceImage(MagickCache *cache,
+  MagickCacheResource *resource,const Image *image)
 {
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  return(resource->resource_type);
+  return(PutMagickCacheImage(cache,resource,image,MagickFalse,MagickFalse,0,
+    (const void *) NULL));
 }
 
 /*
@@ -1645,61 +8176,69 @@ MagickExport MagickCacheResourceType GetMagickCacheResourceType(
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   G e t M a g i c k C a c h e R e s o u r c e V e r s i o n                 %
+%   P u t M a g i c k C a c h e R e s o u r c e I m a g e B l o b             %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  GetMagickCacheResourceVersion() returns the version associated with a
-%  resource in the cache repository.
+%  PutMagickCacheResourceImageBlob() puts an image resource, given in an
+%  encoded image format such as JPEG, in the MagickCache identified by its
+%  IRI.  If the IRI already exists, an exception is returned.  With the source
+%  option, the encoded bytes are kept with the image so
+%  GetMagickCacheResourceImageSource() can return them as they were put.
+%  With the source:lazy option, only the encoded bytes are put and the image
+%  is decoded into the cache on first access to its pixels.
 %
-%  The format of the GetMagickCacheResourceVersion method is:
+%  The format of the PutMagickCacheResourceImageBlob method is:
 %
-%      size_t GetMagickCacheResourceVersion(
-%        const MagickCacheResource *resource)
+%      MagickBooleanType PutMagickCacheResourceImageBlob(MagickCache *cache,
+%        MagickCacheResource *resource,const size_t extent,const void *blob)
 %
 %  A description of each parameter follows:
 %
-%    o resource: the resource.
-%
-*/
-MagickExport size_t GetMagickCacheResourceVersion(
-  const MagickCacheResource *resource)
-{
-  assert(resource != (MagickCacheResource *) NULL);
-  assert(resource->signature == MagickCacheSignature);
-  return(resource->version);
-}
-
-/*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   G e t M a g i c k C a c h e T i m e s t a m p                             %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  GetMagickCacheTimestamp() returns the timestamp associated with the cache
-%  repository.
-%
-%  The format of the GetMagickCacheResource method is:
+%    o cache: the cache repository.
 %
-%      time_t GetMagickCacheResourceTimestamp(const MagickCache *cache)
+%    o resource: the resource.
 %
-%  A description of each parameter follows:
+%    o extent: the blob extent.
 %
-%    o resource: the resource.
+%    o blob: the encoded image.
 %
 */
-MagickExport time_t GetMagickCacheTimestamp(const MagickCache *cache)
+MagickExport MagickBooleanType PutMagickCacheResourceImageBlob(
+  MagickCache *cache,MagickCacheResource *resource,const size_t extent,
+  const void *blob)
 {
+  Image
+    *image;
+
+  ImageInfo
+    *image_info;
+
+  MagickBooleanType
+    status;
+
+  /*
+    Decode the image, or with the source:lazy option just its size; its
+    format is told from its leading bytes.
+  */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  return(cache->timestamp);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  image_info=AcquireImageInfo();
+  if (cache->lazy != MagickFalse)
+    image=PingBlob(image_info,blob,extent,resource->exception);
+  else
+    image=BlobToImage(image_info,blob,extent,resource->exception);
+  image_info=DestroyImageInfo(image_info);
+  if (image == (Image *) NULL)
+    return(MagickFalse);
+  status=PutMagickCacheImage(cache,resource,image,MagickTrue,cache->lazy,
+    extent,blob);
+  image=DestroyImageList(image);
+  return(status);
 }
 
 /*
@@ -1707,77 +8246,198 @@ MagickExport time_t GetMagickCacheTimestamp(const MagickCache *cache)
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   I d e n t i f y M a g i c k C a c h e R e s o u r c e                     %
+%   P u t M a g i c k C a c h e R e s o u r c e I m a g e S t r e a m         %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  IdentifyMagickCacheResource() identifies a resource within the cache
-%  repository.
+%  PutMagickCacheResourceImageStream() puts an image resource, read from a
+%  file, in the MagickCache identified by its IRI.  Rather than decoding the
+%  whole image in memory, its rows are streamed from the decoder straight
+%  into tiles, so memory use is one band of rows a tile high whatever the
+%  image dimensions.  The tiles are stored as the packed option stores them,
+%  at the source depth, and take their extent and compression from the tiles
+%  option; the source and pyramid options do not apply.  Only single frame
+%  JPEG, MIFF, PNG, PNM, and TIFF images, whose decoders return their rows
+%  top to bottom, are streamed.  If the IRI already exists, an exception is
+%  returned.
 %
-%  The format of the IdentifyMagickCacheResource method is:
+%  The format of the PutMagickCacheResourceImageStream method is:
 %
-%      MagickBooleanType IdentifyMagickCacheResource(MagickCache *cache,
-%        MagickCacheResource *resource,FILE *file)
+%      MagickBooleanType PutMagickCacheResourceImageStream(MagickCache *cache,
+%        MagickCacheResource *resource,const char *filename)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o iri: the IRI.
+%    o resource: the resource.
 %
-%    o file: the file.
+%    o filename: the image filename.
 %
 */
-MagickExport MagickBooleanType IdentifyMagickCacheResource(MagickCache *cache,
-  MagickCacheResource *resource,FILE *file)
+static size_t StreamMagickCacheImage(const Image *image,const void *pixels,
+  const size_t columns)
 {
-  char
-    extent[MagickPathExtent],
-    iso8601[sizeof("9999-99-99T99:99:99Z")],
-    *path,
-    size[MagickPathExtent];
+  size_t
+    i,
+    rows;
 
-  int
-    expired;
+  struct ImageStream
+    *stream;
+
+  /*
+    Gather the rows of the region the decoder just synced, as laid out in
+    the image cache, into a band one tile high and write out its tiles once
+    it is full.  A stream row carries no index, so rows are taken to arrive
+    top to bottom: only decoders known to emit them so are streamed, and a
+    region that is not whole rows, or more rows than the image has, fails.
+  */
+  stream=(struct ImageStream *) image->client_data;
+  if (pixels == (const void *) NULL)
+    return(columns);
+  if (stream->image == (const Image *) NULL)
+    {
+      stream->image=image;
+      stream->band=CloneImage(image,image->columns,stream->tiles.extent,
+        MagickTrue,stream->resource->exception);
+      if (stream->band == (Image *) NULL)
+        stream->status=MagickFalse;
+    }
+  rows=columns == 0 ? 0 : (size_t) (GetImageExtent(image)/columns);
+  if ((stream->status == MagickFalse) || (stream->image != image) ||
+      (columns != image->columns) || (rows == 0) ||
+      (((MagickSizeType) rows*columns) != GetImageExtent(image)) ||
+      ((stream->rows+rows) > image->rows) ||
+      (stream->band->number_channels != image->number_channels))
+    {
+      stream->status=MagickFalse;
+      return(0);
+    }
+  for (i=0; i < rows; i++)
+  {
+    Quantum
+      *q;
+
+    size_t
+      extent,
+      y;
+
+    y=stream->rows % stream->tiles.extent;
+    q=QueueAuthenticPixels(stream->band,0,(ssize_t) y,columns,1,
+      stream->resource->exception);
+    if (q == (Quantum *) NULL)
+      {
+        stream->status=MagickFalse;
+        return(0);
+      }
+    extent=columns*image->number_channels;
+    (void) memcpy(q,(const Quantum *) pixels+i*extent,extent*sizeof(*q));
+    if (SyncAuthenticPixels(stream->band,stream->resource->exception) ==
+        MagickFalse)
+      {
+        stream->status=MagickFalse;
+        return(0);
+      }
+    stream->rows++;
+    if ((y == (stream->tiles.extent-1)) || (stream->rows == image->rows))
+      stream->status=WriteMagickCacheTiles(stream->cache,stream->resource,
+        stream->band,0,y+1,&stream->tiles);
+    if (stream->status == MagickFalse)
+      return(0);
+  }
+  return(columns);
+}
+
+MagickExport MagickBooleanType PutMagickCacheResourceImageStream(
+  MagickCache *cache,MagickCacheResource *resource,const char *filename)
+{
+  Image
+    *image;
+
+  ImageInfo
+    *image_info;
 
   MagickBooleanType
     status;
 
-  struct tm
-    timestamp;
+  size_t
+    i;
+
+  struct ImageStream
+    stream;
 
-  /*
-    If the resource ID exists, identify it.
-  */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  status=GetMagickCacheResource(cache,resource);
-  *size='\0';
-  if (resource->resource_type == ImageResourceType)
-    (void) snprintf(size,MagickPathExtent,"[%gx%g]",(double) resource->columns,
-      (double) resource->rows);
-  (void) FormatMagickSize(GetMagickCacheResourceExtent(resource),MagickTrue,
-    "B",MagickPathExtent,extent);
-  (void) GetMagickUTCTime(&resource->timestamp,&timestamp);
-  (void) strftime(iso8601,sizeof(iso8601),"%FT%TZ",&timestamp);
-  expired=' ';
-  if ((resource->ttl != 0) && ((resource->timestamp+resource->ttl) < time(0)))
-    expired='*';
-  (void) fprintf(file,"%s%s %s %g:%02g:%02g:%02g%c %s\n",
-    GetMagickCacheResourceIRI(resource),size,extent,
-    ceil((double) (resource->ttl/(3600*24))),
-    ceil((double) ((resource->ttl % (24*3600))/3600)),
-    ceil((double) ((resource->ttl % 3600)/60)),
-    ceil((double) ((resource->ttl % 3600) % 60)),expired,iso8601);
-  path=DestroyString(path);
-  return(status);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  assert(filename != (const char *) NULL);
+  /*
+    Ping the image for its dimensions and format; its pixels are not read.
+  */
+  image_info=AcquireImageInfo();
+  (void) CopyMagickString(image_info->filename,filename,MagickPathExtent);
+  image=PingImage(image_info,resource->exception);
+  if (image == (Image *) NULL)
+    {
+      image_info=DestroyImageInfo(image_info);
+      return(MagickFalse);
+    }
+  for (i=0; i < (sizeof(StreamFormats)/sizeof(*StreamFormats)); i++)
+    if (LocaleCompare(image->magick,StreamFormats[i]) == 0)
+      break;
+  if ((GetNextImageInList(image) != (Image *) NULL) ||
+      (i == (sizeof(StreamFormats)/sizeof(*StreamFormats))))
+    {
+      image=DestroyImageList(image);
+      image_info=DestroyImageInfo(image_info);
+      (void) ThrowMagickException(resource->exception,GetMagickModule(),
+        CacheError,"cannot stream image","`%s'",filename);
+      return(MagickFalse);
+    }
+  resource->columns=image->columns;
+  resource->rows=image->rows;
+  resource->depth=image->depth;
+  image=DestroyImageList(image);
+  status=PutMagickCacheResource(cache,resource);
+  if (status == MagickFalse)
+    {
+      image_info=DestroyImageInfo(image_info);
+      return(status);
+    }
+  /*
+    The rows go straight into the tiles; the MPC header is an empty marker.
+  */
+  (void) memset(&stream,0,sizeof(stream));
+  stream.cache=cache;
+  stream.resource=resource;
+  stream.status=OpenMagickCacheTiles(cache,resource,resource->columns,
+    resource->rows,&stream.tiles);
+  image=(Image *) NULL;
+  if (stream.status != MagickFalse)
+    {
+      image_info->client_data=(void *) &stream;
+      image=ReadStream(image_info,StreamMagickCacheImage,resource->exception);
+      image_info->client_data=(void *) NULL;
+    }
+  status=MagickFalse;
+  if ((image != (Image *) NULL) && (stream.status != MagickFalse) &&
+      (image->columns == resource->columns) &&
+      (image->rows == resource->rows) && (stream.rows == image->rows))
+    status=MagickTrue;
+  else
+    (void) ThrowMagickException(resource->exception,GetMagickModule(),
+      CacheError,"cannot stream image","`%s'",filename);
+  if (stream.band != (Image *) NULL)
+    stream.band=DestroyImage(stream.band);
+  if (image != (Image *) NULL)
+    image=DestroyImageList(image);
+  image_info=DestroyImageInfo(image_info);
+  status=CloseMagickCacheTiles(cache,resource,&stream.tiles,status);
+  if (status != MagickFalse)
+    status=WriteMagickCacheResourceMarker(cache,resource);
+  return(CommitMagickCacheImage(cache,resource,status));
 }
 
 /*
@@ -1785,47 +8445,55 @@ MagickExport MagickBooleanType IdentifyMagickCacheResource(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   I s M a g i c k C a c h e R e s o u r c e E x p i r e d                   %
+%   P u t M a g i c k C a c h e R e s o u r c e M e t a                       %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  IsMagickCacheResourceExpired() returns MagickTrue if the resource creation
-%  date plus the time to live is greater than or equal to the current time.
-%  Note, a resource with a time to live of zero, never expires.
+%  PutMagickCacheResourceMeta() puts metadata in the MagickCache identified by
+%  its IRI.  If the IRI already exists, an exception is returned.
 %
-%  The format of the IsMagickCacheResourceExpired method is:
+%  The format of the PutMagickCacheResourceMeta method is:
 %
-%      MagickBooleanType IsMagickCacheResourceExpired(MagickCache *cache,
-%        MagickCacheResource *resource)
+%      MagickBooleanType PutMagickCacheResourceMeta(MagickCache *cache,
+%        const MagickCacheResource *resource,const char *properties)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o iri: the IRI.
+%    o resource: the resource.
+%
+%    o properties: the properties.
 %
 */
-MagickExport MagickBooleanType IsMagickCacheResourceExpired(MagickCache *cache,
-  MagickCacheResource *resource)
+MagickExport MagickBooleanType PutMagickCacheResourceMeta(MagickCache *cache,
+  MagickCacheResource *resource,const char *properties)
 {
+  char
+    *path;
+
   MagickBooleanType
     status;
 
-  assert(cache != (MagickCache *) NULL);
-  assert(cache->signature == MagickCacheSignature);
-  status=GetMagickCacheResource(cache,resource);
+  /*
+    Puts resource meta in the MagickCache identified by its IRI.
+  */
+  status=PutMagickCacheResource(cache,resource);
   if (status == MagickFalse)
-    return(status);
-  if ((resource->ttl != 0) && ((resource->timestamp+resource->ttl) < time(0)))
-    {
-#if defined(ESTALE)
-      errno=ESTALE;
-#endif
-      return(MagickTrue);
-    }
-  return(MagickFalse);
+    return(MagickFalse);
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  status=WriteMagickCacheFile(GetMagickCacheTier(cache,resource),path,O_TRUNC,
+    properties,strlen(properties)+1,cache->exception);
+  path=DestroyString(path);
+  status=CommitMagickCacheJournal(cache,resource,PutJournalRecord,status);
+  if (status != MagickFalse)
+    (void) MirrorMagickCacheResource(cache,resource);
+  ChargeMagickCacheResource(cache,resource,status);
+  if (status != MagickFalse)
+    (void) RecordMagickCacheChange(cache,resource,PutChangeType);
+  return(status);
 }
 
 /*
@@ -1833,170 +8501,116 @@ MagickExport MagickBooleanType IsMagickCacheResourceExpired(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   I t e r a t e M a g i c k C a c h e R e s o u r c e s                     %
+%   R e b a l a n c e M a g i c k C a c h e R e s o u r c e s                 %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  IterateMagickCacheResources() iterates over all the resources in the
-%  MagickCache and calls the callback() method once for each resource
-%  discovered with three arguments: the MagickCache, the current resource, and
-%  a user context.  Use the resource `get` methods to retrieve any associated
-%  metadata such as the IRI or time-to-live.  To terminate the iteration, have
-%  callback() return MagickFalse.
+%  RebalanceMagickCacheResources() moves each resource payload below the IRI
+%  that is not on the root its IRI hashes to, typically after a root is added
+%  to the shard:roots option.  Until then such resources are still found, at
+%  the cost of a system call for each root searched.  It also copies the
+%  payloads missing from a root added to the mirror:roots option.  Resources
+%  in the cold tier are left alone.
 %
-%  The format of the IterateMagickCacheResources method is:
+%  The format of the RebalanceMagickCacheResources method is:
 %
-%      MagickBooleanType IterateMagickCacheResources(MagickCache *cache,
-%        const char *iri,MagickBooleanType (*callback)(MagickCache *cache,
-%        MagickCacheResource *resource,const void *context))
+%      MagickBooleanType RebalanceMagickCacheResources(MagickCache *cache,
+%        const char *iri)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
 %    o iri: the IRI.
-%
-*/
-MagickExport MagickBooleanType IterateMagickCacheResources(MagickCache *cache,
-  const char *iri,const void *context,MagickBooleanType (*callback)(
-  MagickCache *cache,MagickCacheResource *resource,const void *context))
+%
+*/
+
+static MagickBooleanType RebalanceMagickCacheResource(MagickCache *cache,
+  MagickCacheResource *resource,const void *context)
 {
   char
     *path;
 
-  DIR
-    *directory;
-
   MagickBooleanType
     status;
 
-  struct dirent
-    *entry;
+  MagickCache
+    *tier;
 
-  struct ResourceNode
-    *head,
-    *node,
-    *p,
-    *q;
+  size_t
+    i,
+    placement;
 
   struct stat
     attributes;
 
-  /*
-    Check that resource id exists in MagickCache.
-  */
-  assert(cache != (MagickCache *) NULL);
-  assert(cache->signature == MagickCacheSignature);
-  status=MagickTrue;
-  head=(struct ResourceNode *) AcquireCriticalMemory(sizeof(*node));
-  (void) memset(head,0,sizeof(*head));
-  head->path=AcquireString(cache->path);
-  (void) ConcatenateString(&head->path,"/");
-  (void) ConcatenateString(&head->path,iri);
-  head->next=(struct ResourceNode *) NULL;
-  head->previous=(struct ResourceNode *) NULL;
-  q=head;
-  for (p=head; p != (struct ResourceNode *) NULL; p=p->next)
-  {
-    directory=opendir(p->path);
-    if (directory == (DIR *) NULL)
-      {
-        status=MagickFalse;
-        break;
-      }
-    while ((entry=readdir(directory)) != (struct dirent *) NULL)
+  (void) context;
+  if (resource->cold != MagickFalse)
+    return(MagickTrue);
+  placement=GetMagickCacheShardPlacement(cache,resource->iri);
+  if (resource->shard != placement)
     {
-      path=AcquireString(p->path);
-      (void) ConcatenateString(&path,"/");
-      (void) ConcatenateString(&path,entry->d_name);
-      if (GetPathAttributes(path,&attributes) <= 0)
-        {
-          path=DestroyString(path);
-          break;
-        }
-      if ((strcmp(entry->d_name, ".") == 0) ||
-          (strcmp(entry->d_name, "..") == 0))
-        {
-          path=DestroyString(path);
-          continue;
-        }
-      if (S_ISDIR(attributes.st_mode) != 0)
+      tier=GetMagickCacheTier(cache,resource);
+      if (MoveMagickCacheResource(tier,GetMagickCacheShard(cache,placement),
+            resource) == MagickFalse)
         {
-          node=(struct ResourceNode *) AcquireCriticalMemory(sizeof(*node));
-          (void) memset(node,0,sizeof(*node));
-          node->path=path;
-          node->next=(struct ResourceNode *) NULL;
-          node->previous=q;
-          q->next=node;
-          q=q->next;
+          (void) ThrowMagickException(cache->exception,GetMagickModule(),
+            CacheError,"cannot rebalance resource","`%s'",resource->iri);
+          return(MagickFalse);
         }
-      else
-        if (S_ISREG(attributes.st_mode) != 0)
-          {
-            char *sentinel = ConstantString(path);
-            GetPathComponent(path,TailPath,sentinel);
-            if (strcmp(sentinel,MagickCacheResourceSentinel) == 0)
-              {
-                MagickCacheResource
-                  *resource;
-
-                GetPathComponent(path,HeadPath,path);
-                resource=AcquireMagickCacheResource(cache,path+
-                  strlen(cache->path)+1);
-                status=GetMagickCacheResource(cache,resource);
-                if (status != MagickFalse)
-                  {
-                    status=callback(cache,resource,context);
-                    if (status == MagickFalse)
-                      {
-                        path=DestroyString(path);
-                        resource=DestroyMagickCacheResource(resource);
-                        sentinel=DestroyString(sentinel);
-                        break;
-                      }
-                  }
-                resource=DestroyMagickCacheResource(resource);
-              }
-            path=DestroyString(path);
-            sentinel=DestroyString(sentinel);
-          }
+      if (tier != cache)
+        RemoveMagickCacheResourcePath(tier,resource);
+      resource->shard=placement;
     }
-    (void) closedir(directory);
-  }
   /*
-    Free resources.
+    Fill in the copies missing from a mirror added since the resource was put.
   */
-  for ( ; q != (struct ResourceNode *) NULL; )
-  {
-    node=q;
-    q=q->previous;
-    node->path=DestroyString(node->path);
-    node=(struct ResourceNode *) RelinquishMagickMemory(node);
-  }
+  status=MagickTrue;
+  path=AcquireMagickCacheResourcePath(resource,resource->id);
+  for (i=0; i < cache->number_mirrors; i++)
+    if ((GetMagickCacheFileAttributes(cache->mirrors[i],path,&attributes) ==
+         MagickFalse) && (CopyMagickCacheResource(GetMagickCacheTier(cache,
+         resource),cache->mirrors[i],resource) == MagickFalse))
+      {
+        (void) ThrowMagickException(cache->exception,GetMagickModule(),
+          CacheError,"cannot mirror resource","`%s'",resource->iri);
+        status=MagickFalse;
+      }
+  path=DestroyString(path);
   return(status);
 }
+
+MagickExport MagickBooleanType RebalanceMagickCacheResources(MagickCache *cache,
+  const char *iri)
+{
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  return(IterateMagickCacheResources(cache,iri,(const void *) NULL,
+    RebalanceMagickCacheResource));
+}
 
 /*
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   P u t M a g i c k C a c h e R e s o u r c e                               %
+%   R e l i n q u i s h M a g i c k C a c h e R e s o u r c e                 %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  PutMagickCacheResource() puts an image, image sequence, video, or metadata
-%  resource in the MagickCache identified by its IRI.  If the IRI already
-%  exists, an exception is returned.
+%  RelinquishMagickCacheResource() returns a resource to the cache so a later
+%  call to AcquireMagickCacheResource() can reuse its allocations.  The
+%  resource must not be referenced once it is relinquished.  The pool is
+%  bounded; resources beyond it are destroyed.
 %
-%  The format of the PutMagickCacheResource method is:
+%  The format of the RelinquishMagickCacheResource method is:
 %
-%      MagickBooleanType PutMagickCacheResource(MagickCache *cache,
-%        const MagickCacheResource *resource)
+%      MagickCacheResource *RelinquishMagickCacheResource(MagickCache *cache,
+%        MagickCacheResource *resource)
 %
 %  A description of each parameter follows:
 %
@@ -2004,99 +8618,28 @@ MagickExport MagickBooleanType IterateMagickCacheResources(MagickCache *cache,
 %
 %    o resource: the resource.
 %
-%    o blob: the blob.
-%
 */
-
-static StringInfo *SetMagickCacheResourceSentinel(
-  const MagickCacheResource *resource)
-{
-  StringInfo
-    *meta;
-
-  unsigned char
-    *p;
-
-  unsigned int
-    signature;
-
-  /*
-    Set the MagickCache resource sentinel.
-  */
-  meta=AcquireStringInfo(MagickPathExtent);
-  p=GetStringInfoDatum(meta);
-  signature=GetMagickCacheSignature(resource->nonce);
-  (void) memcpy(p,&signature,sizeof(signature));
-  p+=sizeof(signature);
-  (void) memcpy(p,GetStringInfoDatum(resource->nonce),
-    GetStringInfoLength(resource->nonce));
-  p+=GetStringInfoLength(resource->nonce);
-  (void) memcpy(p,&resource->ttl,sizeof(resource->ttl));
-  p+=sizeof(resource->ttl);
-  (void) memcpy(p,&resource->columns,sizeof(resource->columns));
-  p+=sizeof(resource->columns);
-  (void) memcpy(p,&resource->rows,sizeof(resource->rows));
-  p+=sizeof(resource->rows);
-  (void) memcpy(p,resource->id,MagickCacheDigestExtent);
-  p+=MagickCacheDigestExtent;
-  SetStringInfoLength(meta,(size_t) (p-GetStringInfoDatum(meta)));
-  return(meta);
-}
-
-MagickExport MagickBooleanType PutMagickCacheResource(MagickCache *cache,
-  MagickCacheResource *resource)
+MagickExport MagickCacheResource *RelinquishMagickCacheResource(
+  MagickCache *cache,MagickCacheResource *resource)
 {
-  char
-    *path;
-
-  MagickBooleanType
-    status;
-
-  StringInfo
-    *meta;
-
-  /*
-    Create the resource path as defined by the IRI.
-  */
   assert(cache != (MagickCache *) NULL);
   assert(cache->signature == MagickCacheSignature);
   assert(resource != (MagickCacheResource *) NULL);
   assert(resource->signature == MagickCacheSignature);
-  status=GetMagickCacheResource(cache,resource);
-  if (status != MagickFalse)
-    {
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"cannot overwrite resource","`%s'",resource->iri);
-      return(MagickFalse);
-    }
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  if (MagickCreatePath(path) == MagickFalse)
-    {
-      path=DestroyString(path);
-      (void) ThrowMagickException(resource->exception,GetMagickModule(),
-        CacheError,"cannot put resource","`%s'",path);
-      return(MagickFalse);
-    }
-  /*
-    Export the MagickCache resource metadata.
-  */
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,MagickCacheResourceSentinel);
-  if (IsPathAccessible(path) != MagickFalse)
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  LockSemaphoreInfo(cache->semaphore);
+  if (cache->number_resources < MagickCacheResourcePoolExtent)
     {
-      path=DestroyString(path);
-      errno=EEXIST;
-      return(MagickFalse);
+      resource->next=cache->resources;
+      cache->resources=resource;
+      cache->number_resources++;
+      resource=(MagickCacheResource *) NULL;
     }
-  SetMagickCacheResourceID(cache,resource);
-  meta=SetMagickCacheResourceSentinel(resource);
-  status=BlobToFile(path,GetStringInfoDatum(meta),GetStringInfoLength(meta),
-    resource->exception);
-  meta=DestroyStringInfo(meta);
-  path=DestroyString(path);
-  return(status);
+  UnlockSemaphoreInfo(cache->semaphore);
+  if (resource != (MagickCacheResource *) NULL)
+    resource=DestroyMagickCacheResource(resource);
+  return((MagickCacheResource *) NULL);
 }
 
 /*
@@ -2104,53 +8647,50 @@ MagickExport MagickBooleanType PutMagickCacheResource(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   P u t M a g i c k C a c h e R e s o u r c e B l o b                       %
+%   R e s e t M a g i c k C a c h e R e s o u r c e                           %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  PutMagickCacheResource() puts a blob resource in the MagickCache identified
-%  by its IRI.  If the IRI already exists, an exception is returned.
+%  ResetMagickCacheResource() returns a resource to its just-acquired state and
+%  associates it with a new IRI.  Its string, nonce, and exception allocations
+%  are reused, which makes it the cheap way to visit many resources in turn.
 %
-%  The format of the PutMagickCacheResource method is:
+%  The format of the ResetMagickCacheResource method is:
 %
-%      MagickBooleanType PutMagickCacheResourceBlob(MagickCache *cache,
-%        const MagickCacheResource *resource,const size_t extent,
-%        const void blob)
+%      MagickBooleanType ResetMagickCacheResource(
+%        MagickCacheResource *resource,const char *iri)
 %
 %  A description of each parameter follows:
 %
-%    o cache: the cache repository.
-%
 %    o resource: the resource.
 %
-%    o blob: the blob.
+%    o iri: the IRI.
 %
 */
-MagickExport MagickBooleanType PutMagickCacheResourceBlob(MagickCache *cache,
-  MagickCacheResource *resource,const size_t extent,const void *blob)
+MagickExport MagickBooleanType ResetMagickCacheResource(
+  MagickCacheResource *resource,const char *iri)
 {
-  char
-    *path;
-
-  MagickBooleanType
-    status;
-
-  /*
-    Puts a blob resource in the MagickCache identified by its IRI.
-  */
-  status=PutMagickCacheResource(cache,resource);
-  if (status == MagickFalse)
-    return(MagickFalse);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  status=BlobToFile(path,blob,extent,cache->exception);
-  path=DestroyString(path);
-  return(status);
+  assert(resource != (MagickCacheResource *) NULL);
+  assert(resource->signature == MagickCacheSignature);
+  if (resource->blob != NULL)
+    DestroyMagickCacheResourceBlob(resource);
+  resource->resource_type=UndefinedResourceType;
+  resource->columns=0;
+  resource->rows=0;
+  resource->depth=0;
+  resource->extent=0;
+  resource->version=MagickCacheAPIVersion;
+  resource->timestamp=0;
+  resource->ttl=0;
+  resource->memory_mapped=MagickFalse;
+  resource->encoded=MagickFalse;
+  resource->cold=MagickFalse;
+  resource->shard=0;
+  resource->sequence=0;
+  ClearMagickException(resource->exception);
+  return(SetMagickCacheResourceIRI((MagickCache *) NULL,resource,iri));
 }
 
 /*
@@ -2158,67 +8698,111 @@ MagickExport MagickBooleanType PutMagickCacheResourceBlob(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   P u t M a g i c k C a c h e R e s o u r c e I m a g e                     %
+%   S e e k M a g i c k C a c h e C u r s o r                                 %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  PutMagickCacheResourceImage() puts an image resource in the MagickCache
-%  identified by its IRI.  If the IRI already exists, an exception is returned.
+%  SeekMagickCacheCursor() positions a freshly opened sorted cursor just after
+%  the entry a continuation token was taken from.  Only the directories along
+%  the token IRI are read; resources added or removed since the token was
+%  issued are honored.
 %
-%  The format of the PutMagickCacheResourceImage method is:
+%  The format of the SeekMagickCacheCursor method is:
 %
-%      MagickBooleanType PutMagickCacheResourceImage(MagickCache *cache,
-%        const MagickCacheResource *resource,const Image *image)
+%      MagickBooleanType SeekMagickCacheCursor(MagickCacheCursor *cursor,
+%        const char *token)
 %
 %  A description of each parameter follows:
 %
-%    o cache: the cache repository.
-%
-%    o resource: the resource.
+%    o cursor: the cursor.
 %
-%    o image: the image.
+%    o token: a token from GetMagickCacheCursorToken().
 %
 */
-MagickExport MagickBooleanType PutMagickCacheResourceImage(MagickCache *cache,
-  MagickCacheResource *resource,const Image *image)
+MagickExport MagickBooleanType SeekMagickCacheCursor(MagickCacheCursor *cursor,
+  const char *token)
 {
   char
-    *path;
+    *iri,
+    name[MagickPathExtent];
 
-  Image
-    *images;
+  const char
+    *p,
+    *q;
 
-  ImageInfo
-    *image_info;
+  size_t
+    length;
 
-  MagickBooleanType
-    status;
+  unsigned char
+    *datum;
 
+  assert(cursor != (MagickCacheCursor *) NULL);
+  assert(cursor->signature == MagickCacheSignature);
+  if (((cursor->flags & SortedCursorFlag) == 0) || (cursor->depth != 1) ||
+      (cursor->frames[0].index != 0) || (*cursor->iri != '\0'))
+    {
+      (void) ThrowMagickException(cursor->cache->exception,GetMagickModule(),
+        CacheError,"cursor is not seekable","`%s'",cursor->path);
+      return(MagickFalse);
+    }
+  datum=Base64Decode(token,&length);
+  if (datum == (unsigned char *) NULL)
+    {
+      (void) ThrowMagickException(cursor->cache->exception,GetMagickModule(),
+        CacheError,"invalid continuation token","`%s'",token);
+      return(MagickFalse);
+    }
+  iri=(char *) AcquireQuantumMemory(length+1,sizeof(*iri));
+  if (iri == (char *) NULL)
+    {
+      datum=(unsigned char *) RelinquishMagickMemory(datum);
+      return(MagickFalse);
+    }
+  (void) memcpy(iri,datum,length);
+  iri[length]='\0';
+  datum=(unsigned char *) RelinquishMagickMemory(datum);
+  length=strlen(cursor->path);
+  if ((length != 0) && ((strncmp(iri,cursor->path,length) != 0) ||
+      ((iri[length] != '/') && (iri[length] != '\0'))))
+    {
+      (void) ThrowMagickException(cursor->cache->exception,GetMagickModule(),
+        CacheError,"continuation token is foreign to cursor","`%s'",iri);
+      iri=DestroyString(iri);
+      return(MagickFalse);
+    }
   /*
-    Puts an image resource in the MagickCache identified by its IRI.
+    Everything up to and including the token IRI was returned: descend along
+    its components, skipping the siblings that sort before each one.
   */
-  resource->columns=image->columns;
-  resource->rows=image->rows;
-  status=PutMagickCacheResource(cache,resource);
-  if (status == MagickFalse)
-    return(status);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  if (MagickCreatePath(path) == MagickFalse)
-    return(MagickFalse);
-  image_info=AcquireImageInfo();
-  images=CloneImageList(image,resource->exception);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  (void) FormatLocaleString(images->filename,MagickPathExtent,"mpc:%s",path);
-  path=DestroyString(path);
-  status=WriteImages(image_info,images,images->filename,resource->exception);
-  images=DestroyImageList(images);
-  image_info=DestroyImageInfo(image_info);
-  return(status);
+  cursor->frames[0].pending=MagickFalse;
+  for (p=iri+length; *p == '/'; p++) ;
+  while (*p != '\0')
+  {
+    struct CursorFrame
+      *frame;
+
+    for (q=p; (*q != '/') && (*q != '\0'); q++) ;
+    (void) CopyMagickString(name,p,MagickCacheMin((size_t) (q-p)+1,
+      MagickPathExtent));
+    frame=cursor->frames+cursor->depth-1;
+    while ((frame->index < frame->number_names) &&
+           (strcmp(frame->names[frame->index],name) < 0))
+      frame->index++;
+    if ((frame->index >= frame->number_names) ||
+        (strcmp(frame->names[frame->index],name) != 0))
+      break;
+    frame->index++;
+    if (PushMagickCacheCursorDirectory(cursor,name,MatchMagickCacheCursorName(
+          cursor,frame->states,name)) == MagickFalse)
+      break;
+    cursor->frames[cursor->depth-1].pending=MagickFalse;
+    for (p=q; *p == '/'; p++) ;
+  }
+  (void) CopyMagickString(cursor->iri,iri,MagickPathExtent);
+  iri=DestroyString(iri);
+  return(MagickTrue);
 }
 
 /*
@@ -2226,52 +8810,211 @@ MagickExport MagickBooleanType PutMagickCacheResourceImage(MagickCache *cache,
 %                                                                             %
 %                                                                             %
 %                                                                             %
-%   P u t M a g i c k C a c h e R e s o u r c e M e t a                       %
+%   S e t M a g i c k C a c h e O p t i o n                                   %
 %                                                                             %
 %                                                                             %
 %                                                                             %
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 %
-%  PutMagickCacheResourceMeta() puts metadata in the MagickCache identified by
-%  its IRI.  If the IRI already exists, an exception is returned.
-%
-%  The format of the PutMagickCacheResourceMeta method is:
-%
-%      MagickBooleanType PutMagickCacheResourceMeta(MagickCache *cache,
-%        const MagickCacheResource *resource,const char *properties)
+%  SetMagickCacheOption() sets or, if the value is NULL, removes an option of
+%  the cache repository.  Options persist in the repository and apply to
+%  every process that acquires it afterwards.  An option that cannot be
+%  applied, e.g. a root that cannot be opened, is neither set nor saved.
+%  These options are recognized:
+%
+%    capacity:extent     evict once the resources exceed this many bytes
+%                        (e.g. 10GiB)
+%    capacity:count      evict once there are more resources than this
+%    capacity:watermark  evict down to this percent of the capacity, 90 by
+%                        default
+%    eviction            lru (default) evicts the least recently accessed
+%                        resources first, lfu the least frequently
+%                        accessed, fifo the oldest
+%    access:slots        the number of access counter slots, fixed when
+%                        the access table is created, 65536 by default
+%    tier:cold           a directory, typically on cheaper storage, that
+%                        resources are demoted to instead of deleted when
+%                        capacity:extent is exceeded
+%    tier:promote        move a cold resource back once it has this many
+%                        hits, 2 by default
+%    shard:roots         more root directories, separated as in PATH, each
+%                        typically on its own disk; resource payloads are
+%                        spread across them and the cache root by a hash of
+%                        their IRI.  After adding a root, call
+%                        RebalanceMagickCacheResources().  Do not remove a
+%                        root that still holds resources.
+%    mirror:roots        more root directories, separated as in PATH, that
+%                        each hold a copy of every resource payload outside
+%                        the cold tier; reads go to the copy with the
+%                        fewest reads in flight
+%    mirror:latency      pass over a copy while its recent reads average
+%                        more than this many milliseconds, 50 by default;
+%                        such a copy is still read once a second so it is
+%                        used again once it keeps up
+%    journal             log puts and deletes so a crash cannot leave one
+%                        half done: none syncs nothing; periodic syncs the
+%                        log on the first commit at least journal:interval
+%                        seconds after the last sync (there is no timer)
+%                        and never syncs a payload; group (the default for
+%                        any other value) makes each put and delete durable
+%                        before it returns.  A group put syncs the begin
+%                        record, each payload file, the sentinel, their
+%                        directories, and the commit record; only the two
+%                        log syncs are shared, and only among the threads
+%                        of one handle.  The log is replayed when the cache
+%                        is acquired, and checkpointed once it exceeds 1MB,
+%                        whenever no process has a put or delete in flight
+%    journal:interval    the periodic journal sync interval, 1 by default
+%    changes             true records each put, delete, and expiry in a
+%                        change feed read by IterateMagickCacheChanges()
+%                        and SyncMagickCacheChanges()
+%    sync:sequence       the last change feed sequence the magick-cache
+%                        sync command applied to this repository
+%    pyramid             true stores each single frame image put with its
+%                        reductions by 2, 4, 8, ... down to 256 pixels or
+%                        less; see GetMagickCacheResourceImageLevel()
+%    source              true keeps the original encoded bytes of images
+%                        put with PutMagickCacheResourceImageBlob(); see
+%                        GetMagickCacheResourceImageSource()
+%    source:lazy         true puts images given as encoded bytes with just
+%                        those bytes; the image is decoded on its first
+%                        pixel access or by MaterializeMagickCacheResources()
+%    tiles               stores each single frame image put as square tiles
+%                        of this many pixels, 256 for true, each compressed
+%                        on its own, instead of an MPC; an extract with an
+%                        offset then decodes only the tiles it overlaps
+%    packed              true stores each single frame image put with its
+%                        samples packed at its source bit depth, recorded
+%                        in its sentinel, rather than at the quantum depth;
+%                        uncompressed 256 pixel tiles unless tiles is set
+%    frames              true stores each image sequence put as frames
+%                        located by an offset table instead of an MPC; see
+%                        GetMagickCacheResourceImageFrames()
+%
+%  The format of the SetMagickCacheOption method is:
+%
+%      MagickBooleanType SetMagickCacheOption(MagickCache *cache,
+%        const char *key,const char *value)
 %
 %  A description of each parameter follows:
 %
 %    o cache: the cache repository.
 %
-%    o resource: the resource.
+%    o key: the option key.
 %
-%    o properties: the properties.
+%    o value: the option value.
 %
 */
-MagickExport MagickBooleanType PutMagickCacheResourceMeta(MagickCache *cache,
-  MagickCacheResource *resource,const char *properties)
+static MagickBooleanType WriteMagickCacheOptions(MagickCache *cache,
+  MagickCache *destination,const MagickBooleanType roots)
+{
+  char
+    *options;
+
+  const char
+    *option;
+
+  MagickBooleanType
+    status;
+
+  /*
+    Replace the options file atomically so readers never see a partial one.
+    Without roots, the options that name other root directories are left
+    out.
+  */
+  options=AcquireString("");
+  ResetSplayTreeIterator(cache->options);
+  for (option=(const char *) GetNextKeyInSplayTree(cache->options);
+       option != (const char *) NULL;
+       option=(const char *) GetNextKeyInSplayTree(cache->options))
+  {
+    if ((roots == MagickFalse) &&
+        ((LocaleCompare(option,"mirror:roots") == 0) ||
+         (LocaleCompare(option,"shard:roots") == 0) ||
+         (LocaleCompare(option,"tier:cold") == 0)))
+      continue;
+    (void) ConcatenateString(&options,option);
+    (void) ConcatenateString(&options,"=");
+    (void) ConcatenateString(&options,(const char *) GetValueFromSplayTree(
+      cache->options,option));
+    (void) ConcatenateString(&options,"\n");
+  }
+  status=WriteMagickCacheFile(destination,MagickCacheOptions "~",O_TRUNC,
+    options,strlen(options),cache->exception);
+  options=DestroyString(options);
+  if ((status != MagickFalse) && (RenameMagickCacheFile(destination,
+       MagickCacheOptions "~",MagickCacheOptions) != 0))
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot write file","`%s'",MagickCacheOptions);
+      status=MagickFalse;
+    }
+  return(status);
+}
+
+MagickExport MagickBooleanType SetMagickCacheOption(MagickCache *cache,
+  const char *key,const char *value)
 {
   char
-    *path;
+    *previous;
+
+  const char
+    *option;
 
   MagickBooleanType
     status;
 
-  /*
-    Puts resource meta in the MagickCache identified by its IRI.
-  */
-  status=PutMagickCacheResource(cache,resource);
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  if ((key == (const char *) NULL) || (*key == '\0') ||
+      (strpbrk(key,"=\n") != (char *) NULL) ||
+      ((value != (const char *) NULL) && (strchr(value,'\n') != (char *) NULL)))
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        OptionError,"invalid cache option","`%s'",key == (const char *) NULL ?
+        "" : key);
+      return(MagickFalse);
+    }
+  previous=(char *) NULL;
+  option=GetMagickCacheOption(cache,key);
+  if (option != (const char *) NULL)
+    previous=ConstantString(option);
+  if (value == (const char *) NULL)
+    (void) DeleteNodeFromSplayTree(cache->options,key);
+  else
+    (void) AddValueToSplayTree(cache->options,ConstantString(key),
+      ConstantString(value));
+  status=SyncMagickCacheOptions(cache);
   if (status == MagickFalse)
+    {
+      /*
+        An option that cannot be applied is not saved; put the old one back.
+      */
+      if (previous == (char *) NULL)
+        (void) DeleteNodeFromSplayTree(cache->options,key);
+      else
+        {
+          (void) AddValueToSplayTree(cache->options,ConstantString(key),
+            previous);
+          previous=(char *) NULL;
+        }
+      (void) SyncMagickCacheOptions(cache);
+      return(MagickFalse);
+    }
+  if (previous != (char *) NULL)
+    previous=DestroyString(previous);
+  if (WriteMagickCacheOptions(cache,cache,MagickTrue) == MagickFalse)
     return(MagickFalse);
-  path=AcquireString(cache->path);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->iri);
-  (void) ConcatenateString(&path,"/");
-  (void) ConcatenateString(&path,resource->id);
-  status=BlobToFile(path,properties,strlen(properties)+1,cache->exception);
-  path=DestroyString(path);
-  return(status);
+  if ((cache->extent_limit == 0) && (cache->count_limit == 0) &&
+      (cache->usage != (struct CacheUsage *) NULL))
+    {
+      /*
+        No capacity, stop accounting; counters would go stale.
+      */
+      CloseMagickCacheUsage(cache);
+      (void) RemoveMagickCacheFile(cache,MagickCacheUsage);
+    }
+  return(EvictMagickCacheResources(cache));
 }
 
 /*
@@ -2302,35 +9045,32 @@ MagickExport MagickBooleanType PutMagickCacheResourceMeta(MagickCache *cache,
 MagickExport MagickBooleanType SetMagickCacheResourceIRI(MagickCache *cache,
   MagickCacheResource *resource,const char *iri)
 {
-  char
-    *path,
-    *p;
+  const char
+    *p,
+    *q;
 
   /*
     Parse the IRI into its components: project / type / resource-path.
   */
   assert(resource != (MagickCacheResource *) NULL);
   assert(resource->signature == MagickCoreSignature);
-  if (resource->iri != (char *) NULL)
-    resource->iri=DestroyString(resource->iri);
-  resource->iri=ConstantString(iri);
-  path=ConstantString(iri);
-  p=strtok(path,"/");
-  if (p == (char *) NULL)
+  (void) cache;
+  (void) CloneString(&resource->iri,iri);
+  resource->resource_type=UndefinedResourceType;
+  (void) CloneString(&resource->type,"");
+  (void) CloneString(&resource->id,"");
+  for (p=iri; *p == '/'; p++) ;
+  for (q=p; (*q != '/') && (*q != '\0'); q++) ;
+  if (q == p)
     return(MagickFalse);
-  if (resource->project != (char *) NULL)
-    resource->project=DestroyString(resource->project);
-  resource->project=ConstantString(p);
-  p=strtok(NULL,"/");
-  if (p == (char *) NULL)
+  (void) CloneString(&resource->project,p);
+  resource->project[q-p]='\0';
+  for (p=q; *p == '/'; p++) ;
+  for (q=p; (*q != '/') && (*q != '\0'); q++) ;
+  if (q == p)
     return(MagickFalse);
-  if (resource->type != (char *) NULL)
-    resource->type=DestroyString(resource->type);
-  resource->type=ConstantString(p);
-  path=DestroyString(path);
-  if (resource->id != (char *) NULL)
-    resource->id=DestroyString(resource->id);
-  resource->id=ConstantString("");
+  (void) CloneString(&resource->type,p);
+  resource->type[q-p]='\0';
   if (LocaleCompare(resource->type,"*") == 0)
     resource->resource_type=WildResourceType;
   else
@@ -2418,3 +9158,492 @@ MagickExport MagickBooleanType SetMagickCacheResourceVersion(
   resource->version=version;
   return(MagickTrue);
 }
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   S n a p s h o t M a g i c k C a c h e                                     %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  SnapshotMagickCache() creates a point-in-time copy of the cache repository
+%  at the given path, a new directory on the same file system.  Files are
+%  cloned where the file system supports it (e.g. Btrfs or XFS), so the
+%  snapshot uses space only for what diverges afterwards; otherwise resource
+%  payloads, which are never written in place, are hard linked and only the
+%  counters and logs are copied.  Subtrees are cloned in parallel.  The
+%  payloads on other root directories are gathered into the snapshot, which
+%  is self-contained and opens with the passkey of the cache.  With the
+%  journal on, puts and deletes in flight while it was taken are rolled
+%  back or finished when the snapshot is first acquired.
+%
+%  The format of the SnapshotMagickCache method is:
+%
+%      MagickBooleanType SnapshotMagickCache(MagickCache *cache,
+%        const char *path)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o path: the snapshot directory path.
+%
+*/
+
+static MagickBooleanType CloneMagickCacheFile(MagickCache *cache,
+  MagickCache *snapshot,const char *path,const MagickBooleanType immutable,
+  volatile MagickOffsetType *reflink)
+{
+#if defined(FICLONE)
+  if (MagickCacheAtomicLoad(reflink) != 0)
+    {
+      int
+        input,
+        output;
+
+      MagickBooleanType
+        status;
+
+      /*
+        A reflink shares the blocks until either file is written.  Once the
+        file system turns one down, no more are tried.
+      */
+      input=OpenMagickCacheFile(cache,path,O_RDONLY,0);
+      if (input == -1)
+        return(MagickFalse);
+      output=OpenMagickCacheFile(snapshot,path,O_WRONLY | O_CREAT | O_EXCL,
+        S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+      if (output == -1)
+        {
+          status=errno == EEXIST ? MagickTrue : MagickFalse;
+          (void) close_utf8(input);
+          return(status);
+        }
+      status=ioctl(output,FICLONE,input) == 0 ? MagickTrue : MagickFalse;
+      if ((status == MagickFalse) && ((errno == EOPNOTSUPP) ||
+          (errno == ENOTTY) || (errno == EXDEV) || (errno == EINVAL)))
+        MagickCacheAtomicStore(reflink,0);
+      (void) close_utf8(output);
+      (void) close_utf8(input);
+      if (status != MagickFalse)
+        return(MagickTrue);
+      (void) RemoveMagickCacheFile(snapshot,path);
+    }
+#else
+  (void) reflink;
+#endif
+  if (immutable != MagickFalse)
+    {
+      if ((LinkMagickCacheFile(cache,snapshot,path) == 0) || (errno == EEXIST))
+        return(MagickTrue);
+    }
+  return(CopyMagickCacheFile(cache,snapshot,path));
+}
+
+static MagickBooleanType IsMagickCacheDirectoryEntry(const MagickCache *cache,
+  const char *path,const struct dirent *entry)
+{
+  struct stat
+    attributes;
+
+#if defined(DT_DIR)
+  if ((entry->d_type != DT_UNKNOWN) && (entry->d_type != DT_LNK))
+    return(entry->d_type == DT_DIR ? MagickTrue : MagickFalse);
+#else
+  (void) entry;
+#endif
+  if (GetMagickCacheFileAttributes(cache,path,&attributes) == MagickFalse)
+    return(MagickFalse);
+  return(S_ISDIR(attributes.st_mode) != 0 ? MagickTrue : MagickFalse);
+}
+
+static MagickBooleanType CloneMagickCacheDirectory(MagickCache *cache,
+  MagickCache *snapshot,const char *path,volatile MagickOffsetType *reflink,
+  LinkedListInfo *directories)
+{
+  char
+    *child;
+
+  DIR
+    *directory;
+
+  MagickBooleanType
+    status;
+
+  struct dirent
+    *entry;
+
+  /*
+    Clone the files of a directory and create its subdirectories, which are
+    returned for the caller to clone.  The counters, logs, and sentinel at
+    the root are handled by the caller, as are interrupted tier copies.
+  */
+  directory=OpenMagickCacheDirectory(cache,path);
+  if (directory == (DIR *) NULL)
+    return(MagickFalse);
+  status=MagickTrue;
+  while ((entry=readdir(directory)) != (struct dirent *) NULL)
+  {
+    size_t
+      length;
+
+    if ((strcmp(entry->d_name,".") == 0) || (strcmp(entry->d_name,"..") == 0))
+      continue;
+    if ((*path == '\0') && (strncmp(entry->d_name,".magickcache.",13) == 0))
+      continue;
+    length=strlen(entry->d_name);
+    if ((length > 5) && (strcmp(entry->d_name+length-5,".tier") == 0))
+      continue;
+    child=AcquireString(path);
+    if (*path != '\0')
+      (void) ConcatenateString(&child,"/");
+    (void) ConcatenateString(&child,entry->d_name);
+    if (IsMagickCacheDirectoryEntry(cache,child,entry) != MagickFalse)
+      {
+        if (((CreateMagickCacheDirectory(snapshot,child) != 0) &&
+             (errno != EEXIST)) ||
+            (AppendValueToLinkedList(directories,child) == MagickFalse))
+          {
+            child=DestroyString(child);
+            status=MagickFalse;
+          }
+        continue;
+      }
+    if (CloneMagickCacheFile(cache,snapshot,child,MagickTrue,reflink) ==
+        MagickFalse)
+      status=MagickFalse;
+    child=DestroyString(child);
+  }
+  (void) closedir(directory);
+  return(status);
+}
+
+static MagickBooleanType CloneMagickCacheTree(MagickCache *cache,
+  MagickCache *snapshot,const char *path,volatile MagickOffsetType *reflink)
+{
+  char
+    *directory;
+
+  LinkedListInfo
+    *directories;
+
+  MagickBooleanType
+    status;
+
+  directories=NewLinkedList(0);
+  status=CloneMagickCacheDirectory(cache,snapshot,path,reflink,directories);
+  while ((directory=(char *) RemoveElementFromLinkedList(directories,0)) !=
+         (char *) NULL)
+  {
+    if ((status != MagickFalse) && (CloneMagickCacheTree(cache,snapshot,
+         directory,reflink) == MagickFalse))
+      status=MagickFalse;
+    directory=DestroyString(directory);
+  }
+  directories=DestroyLinkedList(directories,RelinquishMagickMemory);
+  return(status);
+}
+
+static MagickBooleanType CloneMagickCacheRoot(MagickCache *cache,
+  MagickCache *snapshot,volatile MagickOffsetType *reflink)
+{
+  char
+    **subtrees;
+
+  LinkedListInfo
+    *directories,
+    *level;
+
+  MagickBooleanType
+    status;
+
+  size_t
+    number_subtrees;
+
+  ssize_t
+    i;
+
+  /*
+    Walk the top of the tree level by level until there are enough subtrees
+    to keep every thread busy, then clone the subtrees in parallel.
+  */
+  directories=NewLinkedList(0);
+  status=CloneMagickCacheDirectory(cache,snapshot,"",reflink,directories);
+  while ((status != MagickFalse) &&
+         (GetNumberOfElementsInLinkedList(directories) != 0) &&
+         (GetNumberOfElementsInLinkedList(directories) <
+          MagickCacheSnapshotExtent))
+  {
+    char
+      *directory;
+
+    level=directories;
+    directories=NewLinkedList(0);
+    while ((directory=(char *) RemoveElementFromLinkedList(level,0)) !=
+           (char *) NULL)
+    {
+      if ((status != MagickFalse) && (CloneMagickCacheDirectory(cache,
+           snapshot,directory,reflink,directories) == MagickFalse))
+        status=MagickFalse;
+      directory=DestroyString(directory);
+    }
+    level=DestroyLinkedList(level,RelinquishMagickMemory);
+  }
+  number_subtrees=GetNumberOfElementsInLinkedList(directories);
+  subtrees=(char **) AcquireQuantumMemory(MagickCacheMax(number_subtrees,1),
+    sizeof(*subtrees));
+  if (subtrees == (char **) NULL)
+    {
+      directories=DestroyLinkedList(directories,RelinquishMagickMemory);
+      return(MagickFalse);
+    }
+  ResetLinkedListIterator(directories);
+  for (i=0; i < (ssize_t) number_subtrees; i++)
+    subtrees[i]=(char *) GetNextValueInLinkedList(directories);
+#if defined(MAGICKCORE_OPENMP_SUPPORT)
+  #pragma omp parallel for schedule(dynamic) shared(status)
+#endif
+  for (i=0; i < (ssize_t) number_subtrees; i++)
+  {
+    if (status == MagickFalse)
+      continue;
+    if (CloneMagickCacheTree(cache,snapshot,subtrees[i],reflink) ==
+        MagickFalse)
+      status=MagickFalse;
+  }
+  subtrees=(char **) RelinquishMagickMemory(subtrees);
+  directories=DestroyLinkedList(directories,RelinquishMagickMemory);
+  return(status);
+}
+
+MagickExport MagickBooleanType SnapshotMagickCache(MagickCache *cache,
+  const char *path)
+{
+  const char
+    *logs[] =
+    {
+      MagickCacheAccess,
+      MagickCacheUsage,
+      MagickCacheChanges,
+      MagickCacheJournal
+    };
+
+  MagickBooleanType
+    status;
+
+  MagickCache
+    *snapshot;
+
+  size_t
+    i;
+
+  struct stat
+    attributes;
+
+  volatile MagickOffsetType
+    reflink = 1;
+
+  /*
+    Claim the snapshot with a sentinel of its own that carries the nonce of
+    the cache, so resource IDs hold in the snapshot.
+  */
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(path != (const char *) NULL);
+  if ((MagickCreatePath(path) == MagickFalse) ||
+      (CreateMagickCacheSentinel(path,cache->passkey,cache->nonce) ==
+       MagickFalse))
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot create snapshot","`%s'",path);
+      return(MagickFalse);
+    }
+  snapshot=AcquireMagickCacheTier(path);
+  if (snapshot == (MagickCache *) NULL)
+    {
+      (void) ThrowMagickException(cache->exception,GetMagickModule(),
+        CacheError,"cannot open snapshot","`%s'",path);
+      return(MagickFalse);
+    }
+  status=WriteMagickCacheOptions(cache,snapshot,MagickFalse);
+  if (status != MagickFalse)
+    status=CloneMagickCacheRoot(cache,snapshot,&reflink);
+  for (i=1; (status != MagickFalse) && (i <= cache->number_shards); i++)
+    status=CloneMagickCacheRoot(GetMagickCacheShard(cache,i),snapshot,
+      &reflink);
+  if ((status != MagickFalse) && (cache->cold != (MagickCache *) NULL))
+    status=CloneMagickCacheRoot(cache->cold,snapshot,&reflink);
+  /*
+    The counters and logs are written in place so they are copied, last so
+    the journal covers every put and delete the walk raced with.
+  */
+  for (i=0; (status != MagickFalse) && (i < (sizeof(logs)/sizeof(*logs)));
+       i++)
+    if (GetMagickCacheFileAttributes(cache,logs[i],&attributes) != MagickFalse)
+      status=CloneMagickCacheFile(cache,snapshot,logs[i],MagickFalse,&reflink);
+  snapshot=DestroyMagickCache(snapshot);
+  if (status == MagickFalse)
+    (void) ThrowMagickException(cache->exception,GetMagickModule(),
+      CacheError,"cannot create snapshot","`%s'",path);
+  return(status);
+}
+
+/*
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%   S y n c M a g i c k C a c h e C h a n g e s                               %
+%                                                                             %
+%                                                                             %
+%                                                                             %
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+%
+%  SyncMagickCacheChanges() brings another cache repository up to date with
+%  the changes recorded in the change feed since the given sequence, then
+%  returns the sequence of the last change applied so the next sync resumes
+%  there.  For each changed IRI the copy is replaced by the current resource
+%  or deleted if the resource is gone, so a change applied twice is harmless
+%  and an interrupted sync can simply be repeated.  Resources keep their time
+%  to live and expire in the copy when they do in the cache.
+%
+%  The format of the SyncMagickCacheChanges method is:
+%
+%      MagickBooleanType SyncMagickCacheChanges(MagickCache *cache,
+%        MagickCache *target,MagickSizeType *sequence)
+%
+%  A description of each parameter follows:
+%
+%    o cache: the cache repository.
+%
+%    o target: the cache repository to bring up to date.
+%
+%    o sequence: the sequence to sync from; the sequence synced to is
+%      returned here.
+%
+*/
+
+static MagickBooleanType SyncMagickCacheChange(MagickCache *cache,
+  const MagickCacheChange *change,const void *context)
+{
+  Image
+    *image;
+
+  MagickBooleanType
+    status;
+
+  MagickCacheResource
+    *copy,
+    *resource;
+
+  struct ChangeSync
+    *sync;
+
+  time_t
+    timestamp;
+
+  /*
+    Drop the copy and, if the cache still has the resource, copy it again.
+  */
+  sync=(struct ChangeSync *) context;
+  resource=AcquireMagickCacheResource(cache,change->iri);
+  copy=AcquireMagickCacheResource(sync->target,change->iri);
+  status=MagickTrue;
+  if (GetMagickCacheResource(sync->target,copy) != MagickFalse)
+    status=DeleteMagickCacheResource(sync->target,copy);
+  if ((status != MagickFalse) &&
+      (GetMagickCacheResource(cache,resource) != MagickFalse))
+    {
+      copy->ttl=resource->ttl;
+      copy->version=resource->version;
+      timestamp=time((time_t *) NULL);
+      if (resource->ttl != 0)
+        copy->ttl=MagickCacheMax(resource->timestamp+resource->ttl-timestamp,
+          1);
+      switch (resource->resource_type)
+      {
+        case ImageResourceType:
+        {
+          char
+            *path;
+
+          /*
+            Copy the original encoded bytes if they were kept.
+          */
+          path=AcquireMagickCacheResourcePath(resource,resource->id);
+          (void) ConcatenateString(&path,".source");
+          status=ReadMagickCacheResourceFile(cache,resource,path);
+          path=DestroyString(path);
+          if (status != MagickFalse)
+            {
+              resource->encoded=MagickTrue;
+              status=PutMagickCacheResourceImageBlob(sync->target,copy,
+                resource->extent,resource->blob);
+              break;
+            }
+          ClearMagickException(resource->exception);
+          status=MagickTrue;
+          image=ReadMagickCacheImage(GetMagickCacheTier(cache,resource),
+            resource,0,(const char *) NULL);
+          if (image == (Image *) NULL)
+            {
+              status=MagickFalse;
+              break;
+            }
+          status=PutMagickCacheResourceImage(sync->target,copy,image);
+          image=DestroyImageList(image);
+          break;
+        }
+        case BlobResourceType:
+        {
+          status=ReadMagickCacheResource(cache,resource);
+          if (status != MagickFalse)
+            status=PutMagickCacheResourceBlob(sync->target,copy,
+              resource->extent,resource->blob);
+          break;
+        }
+        case MetaResourceType:
+        {
+          status=ReadMagickCacheResource(cache,resource);
+          if (status != MagickFalse)
+            status=PutMagickCacheResourceMeta(sync->target,copy,
+              (const char *) resource->blob);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+  if (status == MagickFalse)
+    (void) ThrowMagickException(cache->exception,GetMagickModule(),CacheError,
+      "cannot sync resource","`%s'",change->iri);
+  else
+    sync->sequence=change->sequence;
+  copy=RelinquishMagickCacheResource(sync->target,copy);
+  resource=RelinquishMagickCacheResource(cache,resource);
+  return(status);
+}
+
+MagickExport MagickBooleanType SyncMagickCacheChanges(MagickCache *cache,
+  MagickCache *target,MagickSizeType *sequence)
+{
+  MagickBooleanType
+    status;
+
+  struct ChangeSync
+    sync;
+
+  assert(cache != (MagickCache *) NULL);
+  assert(cache->signature == MagickCacheSignature);
+  assert(target != (MagickCache *) NULL);
+  assert(target->signature == MagickCacheSignature);
+  sync.target=target;
+  sync.sequence=(*sequence);
+  status=IterateMagickCacheChanges(cache,*sequence,&sync,SyncMagickCacheChange);
+  *sequence=sync.sequence;
+  return(status);
+}
@@ -66,6 +66,31 @@
 %
 */
 
+static size_t CountPayloads(const char *path)
+{
+  DIR
+    *directory;
+
+  size_t
+    count;
+
+  struct dirent
+    *entry;
+
+  /*
+    Count the files of a resource directory other than its sentinel.
+  */
+  count=0;
+  directory=opendir(path);
+  if (directory == (DIR *) NULL)
+    return(count);
+  while ((entry=readdir(directory)) != (struct dirent *) NULL)
+    if (*entry->d_name != '.')
+      count++;
+  (void) closedir(directory);
+  return(count);
+}
+
 static MagickBooleanType DeleteResources(MagickCache *cache,
   MagickCacheResource *resource,const void *context)
 {
@@ -314,6 +339,52 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
       fail++;
     }
 
+  (void) FormatLocaleFile(stdout,"%g: reuse magick cache resource\n",
+    (double) tests);
+  tests++;
+  count=0;
+  if (cache != (MagickCache *) NULL)
+    {
+      const MagickCacheResource
+        *pooled;
+
+      MagickCacheResource
+        *resource;
+
+      /*
+        A reset or relinquished handle keeps nothing of its previous resource.
+      */
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      if (GetMagickCacheResourceBlob(cache,resource) != (void *) NULL)
+        count++;
+      if ((SetMagickCacheResourceIRI(cache,resource,"invalid") ==
+           MagickFalse) &&
+          (GetMagickCacheResourceType(resource) == UndefinedResourceType))
+        count++;
+      if ((ResetMagickCacheResource(resource,MagickCacheResourceMetaIRI) !=
+           MagickFalse) && (GetMagickCacheResourceExtent(resource) == 0) &&
+          (GetMagickCacheResourceType(resource) == MetaResourceType) &&
+          (GetMagickCacheResourceMeta(cache,resource) != (char *) NULL))
+        count++;
+      pooled=resource;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      if (resource == (MagickCacheResource *) NULL)
+        count++;
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceImageIRI);
+      if ((resource == pooled) &&
+          (GetMagickCacheResourceExtent(resource) == 0) &&
+          (GetMagickCacheResourceType(resource) == ImageResourceType))
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+    }
+  if (count != 5)
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
   (void) FormatLocaleFile(stdout,"%g: identify magick cache resources\n",
     (double) tests);
   tests++;
@@ -332,6 +403,117 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
       fail++;
     }
 
+  (void) FormatLocaleFile(stdout,"%g: walk magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  extent=0;
+  if (cache != (MagickCache *) NULL)
+    {
+      const MagickCacheEntry
+        *entry;
+
+      MagickCacheCursor
+        *cursor;
+
+      cursor=OpenMagickCacheCursor(cache,MagickCacheResourceIRI,
+        DefaultCursorFlag);
+      for (entry=NextMagickCacheCursor(cursor);
+           entry != (const MagickCacheEntry *) NULL;
+           entry=NextMagickCacheCursor(cursor))
+      {
+        if (entry->type == ImageResourceType)
+          extent=entry->columns*entry->rows;
+        count++;
+      }
+      cursor=CloseMagickCacheCursor(cursor);
+    }
+  if ((rose == (Image *) NULL) || (count != 3) ||
+      (extent != (rose->columns*rose->rows)))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: page magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  if (cache != (MagickCache *) NULL)
+    {
+      char
+        *token = (char *) NULL;
+
+      do
+      {
+        const MagickCacheEntry
+          *entry;
+
+        MagickCacheCursor
+          *cursor;
+
+        cursor=OpenMagickCacheCursor(cache,MagickCacheResourceIRI,
+          SortedCursorFlag);
+        if (token != (char *) NULL)
+          {
+            (void) SeekMagickCacheCursor(cursor,token);
+            token=(char *) RelinquishMagickMemory(token);
+          }
+        entry=NextMagickCacheCursor(cursor);
+        if (entry != (const MagickCacheEntry *) NULL)
+          {
+            token=GetMagickCacheCursorToken(cursor);
+            count++;
+          }
+        cursor=CloseMagickCacheCursor(cursor);
+      } while ((token != (char *) NULL) && (count < 8));
+      if (token != (char *) NULL)
+        token=(char *) RelinquishMagickMemory(token);
+    }
+  if (count != 3)
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: match magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  extent=0;
+  if (cache != (MagickCache *) NULL)
+    {
+      const MagickCacheEntry
+        *entry;
+
+      MagickCacheCursor
+        *cursor;
+
+      cursor=OpenMagickCacheCursor(cache,"tests/*/r?[a-z]e",DefaultCursorFlag);
+      for (entry=NextMagickCacheCursor(cursor);
+           entry != (const MagickCacheEntry *) NULL;
+           entry=NextMagickCacheCursor(cursor))
+        count++;
+      cursor=CloseMagickCacheCursor(cursor);
+      cursor=OpenMagickCacheCursor(cache,"**/[!i]*/rose",DefaultCursorFlag);
+      for (entry=NextMagickCacheCursor(cursor);
+           entry != (const MagickCacheEntry *) NULL;
+           entry=NextMagickCacheCursor(cursor))
+        extent++;
+      cursor=CloseMagickCacheCursor(cursor);
+    }
+  if ((count != 3) || (extent != 2))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
   (void) FormatLocaleFile(stdout,"%g: get magick cache (image)\n",(double)
     tests);
   tests++;
@@ -381,6 +563,39 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
       fail++;
     }
 
+  (void) FormatLocaleFile(stdout,"%g: magick cache statistics\n",(double)
+    tests);
+  tests++;
+  count=0;
+  if (cache != (MagickCache *) NULL)
+    {
+      const MagickCacheEntry
+        *entry;
+
+      MagickCacheCursor
+        *cursor;
+
+      MagickCacheStatistics
+        statistics;
+
+      status=GetMagickCacheStatistics(cache,&statistics);
+      if (statistics.hits < 3)
+        status=MagickFalse;
+      cursor=OpenMagickCacheCursor(cache,MagickCacheResourceImageIRI,
+        DefaultCursorFlag);
+      entry=NextMagickCacheCursor(cursor);
+      if (entry != (const MagickCacheEntry *) NULL)
+        count=(size_t) entry->hits;
+      cursor=CloseMagickCacheCursor(cursor);
+    }
+  if ((status == MagickFalse) || (count == 0))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
   (void) FormatLocaleFile(stdout,"%g: expire magick cache resource\n",(double)
     tests);
   tests++;
@@ -418,11 +633,975 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
       fail++;
     }
 
+  (void) FormatLocaleFile(stdout,"%g: evict magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      const char
+        *iris[] = { "tests/blob/tulip", "tests/blob/lily", "tests/blob/iris" };
+
+      const MagickCacheEntry
+        *entry;
+
+      MagickCacheCursor
+        *cursor;
+
+      MagickCacheResource
+        *resource;
+
+      size_t
+        i;
+
+      status=SetMagickCacheOption(cache,"capacity:count","2");
+      if (status != MagickFalse)
+        status=SetMagickCacheOption(cache,"eviction","fifo");
+      for (i=0; (status != MagickFalse) && (i < 3); i++)
+      {
+        resource=AcquireMagickCacheResource(cache,iris[i]);
+        status=PutMagickCacheResourceBlob(cache,resource,
+          strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+        resource=RelinquishMagickCacheResource(cache,resource);
+      }
+      cursor=OpenMagickCacheCursor(cache,MagickCacheResourceIRI,
+        DefaultCursorFlag);
+      for (entry=NextMagickCacheCursor(cursor);
+           entry != (const MagickCacheEntry *) NULL;
+           entry=NextMagickCacheCursor(cursor))
+        count++;
+      cursor=CloseMagickCacheCursor(cursor);
+      extent=0;
+      (void) IterateMagickCacheResources(cache,MagickCacheResourceIRI,&extent,
+        DeleteResources);
+      (void) SetMagickCacheOption(cache,"capacity:count",(const char *) NULL);
+      (void) SetMagickCacheOption(cache,"eviction",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 2))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: tier magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      const MagickCacheEntry
+        *entry;
+
+      MagickCacheCursor
+        *cursor;
+
+      MagickCacheResource
+        *resource;
+
+      /*
+        A tier that cannot be opened is refused and not saved.
+      */
+      if ((SetMagickCacheOption(cache,"tier:cold",MagickCacheRepo "/"
+           MagickCacheSentinel "/cold") == MagickFalse) &&
+          (GetMagickCacheOption(cache,"tier:cold") == (const char *) NULL))
+        count++;
+      ClearMagickCacheException(cache);
+      status=SetMagickCacheOption(cache,"tier:cold",MagickCacheRepo "-cold");
+      if (status != MagickFalse)
+        status=SetMagickCacheOption(cache,"capacity:extent","1");
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceBlob(cache,resource,
+          strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+      cursor=OpenMagickCacheCursor(cache,MagickCacheResourceBlobIRI,
+        DefaultCursorFlag);
+      entry=NextMagickCacheCursor(cursor);
+      if ((entry != (const MagickCacheEntry *) NULL) &&
+          (entry->cold != MagickFalse))
+        count++;
+      cursor=CloseMagickCacheCursor(cursor);
+      blob=GetMagickCacheResourceBlob(cache,resource);
+      if ((blob != (const void *) NULL) &&
+          (memcmp(blob,MagickCacheResourceMeta,
+           strlen(MagickCacheResourceMeta)) == 0))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"capacity:extent",(const char *) NULL);
+      (void) SetMagickCacheOption(cache,"tier:cold",(const char *) NULL);
+      if (remove_utf8(MagickCacheRepo "-cold") == -1)
+        status=MagickFalse;
+    }
+  if ((status == MagickFalse) || (count != 4))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: shard magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      char
+        iri[MagickPathExtent],
+        path[MagickPathExtent];
+
+      MagickCacheResource
+        *resource;
+
+      size_t
+        primary,
+        shard,
+        sharded;
+
+      ssize_t
+        i;
+
+      status=MagickTrue;
+      sharded=0;
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      for (i=0; i < 8; i++)
+      {
+        (void) FormatLocaleString(iri,MagickPathExtent,"%s/%g",
+          MagickCacheResourceBlobIRI,(double) i);
+        (void) ResetMagickCacheResource(resource,iri);
+        status=PutMagickCacheResourceBlob(cache,resource,
+          strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+        if (status == MagickFalse)
+          break;
+      }
+      if (status != MagickFalse)
+        status=SetMagickCacheOption(cache,"shard:roots",MagickCacheRepo
+          "-shard");
+      if (status != MagickFalse)
+        status=RebalanceMagickCacheResources(cache,MagickCacheResourceBlobIRI);
+      for (i=0; i < 8; i++)
+      {
+        (void) FormatLocaleString(iri,MagickPathExtent,"%s/%g",
+          MagickCacheResourceBlobIRI,(double) i);
+        /*
+          Each payload is in exactly one root; its sentinel stays in the
+          primary one.
+        */
+        (void) FormatLocaleString(path,MagickPathExtent,"%s/%s",
+          MagickCacheRepo,iri);
+        primary=CountPayloads(path);
+        (void) FormatLocaleString(path,MagickPathExtent,"%s-shard/%s",
+          MagickCacheRepo,iri);
+        shard=CountPayloads(path);
+        if ((primary+shard) == 1)
+          count++;
+        sharded+=shard;
+        (void) ResetMagickCacheResource(resource,iri);
+        blob=GetMagickCacheResourceBlob(cache,resource);
+        if ((blob != (const void *) NULL) &&
+            (memcmp(blob,MagickCacheResourceMeta,
+             strlen(MagickCacheResourceMeta)) == 0))
+          count++;
+        if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+          count++;
+      }
+      if (sharded != 0)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"shard:roots",(const char *) NULL);
+      if (remove_utf8(MagickCacheRepo "-shard") == -1)
+        status=MagickFalse;
+    }
+  if ((status == MagickFalse) || (count != 25))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: mirror magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      MagickCacheResource
+        *resource;
+
+      ssize_t
+        i;
+
+      status=SetMagickCacheOption(cache,"mirror:roots",MagickCacheRepo
+        "-mirror");
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceBlob(cache,resource,
+          strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+      if (remove_utf8(MagickCacheRepo "-mirror") == -1)
+        count++;
+      for (i=0; i < 4; i++)
+      {
+        blob=GetMagickCacheResourceBlob(cache,resource);
+        if ((blob != (const void *) NULL) &&
+            (memcmp(blob,MagickCacheResourceMeta,
+             strlen(MagickCacheResourceMeta)) == 0))
+          count++;
+      }
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"mirror:roots",(const char *) NULL);
+      if (remove_utf8(MagickCacheRepo "-mirror") == -1)
+        status=MagickFalse;
+    }
+  if ((status == MagickFalse) || (count != 6))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: journal magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      MagickCacheResource
+        *resource;
+
+      /*
+        A put that never committed is rolled back when the cache is acquired
+        again, one that did is kept.
+      */
+      status=SetMagickCacheOption(cache,"journal","group");
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceBlob(cache,resource,
+          strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+      (void) ResetMagickCacheResource(resource,MagickCacheResourceMetaIRI);
+      if (status != MagickFalse)
+        status=PutMagickCacheResource(cache,resource);
+      resource=DestroyMagickCacheResource(resource);
+      cache=DestroyMagickCache(cache);
+      cache=AcquireMagickCache(path,passkey);
+      if (cache == (MagickCache *) NULL)
+        status=MagickFalse;
+    }
+  if (cache != (MagickCache *) NULL)
+    {
+      MagickCacheResource
+        *resource;
+
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceMetaIRI);
+      if (GetMagickCacheResource(cache,resource) == MagickFalse)
+        count++;
+      (void) ResetMagickCacheResource(resource,MagickCacheResourceBlobIRI);
+      blob=GetMagickCacheResourceBlob(cache,resource);
+      if ((blob != (const void *) NULL) &&
+          (memcmp(blob,MagickCacheResourceMeta,
+           strlen(MagickCacheResourceMeta)) == 0))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"journal",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 3))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: sync magick cache resources\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      MagickCache
+        *target = (MagickCache *) NULL;
+
+      MagickCacheResource
+        *resource;
+
+      MagickSizeType
+        sequence = 0;
+
+      /*
+        Only the resource that survives the changes reaches the target.
+      */
+      status=SetMagickCacheOption(cache,"changes","true");
+      if ((status != MagickFalse) &&
+          (CreateMagickCache(MagickCacheRepo "-sync",passkey) != MagickFalse))
+        target=AcquireMagickCache(MagickCacheRepo "-sync",passkey);
+      if (target == (MagickCache *) NULL)
+        status=MagickFalse;
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceBlob(cache,resource,
+          strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+      (void) ResetMagickCacheResource(resource,MagickCacheResourceMetaIRI);
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceMeta(cache,resource,
+          MagickCacheResourceMeta);
+      if (status != MagickFalse)
+        status=DeleteMagickCacheResource(cache,resource);
+      if (status != MagickFalse)
+        status=SyncMagickCacheChanges(cache,target,&sequence);
+      if (sequence != 0)
+        count++;
+      if (target != (MagickCache *) NULL)
+        {
+          MagickCacheResource
+            *copy;
+
+          copy=AcquireMagickCacheResource(target,MagickCacheResourceMetaIRI);
+          if (GetMagickCacheResource(target,copy) == MagickFalse)
+            count++;
+          (void) ResetMagickCacheResource(copy,MagickCacheResourceBlobIRI);
+          blob=GetMagickCacheResourceBlob(target,copy);
+          if ((blob != (const void *) NULL) &&
+              (memcmp(blob,MagickCacheResourceMeta,
+               strlen(MagickCacheResourceMeta)) == 0))
+            count++;
+          (void) ResetMagickCacheResource(resource,MagickCacheResourceBlobIRI);
+          if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+            count++;
+          if (SyncMagickCacheChanges(cache,target,&sequence) == MagickFalse)
+            status=MagickFalse;
+          if (GetMagickCacheResource(target,copy) == MagickFalse)
+            count++;
+          copy=RelinquishMagickCacheResource(target,copy);
+          target=DestroyMagickCache(target);
+        }
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"changes",(const char *) NULL);
+      (void) remove_utf8(MagickCacheRepo "-sync/" MagickCacheAccess);
+      (void) remove_utf8(MagickCacheRepo "-sync/" MagickCacheSentinel);
+      if (remove_utf8(MagickCacheRepo "-sync") == -1)
+        status=MagickFalse;
+    }
+  if ((status == MagickFalse) || (count != 5))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: snapshot magick cache\n",(double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if (cache != (MagickCache *) NULL)
+    {
+      MagickCache
+        *snapshot = (MagickCache *) NULL;
+
+      MagickCacheResource
+        *resource;
+
+      ssize_t
+        deleted = 0;
+
+      /*
+        A resource deleted after the snapshot is still in the snapshot.
+      */
+      resource=AcquireMagickCacheResource(cache,MagickCacheResourceBlobIRI);
+      status=PutMagickCacheResourceBlob(cache,resource,
+        strlen(MagickCacheResourceMeta),MagickCacheResourceMeta);
+      if (status != MagickFalse)
+        status=SnapshotMagickCache(cache,MagickCacheRepo "-snapshot");
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      if (status != MagickFalse)
+        snapshot=AcquireMagickCache(MagickCacheRepo "-snapshot",passkey);
+      if (snapshot == (MagickCache *) NULL)
+        status=MagickFalse;
+      else
+        {
+          resource=AcquireMagickCacheResource(snapshot,
+            MagickCacheResourceBlobIRI);
+          blob=GetMagickCacheResourceBlob(snapshot,resource);
+          if ((blob != (const void *) NULL) &&
+              (memcmp(blob,MagickCacheResourceMeta,
+               strlen(MagickCacheResourceMeta)) == 0))
+            count++;
+          resource=RelinquishMagickCacheResource(snapshot,resource);
+          (void) IterateMagickCacheResources(snapshot,MagickCacheResourceIRI,
+            &deleted,DeleteResources);
+          if (deleted != 0)
+            count++;
+          snapshot=DestroyMagickCache(snapshot);
+        }
+      (void) remove_utf8(MagickCacheRepo "-snapshot/" MagickCacheAccess);
+      (void) remove_utf8(MagickCacheRepo "-snapshot/" MagickCacheChanges);
+      (void) remove_utf8(MagickCacheRepo "-snapshot/" MagickCacheJournal);
+      (void) remove_utf8(MagickCacheRepo "-snapshot/" MagickCacheOptions);
+      (void) remove_utf8(MagickCacheRepo "-snapshot/" MagickCacheUsage);
+      (void) remove_utf8(MagickCacheRepo "-snapshot/" MagickCacheSentinel);
+      if (remove_utf8(MagickCacheRepo "-snapshot") == -1)
+        status=MagickFalse;
+    }
+  if ((status == MagickFalse) || (count != 3))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: source magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      MagickCacheResource
+        *resource;
+
+      size_t
+        length = 0;
+
+      void
+        *source;
+
+      /*
+        The original encoded bytes come back as they were put.
+      */
+      (void) CopyMagickString(image_info->magick,"PNG",MagickPathExtent);
+      (void) CopyMagickString(rose->magick,"PNG",MagickPathExtent);
+      source=ImageToBlob(image_info,rose,&extent,exception);
+      status=SetMagickCacheOption(cache,"source","true");
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-source");
+      if ((status != MagickFalse) && (source != (void *) NULL))
+        status=PutMagickCacheResourceImageBlob(cache,resource,extent,source);
+      blob=GetMagickCacheResourceImageSource(cache,resource,&length);
+      if ((source != (void *) NULL) && (blob != (const void *) NULL) &&
+          (length == extent) && (memcmp(blob,source,extent) == 0))
+        count++;
+      blob=GetMagickCacheResourceRendition(cache,resource,(const char *) NULL,
+        "PNG",&length);
+      if ((blob != (const void *) NULL) && (length == extent))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      if (source != (void *) NULL)
+        source=RelinquishMagickMemory(source);
+      (void) SetMagickCacheOption(cache,"source",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 3))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: lazy magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      MagickCacheResource
+        *lazy_resource,
+        *resource;
+
+      void
+        *source;
+
+      /*
+        A lazily put image is decoded on first access or when materialized.
+      */
+      (void) CopyMagickString(image_info->magick,"PNG",MagickPathExtent);
+      (void) CopyMagickString(rose->magick,"PNG",MagickPathExtent);
+      source=ImageToBlob(image_info,rose,&extent,exception);
+      status=SetMagickCacheOption(cache,"source:lazy","true");
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-lazy");
+      lazy_resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-materialize");
+      if ((status != MagickFalse) && (source != (void *) NULL))
+        status=PutMagickCacheResourceImageBlob(cache,resource,extent,source);
+      if ((status != MagickFalse) && (source != (void *) NULL))
+        status=PutMagickCacheResourceImageBlob(cache,lazy_resource,extent,
+          source);
+      GetMagickCacheResourceSize(resource,&columns,&rows);
+      if ((columns == rose->columns) && (rows == rose->rows))
+        count++;
+      /*
+        Until it is decoded the MPC header is an empty marker.
+      */
+      if ((GetMagickCacheResource(cache,resource) != MagickFalse) &&
+          (GetMagickCacheResourceExtent(resource) == 0))
+        count++;
+      image=GetMagickCacheResourceImage(cache,resource,(const char *) NULL);
+      if ((image != (const Image *) NULL) &&
+          (image->columns == rose->columns))
+        count++;
+      if (MaterializeMagickCacheResources(cache,MagickCacheResourceIRI) !=
+          MagickFalse)
+        count++;
+      if ((DeleteMagickCacheResource(cache,resource) != MagickFalse) &&
+          (DeleteMagickCacheResource(cache,lazy_resource) != MagickFalse))
+        count++;
+      /*
+        One never decoded is deleted with its encoded bytes.
+      */
+      (void) ResetMagickCacheResource(lazy_resource,
+        MagickCacheResourceImageIRI "-unmaterialized");
+      if ((status != MagickFalse) && (source != (void *) NULL) &&
+          (PutMagickCacheResourceImageBlob(cache,lazy_resource,extent,
+           source) != MagickFalse) &&
+          (DeleteMagickCacheResource(cache,lazy_resource) != MagickFalse) &&
+          (GetMagickCacheResource(cache,lazy_resource) == MagickFalse))
+        count++;
+      ClearMagickCacheResourceException(lazy_resource);
+      lazy_resource=RelinquishMagickCacheResource(cache,lazy_resource);
+      resource=RelinquishMagickCacheResource(cache,resource);
+      if (source != (void *) NULL)
+        source=RelinquishMagickMemory(source);
+      (void) SetMagickCacheOption(cache,"source:lazy",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 6))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: rendition magick cache image\n",
+    (double) tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      char
+        rendition_path[MagickPathExtent];
+
+      MagickCacheResource
+        *resource;
+
+      size_t
+        length = 0;
+
+      /*
+        The second request is a hit; the rendition is a file beside the
+        image and goes with it.
+      */
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-rendition");
+      status=PutMagickCacheResourceImage(cache,resource,rose);
+      blob=GetMagickCacheResourceRendition(cache,resource,"50x50","PNG",
+        &extent);
+      if ((blob != (const void *) NULL) && (extent > 8) &&
+          (memcmp(blob,"\211PNG",4) == 0))
+        count++;
+      blob=GetMagickCacheResourceRendition(cache,resource,"50X50","png",
+        &length);
+      if ((blob != (const void *) NULL) && (length == extent))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      (void) FormatLocaleString(rendition_path,MagickPathExtent,"%s/%s",
+        MagickCacheRepo,MagickCacheResourceImageIRI "-rendition");
+      if (CountPayloads(rendition_path) == 0)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+    }
+  if ((status == MagickFalse) || (count != 4))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: pyramid magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      Image
+        *large;
+
+      MagickCacheResource
+        *resource;
+
+      /*
+        A 700x460 image has two levels: 350x230 and 175x115.
+      */
+      status=SetMagickCacheOption(cache,"pyramid","true");
+      large=ResizeImage(rose,700,460,LanczosFilter,exception);
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-pyramid");
+      if ((status != MagickFalse) && (large != (Image *) NULL))
+        status=PutMagickCacheResourceImage(cache,resource,large);
+      image=GetMagickCacheResourceImage(cache,resource,"100x100");
+      if ((image != (const Image *) NULL) && (image->columns <= 100) &&
+          (image->rows <= 100))
+        count++;
+      image=GetMagickCacheResourceImageLevel(cache,resource,2,
+        (const char *) NULL);
+      if ((image != (const Image *) NULL) && (image->columns == 175) &&
+          (image->rows == 115))
+        count++;
+      image=GetMagickCacheResourceImageLevel(cache,resource,3,
+        (const char *) NULL);
+      if (image == (const Image *) NULL)
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      if (large != (Image *) NULL)
+        large=DestroyImage(large);
+      (void) SetMagickCacheOption(cache,"pyramid",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 4))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: stream magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      const char
+        *filename = "magick-cache-stream.ppm";
+
+      Image
+        *stream_image;
+
+      MagickCacheResource
+        *resource;
+
+      /*
+        The streamed rows are the rose pixels.
+      */
+      stream_image=CloneImage(rose,0,0,MagickTrue,exception);
+      if (stream_image != (Image *) NULL)
+        {
+          (void) CopyMagickString(stream_image->filename,filename,
+            MagickPathExtent);
+          status=WriteImage(image_info,stream_image,exception);
+          stream_image=DestroyImage(stream_image);
+        }
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-stream");
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceImageStream(cache,resource,filename);
+      if (status != MagickFalse)
+        count++;
+      image=GetMagickCacheResourceImage(cache,resource,(const char *) NULL);
+      if ((image != (const Image *) NULL) &&
+          (image->columns == rose->columns) && (image->rows == rose->rows) &&
+          (IsImagesEqual(rose,image,exception) != MagickFalse))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      (void) remove_utf8(filename);
+      /*
+        A BMP decoder returns its rows bottom up, so it is not streamed.
+      */
+      filename="magick-cache-stream.bmp";
+      stream_image=CloneImage(rose,0,0,MagickTrue,exception);
+      if (stream_image != (Image *) NULL)
+        {
+          (void) CopyMagickString(stream_image->filename,filename,
+            MagickPathExtent);
+          (void) WriteImage(image_info,stream_image,exception);
+          stream_image=DestroyImage(stream_image);
+        }
+      if (PutMagickCacheResourceImageStream(cache,resource,filename) ==
+          MagickFalse)
+        count++;
+      ClearMagickCacheResourceException(resource);
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) remove_utf8(filename);
+    }
+  if ((status == MagickFalse) || (count != 4))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: tiles magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      Image
+        *crop_image;
+
+      MagickCacheResource
+        *resource;
+
+      RectangleInfo
+        geometry = { 20, 20, 30, 20 };
+
+      /*
+        The 70x46 rose is 3x2 tiles of 32 pixels; the crop spans four.
+      */
+      status=SetMagickCacheOption(cache,"tiles","32");
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-tiles");
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceImage(cache,resource,rose);
+      image=GetMagickCacheResourceImage(cache,resource,(const char *) NULL);
+      if ((image != (const Image *) NULL) &&
+          (IsImagesEqual(rose,image,exception) != MagickFalse))
+        count++;
+      crop_image=CropImage(rose,&geometry,exception);
+      image=GetMagickCacheResourceImage(cache,resource,"20x20+30+20");
+      if ((image != (const Image *) NULL) && (crop_image != (Image *) NULL) &&
+          (image->columns == 20) && (image->rows == 20) &&
+          (IsImagesEqual(crop_image,image,exception) != MagickFalse))
+        count++;
+      if (crop_image != (Image *) NULL)
+        crop_image=DestroyImage(crop_image);
+      image=GetMagickCacheResourceImage(cache,resource,"35x23");
+      if ((image != (const Image *) NULL) && (image->columns == 35))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"tiles",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 4))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: packed magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      MagickCacheResource
+        *packed_resource,
+        *resource;
+
+      /*
+        The 8-bit rose is stored and read back at 8 bits.
+      */
+      status=SetMagickCacheOption(cache,"packed","true");
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-packed");
+      packed_resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-packed");
+      if (status != MagickFalse)
+        status=PutMagickCacheResourceImage(cache,resource,rose);
+      image=GetMagickCacheResourceImage(cache,packed_resource,
+        (const char *) NULL);
+      if ((image != (const Image *) NULL) &&
+          (IsImagesEqual(rose,image,exception) != MagickFalse))
+        count++;
+      if ((GetMagickCacheResourceDepth(packed_resource) == rose->depth) &&
+          (rose->depth == 8))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      packed_resource=RelinquishMagickCacheResource(cache,packed_resource);
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"packed",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 3))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: frames magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      Image
+        *frames;
+
+      MagickCacheResource
+        *resource;
+
+      RectangleInfo
+        large_geometry = { 20, 20, 30, 20 },
+        small_geometry = { 10, 10, 0, 0 };
+
+      /*
+        A sequence of three frames, each of a different size.
+      */
+      frames=CloneImage(rose,0,0,MagickTrue,exception);
+      if (frames != (Image *) NULL)
+        {
+          AppendImageToList(&frames,CropImage(rose,&large_geometry,exception));
+          AppendImageToList(&frames,CropImage(rose,&small_geometry,exception));
+        }
+      status=SetMagickCacheOption(cache,"frames","true");
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-frames");
+      if ((status != MagickFalse) && (frames != (Image *) NULL) &&
+          (GetImageListLength(frames) == 3))
+        status=PutMagickCacheResourceImage(cache,resource,frames);
+      else
+        status=MagickFalse;
+      image=GetMagickCacheResourceImageFrames(cache,resource,2,1,
+        (const char *) NULL);
+      if ((image != (const Image *) NULL) && (image->columns == 10) &&
+          (GetImageListLength(image) == 1))
+        count++;
+      image=GetMagickCacheResourceImageFrames(cache,resource,1,0,
+        (const char *) NULL);
+      if ((image != (const Image *) NULL) && (image->columns == 20) &&
+          (GetImageListLength(image) == 2))
+        count++;
+      /*
+        A scene past the last frame fails from the offset table alone.
+      */
+      if (GetMagickCacheResourceImageFrames(cache,resource,3,1,
+          (const char *) NULL) == (Image *) NULL)
+        count++;
+      ClearMagickCacheResourceException(resource);
+      image=GetMagickCacheResourceImage(cache,resource,(const char *) NULL);
+      if ((image != (const Image *) NULL) && (GetImageListLength(image) == 3) &&
+          (IsImagesEqual(rose,image,exception) != MagickFalse))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      if (frames != (Image *) NULL)
+        frames=DestroyImageList(frames);
+      (void) SetMagickCacheOption(cache,"frames",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 5))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
+  (void) FormatLocaleFile(stdout,"%g: regions magick cache image\n",(double)
+    tests);
+  tests++;
+  count=0;
+  status=MagickFalse;
+  if ((cache != (MagickCache *) NULL) && (rose != (Image *) NULL))
+    {
+      const char
+        *geometries[] = { "20x20+30+20", "10x10+0+0", "30x30+25+15" };
+
+      Image
+        *crop_image;
+
+      MagickCacheResource
+        *resource;
+
+      RectangleInfo
+        geometry = { 20, 20, 30, 20 };
+
+      /*
+        Three regions, the first and last overlapping, in one call.
+      */
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-regions");
+      status=PutMagickCacheResourceImage(cache,resource,rose);
+      image=GetMagickCacheResourceImageRegions(cache,resource,geometries,3);
+      if ((image != (const Image *) NULL) && (GetImageListLength(image) == 3))
+        count++;
+      crop_image=CropImage(rose,&geometry,exception);
+      if ((image != (const Image *) NULL) && (crop_image != (Image *) NULL) &&
+          (IsImagesEqual(crop_image,image,exception) != MagickFalse))
+        count++;
+      if (crop_image != (Image *) NULL)
+        crop_image=DestroyImage(crop_image);
+      if ((image != (const Image *) NULL) &&
+          (GetNextImageInList(image) != (Image *) NULL) &&
+          (GetNextImageInList(image)->columns == 10))
+        count++;
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      /*
+        The same regions from tiles, decoding only those they overlap.
+      */
+      (void) SetMagickCacheOption(cache,"tiles","32");
+      resource=AcquireMagickCacheResource(cache,
+        MagickCacheResourceImageIRI "-regions-tiles");
+      if (PutMagickCacheResourceImage(cache,resource,rose) == MagickFalse)
+        status=MagickFalse;
+      image=GetMagickCacheResourceImageRegions(cache,resource,geometries,3);
+      crop_image=CropImage(rose,&geometry,exception);
+      if ((image != (const Image *) NULL) && (crop_image != (Image *) NULL) &&
+          (GetImageListLength(image) == 3) &&
+          (IsImagesEqual(crop_image,image,exception) != MagickFalse))
+        count++;
+      if (crop_image != (Image *) NULL)
+        crop_image=DestroyImage(crop_image);
+      if (DeleteMagickCacheResource(cache,resource) != MagickFalse)
+        count++;
+      resource=RelinquishMagickCacheResource(cache,resource);
+      (void) SetMagickCacheOption(cache,"tiles",(const char *) NULL);
+    }
+  if ((status == MagickFalse) || (count != 6))
+    {
+      (void) FormatLocaleFile(stdout,"... fail @ %s/%s/%lu.\n",
+        GetMagickModule());
+      ThrowMagickCacheException(cache);
+      fail++;
+    }
+
   (void) FormatLocaleFile(stdout,"%g: delete magick cache\n",(double) tests);
   tests++;
   if (cache != (MagickCache *) NULL)
     {
       const char *path = MagickCacheRepo "/" MagickCacheSentinel;
+      (void) remove_utf8(MagickCacheRepo "/" MagickCacheAccess);
+      (void) remove_utf8(MagickCacheRepo "/" MagickCacheChanges);
+      (void) remove_utf8(MagickCacheRepo "/" MagickCacheJournal);
+      (void) remove_utf8(MagickCacheRepo "/" MagickCacheOptions);
+      (void) remove_utf8(MagickCacheRepo "/" MagickCacheUsage);
       if (remove_utf8(path) == -1)
         status=MagickFalse;
       if (remove_utf8(MagickCacheRepo) == -1)
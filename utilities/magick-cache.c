@@ -80,21 +80,43 @@ static MagickBooleanType DeleteResources(MagickCache *cache,
   return(status);
 }
 
-static MagickBooleanType ExpireResources(MagickCache *cache,
-  MagickCacheResource *resource,const void *context)
+static MagickBooleanType DefineOptions(MagickCache *cache,int argc,
+  char **argv)
 {
-  MagickBooleanType
-    status;
+  int
+    i;
 
-  ssize_t
-    *count = (ssize_t *) context;
+  /*
+    Apply each -define key=value option to the cache repository.  Every
+    option but -stream takes an argument.
+  */
+  for (i=1; i < (argc-1); i++)
+  {
+    char
+      *key,
+      *value;
 
-  status=IsMagickCacheResourceExpired(cache,resource);
-  if (status != MagickFalse)
-    {
-      (*count)++;
-      return(DeleteMagickCacheResource(cache,resource));
-    }
+    MagickBooleanType
+      status;
+
+    if (*argv[i] != '-')
+      break;
+    if (LocaleCompare(argv[i],"-stream") == 0)
+      continue;
+    if (LocaleCompare(argv[i],"-define") != 0)
+      {
+        i++;
+        continue;
+      }
+    key=ConstantString(argv[++i]);
+    value=strchr(key,'=');
+    if (value != (char *) NULL)
+      *value++='\0';
+    status=SetMagickCacheOption(cache,key,value);
+    key=DestroyString(key);
+    if (status == MagickFalse)
+      return(MagickFalse);
+  }
   return(MagickTrue);
 }
 
@@ -117,13 +139,28 @@ static void MagickCacheUsage(int argc,char **argv)
 {
   (void) fprintf(stdout,"Version: %s\n",GetMagickCacheVersion((size_t *) NULL));
   (void) fprintf(stdout,"Copyright: %s\n\n",GetMagickCacheCopyright());
-  (void) fprintf(stdout,"Usage: %s [-passkey filename] create path\n",*argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] [-define key=value]"
+    " create path\n",*argv);
   (void) fprintf(stdout,"Usage: %s [-passkey filename] "
     "[delete | expire | identify] path iri\n",*argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] [-limit count]"
+    " [-token token] list path iri\n",*argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] [-define key=value]"
+    " rebalance path iri\n",*argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] [-limit count]"
+    " stats path iri\n",*argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] materialize path iri\n",
+    *argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] snapshot path dest\n",
+    *argv);
+  (void) fprintf(stdout,"Usage: %s [-passkey filename] sync path target\n",
+    *argv);
   (void) fprintf(stdout,"Usage: %s [-passkey filename] [-passphrase filename]"
-    " [-extract geometry] [-ttl seconds] get path iri filename\n",*argv);
+    " [-extract geometry] [-level n] [-ttl seconds] get path iri filename\n",
+    *argv);
   (void) fprintf(stdout,"Usage: %s [-passkey filename] [-passphrase filename]"
-    " [-ttl seconds] put path iri filename\n",*argv);
+    " [-define key=value] [-stream] [-ttl seconds] put path iri filename\n",
+    *argv);
   exit(0);
 }
 
@@ -170,7 +207,8 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
     *function,
     *iri,
     *message = (char *) NULL,
-    *path;
+    *path,
+    *token = (char *) NULL;
 
   const char
     *meta;
@@ -188,7 +226,8 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
     i = 1;
 
   MagickBooleanType
-    status;
+    status,
+    stream = MagickFalse;
 
   MagickCache
     *cache = (MagickCache *) NULL;
@@ -200,7 +239,11 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
     type;
 
   size_t
-    extent;
+    extent,
+    limit = 0;
+
+  ssize_t
+    level = (-1);
 
   StringInfo
     *passkey = (StringInfo *) NULL,
@@ -272,8 +315,18 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
               ttl*=31536000;
           }
       }
+    if (LocaleCompare(argv[i],"-define") == 0)
+      i++;
     if (LocaleCompare(argv[i],"-extract") == 0)
       extract=argv[++i];
+    if (LocaleCompare(argv[i],"-level") == 0)
+      level=(ssize_t) InterpretLocaleValue(argv[++i],(char **) NULL);
+    if (LocaleCompare(argv[i],"-limit") == 0)
+      limit=(size_t) InterpretLocaleValue(argv[++i],(char **) NULL);
+    if (LocaleCompare(argv[i],"-stream") == 0)
+      stream=MagickTrue;
+    if (LocaleCompare(argv[i],"-token") == 0)
+      token=argv[++i];
   }
   if (i == (argc-1))
     MagickCacheUsage(argc,argv);
@@ -294,6 +347,17 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
             "unable to create magick cache","`%s': %s",path,message);
           MagickCacheExit(exception);
         }
+      cache=AcquireMagickCache(path,passkey);
+      if (cache == (MagickCache *) NULL)
+        {
+          message=GetExceptionMessage(errno);
+          (void) ThrowMagickException(exception,GetMagickModule(),OptionError,
+            "unable to open magick cache","`%s': %s",path,message);
+          MagickCacheExit(exception);
+        }
+      if (DefineOptions(cache,argc,argv) == MagickFalse)
+        ThrowMagickCacheException(cache);
+      cache=DestroyMagickCache(cache);
       return(MagickTrue);
     }
   cache=AcquireMagickCache(path,passkey);
@@ -304,6 +368,8 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
         "unable to open magick cache","`%s': %s",path,message);
       MagickCacheExit(exception);
     }
+  if (DefineOptions(cache,argc,argv) == MagickFalse)
+    ThrowMagickCacheException(cache);
   if (i == (argc-1))
     MagickCacheUsage(argc,argv);
   iri=argv[++i];
@@ -312,7 +378,13 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
   type=GetMagickCacheResourceType(resource);
   if ((LocaleCompare(function,"delete") != 0) &&
       (LocaleCompare(function,"expire") != 0) &&
-      (LocaleCompare(function,"identify") != 0))
+      (LocaleCompare(function,"identify") != 0) &&
+      (LocaleCompare(function,"list") != 0) &&
+      (LocaleCompare(function,"materialize") != 0) &&
+      (LocaleCompare(function,"rebalance") != 0) &&
+      (LocaleCompare(function,"snapshot") != 0) &&
+      (LocaleCompare(function,"stats") != 0) &&
+      (LocaleCompare(function,"sync") != 0))
     {
       if (type == UndefinedResourceType)
         {
@@ -350,8 +422,28 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
           /*
             Expire one or more resources in the cache repository.
           */
+          const MagickCacheEntry *entry;
+          MagickCacheCursor *cursor = OpenMagickCacheCursor(cache,iri,
+            NoStatCursorFlag);
           ssize_t count = 0;
-          status=IterateMagickCacheResources(cache,iri,&count,ExpireResources);
+          time_t now = time((time_t *) NULL);
+          for (entry=NextMagickCacheCursor(cursor);
+               entry != (const MagickCacheEntry *) NULL;
+               entry=NextMagickCacheCursor(cursor))
+          {
+            MagickCacheResource *expire_resource;
+            if ((entry->ttl == 0) || ((entry->timestamp+entry->ttl) >= now))
+              continue;
+            expire_resource=AcquireMagickCacheResource(cache,entry->iri);
+            if ((IsMagickCacheResourceExpired(cache,expire_resource) !=
+                 MagickFalse) &&
+                (DeleteMagickCacheResource(cache,expire_resource) !=
+                 MagickFalse))
+              count++;
+            expire_resource=RelinquishMagickCacheResource(cache,
+              expire_resource);
+          }
+          cursor=CloseMagickCacheCursor(cursor);
           (void) fprintf(stderr,"expired %g resources\n",(double) count);
           break;
         }
@@ -382,23 +474,73 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
             }
             case ImageResourceType:
             {
+              char
+                magick[MagickPathExtent];
+
               Image
                 *write_image;
 
-              image=GetMagickCacheResourceImage(cache,resource,extract);
+              void
+                *source = (void *) NULL;
+
+              if ((extract == (char *) NULL) && (level < 0) &&
+                  (passphrase == (StringInfo *) NULL) &&
+                  (IsStringTrue(GetMagickCacheOption(cache,"source")) !=
+                   MagickFalse))
+                {
+                  /*
+                    Write the original encoded bytes if they are in the
+                    format asked for.
+                  */
+                  source=GetMagickCacheResourceImageSource(cache,resource,
+                    &extent);
+                  image_info=AcquireImageInfo();
+                  (void) CopyMagickString(image_info->filename,filename,
+                    MagickPathExtent);
+                  (void) SetImageInfo(image_info,0,exception);
+                  if ((source != (void *) NULL) && (GetImageMagick(
+                       (const unsigned char *) source,extent,magick) !=
+                       MagickFalse) &&
+                      (LocaleCompare(magick,image_info->magick) == 0))
+                    status=BlobToFile(filename,source,extent,exception);
+                  else
+                    source=(void *) NULL;
+                  image_info=DestroyImageInfo(image_info);
+                  (void) ClearMagickCacheResourceException(resource);
+                }
+              if (source != (void *) NULL)
+                break;
+              if (level < 0)
+                image=GetMagickCacheResourceImage(cache,resource,extract);
+              else
+                image=GetMagickCacheResourceImageLevel(cache,resource,
+                  (size_t) level,extract);
               if (image == (Image *) NULL)
                 {
                   status=MagickFalse;
                   break;
                 }
-              image_info=AcquireImageInfo();
-              write_image=CloneImageList(image,exception);
+              /*
+                Only a scrambled image is cloned, to descramble it.
+              */
+              write_image=(Image *) image;
               if (passphrase != (StringInfo *) NULL)
-                status=PasskeyDecipherImage(write_image,passphrase,exception);
+                {
+                  write_image=CloneImageList(image,exception);
+                  if (write_image == (Image *) NULL)
+                    {
+                      status=MagickFalse;
+                      break;
+                    }
+                  status=PasskeyDecipherImage(write_image,passphrase,
+                    exception);
+                }
+              image_info=AcquireImageInfo();
               if (status != MagickFalse)
                 status=WriteImages(image_info,write_image,filename,exception);
-              write_image=DestroyImageList(write_image);
               image_info=DestroyImageInfo(image_info);
+              if (write_image != image)
+                write_image=DestroyImageList(write_image);
               break;
             }
             case MetaResourceType:
@@ -439,41 +581,8 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
             Identify one or more resources in the cache repository.
           */
           ssize_t count = 0;
-          MagickCacheResource *resource = AcquireMagickCacheResource(cache,iri);
-          MagickCacheResourceType type = GetMagickCacheResourceType(resource);
-          resource=DestroyMagickCacheResource(resource);
-          if (type != WildResourceType)
-            status=IterateMagickCacheResources(cache,iri,&count,
-              IdentifyResources);
-          else
-            {
-              char *clone_iri = AcquireString(iri);
-              (void) SubstituteString(&clone_iri,"/*/","/image/");      
-              resource=AcquireMagickCacheResource(cache,clone_iri);
-              if (resource != (MagickCacheResource *) NULL)
-                {
-                  status=IterateMagickCacheResources(cache,clone_iri,&count,
-                    IdentifyResources);
-                  resource=DestroyMagickCacheResource(resource);
-                }
-              (void) SubstituteString(&clone_iri,"/image/","/blob/");      
-              resource=AcquireMagickCacheResource(cache,clone_iri);
-              if (resource != (MagickCacheResource *) NULL)
-                {
-                  status=IterateMagickCacheResources(cache,clone_iri,&count,
-                    IdentifyResources);
-                  resource=DestroyMagickCacheResource(resource);
-                }
-              (void) SubstituteString(&clone_iri,"/blob/","/meta/");      
-              resource=AcquireMagickCacheResource(cache,clone_iri);
-              if (resource != (MagickCacheResource *) NULL)
-                {
-                  status=IterateMagickCacheResources(cache,clone_iri,&count,
-                    IdentifyResources);
-                  resource=DestroyMagickCacheResource(resource);
-                }
-              clone_iri=DestroyString(clone_iri);
-            }
+          status=IterateMagickCacheResources(cache,iri,&count,
+            IdentifyResources);
           (void) fprintf(stderr,"identified %g resources\n",(double) count);
           if (status == MagickFalse)
             {
@@ -487,6 +596,68 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
         "unrecognized magick cache function","`%s'",filename);
       MagickCacheExit(exception);
     }
+    case 'l':
+    {
+      if (LocaleCompare(function,"list") == 0)
+        {
+          /*
+            List resources in IRI order, a page at a time.
+          */
+          const MagickCacheEntry *entry;
+          MagickCacheCursor *cursor = OpenMagickCacheCursor(cache,iri,
+            SortedCursorFlag);
+          size_t count = 0;
+          if (token != (char *) NULL)
+            status=SeekMagickCacheCursor(cursor,token);
+          while ((status != MagickFalse) && ((limit == 0) || (count < limit)))
+          {
+            entry=NextMagickCacheCursor(cursor);
+            if (entry == (const MagickCacheEntry *) NULL)
+              break;
+            (void) fprintf(stdout,"%s\n",entry->iri);
+            count++;
+          }
+          if ((limit != 0) && (count == limit))
+            {
+              /*
+                Take the token before peeking; it resumes after the last entry
+                listed, and is only worth returning if the walk is not over.
+              */
+              char *continuation = GetMagickCacheCursorToken(cursor);
+              if ((continuation != (char *) NULL) &&
+                  (NextMagickCacheCursor(cursor) != (const MagickCacheEntry *)
+                   NULL))
+                (void) fprintf(stderr,"continuation token: %s\n",
+                  continuation);
+              if (continuation != (char *) NULL)
+                continuation=(char *) RelinquishMagickMemory(continuation);
+            }
+          cursor=CloseMagickCacheCursor(cursor);
+          (void) fprintf(stderr,"listed %g resources\n",(double) count);
+          if (status == MagickFalse)
+            ThrowMagickCacheException(cache);
+          break;
+        }
+      (void) ThrowMagickException(exception,GetMagickModule(),OptionError,
+        "unrecognized magick cache function","`%s'",filename);
+      MagickCacheExit(exception);
+    }
+    case 'm':
+    {
+      if (LocaleCompare(function,"materialize") == 0)
+        {
+          /*
+            Decode the images put with just their encoded bytes.
+          */
+          status=MaterializeMagickCacheResources(cache,iri);
+          if (status == MagickFalse)
+            ThrowMagickCacheException(cache);
+          break;
+        }
+      (void) ThrowMagickException(exception,GetMagickModule(),OptionError,
+        "unrecognized magick cache function","`%s'",function);
+      MagickCacheExit(exception);
+    }
     case 'p':
     {
       if (LocaleCompare(function,"put") == 0)
@@ -498,7 +669,10 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
           {
             case BlobResourceType:
             {
-              void *blob = FileToBlob(filename,~0UL,&extent,exception);
+              void
+                *blob;
+
+              blob=FileToBlob(filename,~0UL,&extent,exception);
               if (blob == (void *) NULL)
                 {
                   status=MagickFalse;
@@ -513,17 +687,44 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
               Image
                 *resource_image;
 
+              if ((passphrase == (StringInfo *) NULL) &&
+                  ((IsStringTrue(GetMagickCacheOption(cache,"source")) !=
+                    MagickFalse) ||
+                   (IsStringTrue(GetMagickCacheOption(cache,"source:lazy")) !=
+                    MagickFalse)))
+                {
+                  void
+                    *blob;
+
+                  /*
+                    Keep the original encoded bytes with the image.
+                  */
+                  blob=FileToBlob(filename,~0UL,&extent,exception);
+                  if (blob == (void *) NULL)
+                    {
+                      status=MagickFalse;
+                      break;
+                    }
+                  status=PutMagickCacheResourceImageBlob(cache,resource,
+                    extent,blob);
+                  blob=RelinquishMagickMemory(blob);
+                  break;
+                }
+              if ((passphrase == (StringInfo *) NULL) &&
+                  (stream != MagickFalse))
+                {
+                  /*
+                    Stream the image rows to the cache; for huge images.
+                  */
+                  status=PutMagickCacheResourceImageStream(cache,resource,
+                    filename);
+                  break;
+                }
               image_info=AcquireImageInfo();
               (void) CopyMagickString(image_info->filename,filename,
                 MagickPathExtent);
-              image=ReadImage(image_info,exception);
+              resource_image=ReadImage(image_info,exception);
               image_info=DestroyImageInfo(image_info);
-              if (image == (Image *) NULL)
-                {
-                  status=MagickFalse;
-                  break;
-                }
-              resource_image=CloneImageList(image,exception);
               if (resource_image == (Image *) NULL)
                 {
                   status=MagickFalse;
@@ -568,6 +769,155 @@ static MagickBooleanType MagickCacheCLI(int argc,char **argv,
          "unrecognized magick cache function","`%s'",function);
       MagickCacheExit(exception);
     }
+    case 'r':
+    {
+      if (LocaleCompare(function,"rebalance") == 0)
+        {
+          /*
+            Move resources to the root their IRI hashes to.
+          */
+          status=RebalanceMagickCacheResources(cache,iri);
+          if (status == MagickFalse)
+            ThrowMagickCacheException(cache);
+          break;
+        }
+      (void) ThrowMagickException(exception,GetMagickModule(),OptionError,
+         "unrecognized magick cache function","`%s'",function);
+      MagickCacheExit(exception);
+    }
+    case 's':
+    {
+      if (LocaleCompare(function,"snapshot") == 0)
+        {
+          /*
+            Take a point-in-time copy of the cache repository.
+          */
+          status=SnapshotMagickCache(cache,iri);
+          if (status == MagickFalse)
+            ThrowMagickCacheException(cache);
+          break;
+        }
+      if (LocaleCompare(function,"stats") == 0)
+        {
+          /*
+            Report the cache hit ratio and its most accessed resources.
+          */
+          char **hot_iris;
+          const MagickCacheEntry *entry;
+          MagickCacheCursor *cursor;
+          MagickCacheStatistics statistics;
+          MagickSizeType *hot_hits;
+          size_t count = 0, j, k;
+          if (GetMagickCacheStatistics(cache,&statistics) == MagickFalse)
+            ThrowMagickCacheException(cache);
+          (void) fprintf(stdout,"hits: %g\nmisses: %g\nhit ratio: %g\n",
+            (double) statistics.hits,(double) statistics.misses,
+            (statistics.hits+statistics.misses) == 0 ? 0.0 : (double)
+            statistics.hits/(statistics.hits+statistics.misses));
+          if ((statistics.extent != 0) || (statistics.count != 0))
+            (void) fprintf(stdout,"extent: %g\ncount: %g\n",(double)
+              statistics.extent,(double) statistics.count);
+          if (limit == 0)
+            limit=10;
+          hot_iris=(char **) AcquireQuantumMemory(limit,sizeof(*hot_iris));
+          hot_hits=(MagickSizeType *) AcquireQuantumMemory(limit,
+            sizeof(*hot_hits));
+          if ((hot_iris == (char **) NULL) ||
+              (hot_hits == (MagickSizeType *) NULL))
+            {
+              if (hot_hits != (MagickSizeType *) NULL)
+                hot_hits=(MagickSizeType *) RelinquishMagickMemory(hot_hits);
+              if (hot_iris != (char **) NULL)
+                hot_iris=(char **) RelinquishMagickMemory(hot_iris);
+              (void) ThrowMagickException(exception,GetMagickModule(),
+                ResourceLimitError,"MemoryAllocationFailed","`%s'",iri);
+              MagickCacheExit(exception);
+            }
+          cursor=OpenMagickCacheCursor(cache,iri,(MagickCacheCursorFlags)
+            (NoStatCursorFlag | NoVerifyCursorFlag));
+          for (entry=NextMagickCacheCursor(cursor);
+               entry != (const MagickCacheEntry *) NULL;
+               entry=NextMagickCacheCursor(cursor))
+          {
+            if (entry->hits == 0)
+              continue;
+            if ((count == limit) && (entry->hits <= hot_hits[count-1]))
+              continue;
+            if (count == limit)
+              {
+                count--;
+                hot_iris[count]=DestroyString(hot_iris[count]);
+              }
+            for (j=count; (j > 0) && (hot_hits[j-1] < entry->hits); j--) ;
+            for (k=count; k > j; k--)
+            {
+              hot_iris[k]=hot_iris[k-1];
+              hot_hits[k]=hot_hits[k-1];
+            }
+            hot_iris[j]=ConstantString(entry->iri);
+            hot_hits[j]=entry->hits;
+            count++;
+          }
+          cursor=CloseMagickCacheCursor(cursor);
+          for (j=0; j < count; j++)
+          {
+            (void) fprintf(stdout,"%g %s\n",(double) hot_hits[j],hot_iris[j]);
+            hot_iris[j]=DestroyString(hot_iris[j]);
+          }
+          hot_hits=(MagickSizeType *) RelinquishMagickMemory(hot_hits);
+          hot_iris=(char **) RelinquishMagickMemory(hot_iris);
+          break;
+        }
+      if (LocaleCompare(function,"sync") == 0)
+        {
+          char
+            sequence_value[MagickPathExtent];
+
+          const char
+            *value;
+
+          MagickCache
+            *target;
+
+          MagickSizeType
+            sequence = 0;
+
+          /*
+            Apply the changes since the last sync to another cache repository.
+          */
+          target=AcquireMagickCache(iri,passkey);
+          if (target == (MagickCache *) NULL)
+            {
+              message=GetExceptionMessage(errno);
+              (void) ThrowMagickException(exception,GetMagickModule(),
+                OptionError,"unable to open magick cache","`%s': %s",iri,
+                message);
+              MagickCacheExit(exception);
+            }
+          value=GetMagickCacheOption(target,"sync:sequence");
+          if (value != (const char *) NULL)
+            sequence=(MagickSizeType) InterpretLocaleValue(value,
+              (char **) NULL);
+          status=SyncMagickCacheChanges(cache,target,&sequence);
+          (void) FormatLocaleString(sequence_value,MagickPathExtent,"%.20g",
+            (double) sequence);
+          if (SetMagickCacheOption(target,"sync:sequence",sequence_value) ==
+              MagickFalse)
+            {
+              (void) ThrowMagickException(exception,GetMagickModule(),
+                OptionError,"unable to save sync sequence","`%s'",iri);
+              status=MagickFalse;
+            }
+          target=DestroyMagickCache(target);
+          (void) fprintf(stderr,"synced to sequence %s\n",sequence_value);
+          if (status == MagickFalse)
+            ThrowMagickCacheException(cache);
+          break;
+        }
+      (void) ThrowMagickException(exception,GetMagickModule(),OptionError,
+         "unrecognized magick cache function","`%s'",function);
+      MagickCacheExit(exception);
+    }
     default:
     {
       (void) ThrowMagickException(exception,GetMagickModule(),OptionError,